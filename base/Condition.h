@@ -1,6 +1,9 @@
 #ifndef __BT_CONDITON_H
 #define __BT_CONDITON_H
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
 #include <boost/noncopyable.hpp>
 
 #include "Mutex.h"
@@ -19,6 +22,18 @@ public:
     { pthread_cond_destroy(&cond_); }
 
     void wait()         { pthread_cond_wait(&cond_, mutex_.getPthreadMutex()); }
+    // returns true if time out, false otherwise.
+    bool waitForMicros(int64_t micros)
+    {
+        struct timespec abstime;
+        clock_gettime(CLOCK_REALTIME, &abstime);
+
+        int64_t nanos = abstime.tv_nsec + micros * 1000;
+        abstime.tv_sec += static_cast<time_t>(nanos / (1000 * 1000 * 1000));
+        abstime.tv_nsec = static_cast<long>(nanos % (1000 * 1000 * 1000));
+
+        return ETIMEDOUT == pthread_cond_timedwait(&cond_, mutex_.getPthreadMutex(), &abstime);
+    }
     void notify()       { pthread_cond_signal(&cond_); }
     void notify_all()   { pthread_cond_broadcast(&cond_); }
 
@@ -0,0 +1,259 @@
+#include <sched.h>
+#include <assert.h>
+#include <map>
+#include <utility>
+#include <algorithm>
+
+#include "Epoch.h"
+#include "Thread.h"
+
+using namespace bt;
+
+namespace {
+
+std::atomic<uint64_t> nextManagerId(1);
+
+// each thread remembers its record in the last few managers it touched,
+// keyed by id so a manager reusing a freed address never matches.
+struct RecordSlot
+{
+    uint64_t id;
+    void* record;
+};
+
+const int kRecordSlots = 4;
+__thread RecordSlot recordSlots[kRecordSlots];
+__thread int nextSlot = 0;
+
+// the managers alive by id, a thread exiting after its manager is gone
+// has no record to give back.
+MutexLock liveLock;
+std::map<uint64_t, void*> liveManagers; // GUARDED BY liveLock
+
+}
+
+// gives the thread's records back when it exits, so thread churn does
+// not grow the list and an exited thread never holds an epoch back.
+struct EpochManager::ThreadRecords
+{
+    ~ThreadRecords()
+    {
+        MutexLockGuard lock(liveLock);
+        for(size_t i = 0; i < held.size(); ++i) {
+            if(liveManagers.count(held[i].first))
+                release(held[i].second);
+        }
+    }
+
+    std::vector<std::pair<uint64_t, Record*> > held;
+};
+
+thread_local EpochManager::ThreadRecords EpochManager::threadRecords_;
+
+EpochManager::Record::Record()
+    : epoch(kQuiescent),
+      depth(0),
+      tid(0),
+      used(true),
+      lock(),
+      limbo(),
+      next(NULL)
+{}
+
+EpochManager::EpochManager()
+    : id_(nextManagerId.fetch_add(1)),
+      global_(0),
+      records_(NULL),
+      registerLock_()
+{
+    MutexLockGuard lock(liveLock);
+    liveManagers[id_] = this;
+}
+
+EpochManager::~EpochManager()
+{
+    {
+    MutexLockGuard lock(liveLock);
+    liveManagers.erase(id_);
+    }
+
+    synchronize();
+
+    Record* r = records_.load();
+    while(r) {
+        Record* next = r->next;
+        delete r;
+        r = next;
+    }
+}
+
+EpochManager::Record* EpochManager::record()
+{
+    for(int i = 0; i < kRecordSlots; ++i) {
+        if(recordSlots[i].id == id_)
+            return static_cast<Record*>(recordSlots[i].record);
+    }
+
+    pid_t tid = currentData::getTid();
+    Record* r = records_.load(std::memory_order_acquire);
+    while(r && !(r->tid == tid && r->used.load(std::memory_order_acquire)))
+        r = r->next;
+
+    if(r == NULL)
+        r = claim(tid);
+    if(r == NULL) {
+        r = new Record();
+        r->tid = tid;
+
+        MutexLockGuard lock(registerLock_);
+        r->next = records_.load(std::memory_order_relaxed);
+        records_.store(r, std::memory_order_release);
+    }
+    std::pair<uint64_t, Record*> held(id_, r);
+    if(std::find(threadRecords_.held.begin(), threadRecords_.held.end(), held)
+            == threadRecords_.held.end())
+        threadRecords_.held.push_back(held);
+
+    RecordSlot& slot = recordSlots[nextSlot];
+    nextSlot = (nextSlot + 1) % kRecordSlots;
+    slot.id = id_;
+    slot.record = r;
+    return r;
+}
+
+EpochManager::Record* EpochManager::claim(pid_t tid)
+{
+    for(Record* r = records_.load(std::memory_order_acquire); r; r = r->next) {
+        bool used = false;
+        if(!r->used.load(std::memory_order_relaxed)
+                && r->used.compare_exchange_strong(used, true,
+                    std::memory_order_acq_rel)) {
+            r->tid = tid;
+            return r;
+        }
+    }
+    return NULL;
+}
+
+// the record is quiescent from now on, whatever depth it was left at.
+void EpochManager::release(Record* r)
+{
+    r->depth = 0;
+    r->tid = 0;
+    r->epoch.store(kQuiescent, std::memory_order_release);
+    r->used.store(false, std::memory_order_release);
+}
+
+void EpochManager::enter()
+{
+    Record* r = record();
+    if(r->depth++ == 0) {
+        // seq_cst pairs with the load in tryAdvance, so either the
+        // advancer sees us or we see the advanced epoch.
+        uint64_t epoch = global_.load(std::memory_order_seq_cst);
+        while(true) {
+            r->epoch.store(epoch, std::memory_order_seq_cst);
+            uint64_t current = global_.load(std::memory_order_seq_cst);
+            if(current == epoch)
+                break;
+            epoch = current;
+        }
+    }
+}
+
+void EpochManager::exit()
+{
+    Record* r = record();
+    assert(r->depth > 0);
+    if(--r->depth == 0)
+        r->epoch.store(kQuiescent, std::memory_order_release);
+}
+
+void EpochManager::retire(Deleter fn, void* arg, void* ptr)
+{
+    Record* r = record();
+    Retired retired = { fn, arg, ptr, global_.load(std::memory_order_seq_cst) };
+
+    size_t pending;
+    {
+    MutexLockGuard lock(r->lock);
+    r->limbo.push_back(retired);
+    pending = r->limbo.size();
+    }
+
+    if(pending % kReclaimBatch == 0)
+        reclaim();
+}
+
+// the global epoch moves on only when every thread inside an epoch
+// has observed the current one.
+bool EpochManager::tryAdvance()
+{
+    uint64_t current = global_.load(std::memory_order_seq_cst);
+
+    for(Record* r = records_.load(std::memory_order_acquire); r; r = r->next) {
+        uint64_t local = r->epoch.load(std::memory_order_seq_cst);
+        if(local != kQuiescent && local != current)
+            return false;
+    }
+
+    return global_.compare_exchange_strong(current, current + 1);
+}
+
+void EpochManager::collect(uint64_t safeEpoch, std::vector<Retired>& ready)
+{
+    std::vector<Retired> keep;
+
+    for(Record* r = records_.load(std::memory_order_acquire); r; r = r->next) {
+        MutexLockGuard lock(r->lock);
+
+        keep.clear();
+        for(size_t i = 0; i < r->limbo.size(); ++i) {
+            if(r->limbo[i].epoch < safeEpoch)
+                ready.push_back(r->limbo[i]);
+            else
+                keep.push_back(r->limbo[i]);
+        }
+        r->limbo.swap(keep);
+    }
+}
+
+void EpochManager::reclaim()
+{
+    tryAdvance();
+
+    // a thread may still be in epoch (global - 1), anything retired
+    // before that cannot be reached any more.
+    uint64_t current = global_.load(std::memory_order_seq_cst);
+    if(current < 2)
+        return;
+
+    std::vector<Retired> ready;
+    collect(current - 1, ready);
+
+    // deleters run unlocked, they may retire more.
+    for(size_t i = 0; i < ready.size(); ++i)
+        ready[i].fn(ready[i].arg, ready[i].ptr);
+}
+
+void EpochManager::synchronize()
+{
+    while(pending()) {
+        uint64_t target = global_.load() + 2;
+        while(global_.load() < target) {
+            if(!tryAdvance())
+                sched_yield();
+        }
+        reclaim();
+    }
+}
+
+size_t EpochManager::pending()
+{
+    size_t n = 0;
+    for(Record* r = records_.load(std::memory_order_acquire); r; r = r->next) {
+        MutexLockGuard lock(r->lock);
+        n += r->limbo.size();
+    }
+    return n;
+}
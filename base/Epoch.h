@@ -0,0 +1,109 @@
+#ifndef __BT_EPOCH_H
+#define __BT_EPOCH_H
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <boost/noncopyable.hpp>
+
+#include "Mutex.h"
+
+namespace bt {
+
+// Epoch based reclamation.
+//
+// Threads that dereference shared objects without holding a lock wrap the
+// access in an EpochGuard. Objects unlinked from shared structures are
+// retire()d instead of freed, and the deleter runs only once every thread
+// that could still see them has left the epoch it was in at retire time.
+// A thread's record is given back when the thread exits, quiescent, and
+// the next new thread takes it over.
+class EpochManager : boost::noncopyable
+{
+public:
+    typedef void (*Deleter)(void* arg, void* ptr);
+
+    EpochManager();
+    // runs every pending deleter, REQUIRES no thread inside an epoch.
+    ~EpochManager();
+
+    // nestable.
+    void enter();
+    void exit();
+
+    void retire(Deleter fn, void* arg, void* ptr);
+
+    // advance the global epoch if possible and run the deleters
+    // that became safe, never blocks on other threads.
+    void reclaim();
+    // wait until everything retired so far has been freed.
+    void synchronize();
+
+    uint64_t epoch() const { return global_.load(std::memory_order_acquire); }
+    size_t pending();
+
+private:
+    struct Retired
+    {
+        Deleter fn;
+        void* arg;
+        void* ptr;
+        uint64_t epoch;
+    };
+
+    struct Record
+    {
+        std::atomic<uint64_t> epoch;
+        int depth;
+        std::atomic<pid_t> tid;
+        // held by a live thread. a free record keeps its limbo until
+        // collect() empties it.
+        std::atomic<bool> used;
+        MutexLock lock;
+        std::vector<Retired> limbo; // GUARDED BY lock
+        Record* next;
+
+        Record();
+    };
+
+    // the records of a thread, see Epoch.cpp.
+    struct ThreadRecords;
+    static thread_local ThreadRecords threadRecords_;
+
+    static const uint64_t kQuiescent = ~0ULL;
+    static const size_t kReclaimBatch = 64;
+
+    Record* record();
+    // a free record taken over by the calling thread, or NULL.
+    Record* claim(pid_t tid);
+    static void release(Record* r);
+    bool tryAdvance();
+    void collect(uint64_t safeEpoch, std::vector<Retired>& ready);
+
+    const uint64_t id_;
+    std::atomic<uint64_t> global_;
+    std::atomic<Record*> records_;
+    MutexLock registerLock_;
+};
+
+class EpochGuard : boost::noncopyable
+{
+public:
+    explicit EpochGuard(EpochManager* epoch)
+        : epoch_(epoch)
+    {
+        epoch_->enter();
+    }
+
+    ~EpochGuard()
+    {
+        epoch_->exit();
+    }
+
+private:
+    EpochManager* epoch_;
+};
+
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <semaphore.h>
+#include <atomic>
 
 
 
@@ -202,6 +203,32 @@ struct LogData
 	char _content[LOG4Z_LOG_BUF_SIZE]; //content
 };
 
+//////////////////////////////////////////////////////////////////////////
+//! Log4zRing
+//! written by its own thread, drained by the log thread. the producer only
+//! touches _head and the consumer only _tail, so neither side ever waits.
+//////////////////////////////////////////////////////////////////////////
+struct Log4zRing
+{
+	alignas(64) std::atomic<unsigned int> _head;
+	alignas(64) std::atomic<unsigned int> _tail;
+	std::atomic<unsigned long long> _dropped;
+	//! the owner thread exited, the next new thread may take the ring over.
+	std::atomic<bool> _closed;
+	Log4zRing * _next;
+	Log4zRecord _slots[LOG4Z_RING_SLOTS];
+
+	Log4zRing() : _head(0), _tail(0), _dropped(0), _closed(false), _next(NULL){}
+};
+
+static __thread Log4zRing * tlsRing = NULL;
+
+static void closeRing(void * ring)
+{
+	tlsRing = NULL;
+	static_cast<Log4zRing *>(ring)->_closed.store(true, std::memory_order_release);
+}
+
 //////////////////////////////////////////////////////////////////////////
 //! LoggerInfo
 //////////////////////////////////////////////////////////////////////////
@@ -269,6 +296,7 @@ public:
 	virtual bool stop();
 	virtual bool prePushLog(LoggerId id, int level);
 	virtual bool pushLog(LoggerId id, int level, const char * log, const char * file, int line);
+	virtual bool pushRecord(Log4zRecord & record);
 	//! 查找ID
 	virtual LoggerId findLogger(const char*  key);
 
@@ -287,13 +315,18 @@ public:
 	virtual bool isLoggerEnable(LoggerId id);
 	virtual unsigned long long getStatusTotalWriteCount(){return _ullStatusTotalWriteFileCount;}
 	virtual unsigned long long getStatusTotalWriteBytes(){return _ullStatusTotalWriteFileBytes;}
-	virtual unsigned long long getStatusWaitingCount(){return _ullStatusTotalPushLog - _ullStatusTotalPopLog;}
+	virtual unsigned long long getStatusWaitingCount();
+	virtual unsigned long long getStatusDroppedCount();
 	virtual unsigned int getStatusActiveLoggers();
 protected:
 	void showColorText(const char *text, int level = LOG_LEVEL_DEBUG);
 	bool openLogger(LogData * log);
 	bool closeLogger(LoggerId id);
-	bool popLog(LogData *& log);
+	Log4zRing * threadRing();
+	void makeLogData(const Log4zRecord & record, LogData * pLog);
+	void writeLog(LogData * pLog, int * needFlush);
+	bool drainRings(LogData * pLog, int * needFlush);
+	void reportDropped(LogData * pLog, int * needFlush);
 	virtual void run();
 private:
 
@@ -319,8 +352,13 @@ private:
 	LoggerId	_lastId; 
 	LoggerInfo _loggers[LOG4Z_LOGGER_MAX];
 
-	//! log queue
-	std::list<LogData *> _logs;
+	//! one ring per thread that ever logged, never unlinked while running.
+	std::atomic<Log4zRing *> _rings;
+	LockHelper	_ringLock;
+	pthread_key_t _ringKey;
+	//! drops already reported by the log thread.
+	unsigned long long _ullReportedDropped;
+	//! synchronous output
 	LockHelper	_logLock;
 
 	//show color lock
@@ -331,7 +369,6 @@ private:
 	unsigned long long _ullStatusTotalWriteFileBytes;
 
 	//Log queue statistics
-	unsigned long long _ullStatusTotalPushLog;
 	unsigned long long _ullStatusTotalPopLog;
 
 };
@@ -894,8 +931,10 @@ LogerManager::LogerManager()
 	_lastId = LOG4Z_MAIN_LOGGER_ID;
 	_hotUpdateInterval = 0;
 
-	_ullStatusTotalPushLog = 0;
 	_ullStatusTotalPopLog = 0;
+	_ullReportedDropped = 0;
+	_rings = NULL;
+	pthread_key_create(&_ringKey, closeRing);
 	_ullStatusTotalWriteFileCount = 0;
 	_ullStatusTotalWriteFileBytes = 0;
 	
@@ -910,6 +949,13 @@ LogerManager::LogerManager()
 LogerManager::~LogerManager()
 {
 	stop();
+	Log4zRing * ring = _rings.exchange(NULL);
+	while (ring)
+	{
+		Log4zRing * next = ring->_next;
+		delete ring;
+		ring = next;
+	}
 }
 
 
@@ -1070,33 +1116,138 @@ bool LogerManager::prePushLog(LoggerId id, int level)
 	return true;
 }
 bool LogerManager::pushLog(LoggerId id, int level, const char * log, const char * file, int line)
+{
+	//text longer than a record goes over several, in order.
+	const size_t chunk = LOG4Z_RECORD_PAYLOAD - Log4zStringArg::kFixed;
+	size_t len = strlen(log);
+	if (len <= chunk)
+	{
+		return log4zFormat(id, level, file, line, "%s", log);
+	}
+
+	char buf[chunk + 1];
+	bool ret = true;
+	for (size_t off = 0; off < len; off += chunk)
+	{
+		size_t n = len - off < chunk ? len - off : chunk;
+		memcpy(buf, log + off, n);
+		buf[n] = '\0';
+		ret = log4zFormat(id, level, file, line, "%s", buf) && ret;
+	}
+	return ret;
+}
+
+bool LogerManager::pushRecord(Log4zRecord & record)
 {
 	// discard log
-	if (id < 0 || id > _lastId || !_runing || !_loggers[id]._enable)
+	if (record._id < 0 || record._id > _lastId || !_runing || !_loggers[record._id]._enable)
 	{
 		return false;
 	}
 
 	//filter log
-	if (level < _loggers[id]._level)
+	if (record._level < _loggers[record._id]._level)
 	{
 		return false;
 	}
 
-	//create log data
-	LogData * pLog = new LogData;
-	pLog->_id =id;
-	pLog->_level = level;
-	
 	//append precise time to log
 	{
 		struct timeval tm;
 		gettimeofday(&tm, NULL);
-		pLog->_time = tm.tv_sec;
-		pLog->_precise = tm.tv_usec/1000;
+		record._time = tm.tv_sec;
+		record._precise = tm.tv_usec/1000;
+	}
+
+	if (LOG4Z_ALL_SYNCHRONOUS_OUTPUT)
+	{
+		LogData * pLog = new LogData;
+		makeLogData(record, pLog);
+		if (_loggers[pLog->_id]._display)
+		{
+			showColorText(pLog->_content, pLog->_level);
+		}
+		if (_loggers[pLog->_id]._outfile)
+		{
+			AutoLock l(_logLock);
+			if (openLogger(pLog))
+			{
+				_loggers[pLog->_id]._handle.write(pLog->_content, pLog->_contentLen);
+				closeLogger(pLog->_id);
+				_ullStatusTotalWriteFileCount++;
+				_ullStatusTotalWriteFileBytes += pLog->_contentLen;
+			}
+		}
+		delete pLog;
+		return true;
+	}
+
+	//a full ring drops the chatty levels, warnings and errors wait for
+	//the log thread to make room.
+	Log4zRing * ring = threadRing();
+	unsigned int head = ring->_head.load(std::memory_order_relaxed);
+	while (head - ring->_tail.load(std::memory_order_acquire) >= (unsigned int)LOG4Z_RING_SLOTS)
+	{
+		if (record._level < LOG_LEVEL_WARN || !_runing)
+		{
+			ring->_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		sleepMillisecond(1);
+	}
+	ring->_slots[head % LOG4Z_RING_SLOTS] = record;
+	ring->_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+Log4zRing * LogerManager::threadRing()
+{
+	if (tlsRing)
+	{
+		return tlsRing;
+	}
+
+	//take over the ring of an exited thread, its leftovers still drain in order.
+	Log4zRing * ring = NULL;
+	for (Log4zRing * r = _rings.load(std::memory_order_acquire); r; r = r->_next)
+	{
+		bool closed = true;
+		if (r->_closed.load(std::memory_order_relaxed) && r->_closed.compare_exchange_strong(closed, false))
+		{
+			ring = r;
+			break;
+		}
+	}
+
+	if (ring == NULL)
+	{
+		ring = new Log4zRing;
+		AutoLock l(_ringLock);
+		ring->_next = _rings.load(std::memory_order_relaxed);
+		_rings.store(ring, std::memory_order_release);
+	}
+
+	pthread_setspecific(_ringKey, ring);
+	tlsRing = ring;
+	return ring;
+}
+
+void LogerManager::makeLogData(const Log4zRecord & record, LogData * pLog)
+{
+	pLog->_id = record._id;
+	pLog->_level = record._level;
+	pLog->_time = record._time;
+	pLog->_precise = record._precise;
+
+	char log[LOG4Z_LOG_BUF_SIZE];
+	if (record._format(log, LOG4Z_LOG_BUF_SIZE, record._fmt, record._payload) < 0)
+	{
+		log[0] = '\0';
 	}
 
 	//format log
+	const char * file = record._file;
+	int line = record._line;
 	{
 		tm tt = timeToTm(pLog->_time);
 		if (file == NULL || !_loggers[pLog->_id]._fileLine)
@@ -1148,38 +1299,6 @@ bool LogerManager::pushLog(LoggerId id, int level, const char * log, const char
 		}
 	
 	}
-
-	if (_loggers[pLog->_id]._display && LOG4Z_ALL_SYNCHRONOUS_OUTPUT)
-	{
-		showColorText(pLog->_content, pLog->_level);
-	}
-
-	if (LOG4Z_ALL_DEBUGOUTPUT_DISPLAY && LOG4Z_ALL_SYNCHRONOUS_OUTPUT)
-	{
-	}
-
-	if (_loggers[pLog->_id]._outfile && LOG4Z_ALL_SYNCHRONOUS_OUTPUT)
-	{
-		AutoLock l(_logLock);
-		if (openLogger(pLog))
-		{
-			_loggers[pLog->_id]._handle.write(pLog->_content, pLog->_contentLen);
-			closeLogger(pLog->_id);
-			_ullStatusTotalWriteFileCount++;
-			_ullStatusTotalWriteFileBytes += pLog->_contentLen;
-		}
-	}
-
-	if (LOG4Z_ALL_SYNCHRONOUS_OUTPUT)
-	{
-		delete pLog;
-		return true;
-	}
-	
-	AutoLock l(_logLock);
-	_logs.push_back(pLog);
-	_ullStatusTotalPushLog ++;
-	return true;
 }
 
 //! 查找ID
@@ -1420,16 +1539,103 @@ bool LogerManager::closeLogger(LoggerId id)
 	}
 	return false;
 }
-bool LogerManager::popLog(LogData *& log)
+unsigned long long LogerManager::getStatusWaitingCount()
 {
-	AutoLock l(_logLock);
-	if (_logs.empty())
+	unsigned long long waiting = 0;
+	for (Log4zRing * ring = _rings.load(std::memory_order_acquire); ring; ring = ring->_next)
 	{
-		return false;
+		waiting += ring->_head.load(std::memory_order_acquire) - ring->_tail.load(std::memory_order_acquire);
 	}
-	log = _logs.front();
-	_logs.pop_front();
-	return true;
+	return waiting;
+}
+
+unsigned long long LogerManager::getStatusDroppedCount()
+{
+	unsigned long long dropped = 0;
+	for (Log4zRing * ring = _rings.load(std::memory_order_acquire); ring; ring = ring->_next)
+	{
+		dropped += ring->_dropped.load(std::memory_order_relaxed);
+	}
+	return dropped;
+}
+
+void LogerManager::writeLog(LogData * pLog, int * needFlush)
+{
+	_ullStatusTotalPopLog ++;
+	//discard
+	LoggerInfo & curLogger = _loggers[pLog->_id];
+	if (!curLogger._enable || pLog->_level <curLogger._level  )
+	{
+		return;
+	}
+
+	if (curLogger._display)
+	{
+		showColorText(pLog->_content, pLog->_level);
+	}
+
+	if (curLogger._outfile)
+	{
+		if (!openLogger(pLog))
+		{
+			return;
+		}
+
+		curLogger._handle.write(pLog->_content, pLog->_contentLen);
+		curLogger._curWriteLen += (unsigned int)pLog->_contentLen;
+		needFlush[pLog->_id] ++;
+	}
+	_ullStatusTotalWriteFileCount++;
+	_ullStatusTotalWriteFileBytes += pLog->_contentLen;
+}
+
+//! one pass over every ring, returns false if all of them were empty.
+bool LogerManager::drainRings(LogData * pLog, int * needFlush)
+{
+	bool drained = false;
+	for (Log4zRing * ring = _rings.load(std::memory_order_acquire); ring; ring = ring->_next)
+	{
+		unsigned int tail = ring->_tail.load(std::memory_order_relaxed);
+		unsigned int head = ring->_head.load(std::memory_order_acquire);
+		for (; tail != head; tail++)
+		{
+			makeLogData(ring->_slots[tail % LOG4Z_RING_SLOTS], pLog);
+			//the slot is free again once formatted.
+			ring->_tail.store(tail + 1, std::memory_order_release);
+			writeLog(pLog, needFlush);
+			drained = true;
+		}
+	}
+	return drained;
+}
+
+void LogerManager::reportDropped(LogData * pLog, int * needFlush)
+{
+	unsigned long long dropped = getStatusDroppedCount();
+	if (dropped == _ullReportedDropped)
+	{
+		return;
+	}
+
+	Log4zRecord record;
+	record._id = LOG4Z_MAIN_LOGGER_ID;
+	record._level = LOG_LEVEL_WARN;
+	record._file = NULL;
+	record._line = 0;
+	record._fmt = "log4z dropped %llu logs, the log thread can not keep up";
+	record._format = &log4zFormatRecord<unsigned long long>;
+	int budget = 0;
+	log4zEncode(record._payload, budget, dropped - _ullReportedDropped);
+	{
+		struct timeval tm;
+		gettimeofday(&tm, NULL);
+		record._time = tm.tv_sec;
+		record._precise = tm.tv_usec/1000;
+	}
+	_ullReportedDropped = dropped;
+
+	makeLogData(record, pLog);
+	writeLog(pLog, needFlush);
 }
 
 void LogerManager::run()
@@ -1454,58 +1660,13 @@ void LogerManager::run()
 	_semaphore.post();
 
 
-	LogData * pLog = NULL;
+	LogData * pLog = new LogData;
 	int needFlush[LOG4Z_LOGGER_MAX] = {0};
 	time_t lastCheckUpdate = time(NULL);
 	while (true)
 	{
-		while(popLog(pLog))
-		{
-			//
-			_ullStatusTotalPopLog ++;
-			//discard
-			LoggerInfo & curLogger = _loggers[pLog->_id];
-			if (!curLogger._enable || pLog->_level <curLogger._level  )
-			{
-				delete pLog;
-				pLog = NULL;
-				continue;
-			}
-
-
-			if (curLogger._display && !LOG4Z_ALL_SYNCHRONOUS_OUTPUT)
-			{
-				showColorText(pLog->_content, pLog->_level);
-			}
-			if (LOG4Z_ALL_DEBUGOUTPUT_DISPLAY && !LOG4Z_ALL_SYNCHRONOUS_OUTPUT)
-			{
-			}
-
-
-			if (curLogger._outfile && !LOG4Z_ALL_SYNCHRONOUS_OUTPUT)
-			{
-				if (!openLogger(pLog))
-				{
-					delete pLog;
-					pLog = NULL;
-					continue;
-				}
-
-				curLogger._handle.write(pLog->_content, pLog->_contentLen);
-				curLogger._curWriteLen += (unsigned int)pLog->_contentLen;
-				needFlush[pLog->_id] ++;
-				_ullStatusTotalWriteFileCount++;
-				_ullStatusTotalWriteFileBytes += pLog->_contentLen;
-			}
-			else if (!LOG4Z_ALL_SYNCHRONOUS_OUTPUT)
-			{
-				_ullStatusTotalWriteFileCount++;
-				_ullStatusTotalWriteFileBytes += pLog->_contentLen;
-			}
-
-			delete pLog;
-			pLog = NULL;
-		}
+		bool drained = drainRings(pLog, needFlush);
+		reportDropped(pLog, needFlush);
 
 		for (int i=0; i<=_lastId; i++)
 		{
@@ -1520,14 +1681,17 @@ void LogerManager::run()
 			}
 		}
 
-		//! delay. 
-		sleepMillisecond(100);
-
 		//! quit
-		if (!_runing && _logs.empty())
+		if (!_runing && !drained)
 		{
 			break;
 		}
+
+		//! delay only when idle, a busy ring would start dropping.
+		if (!drained)
+		{
+			sleepMillisecond(10);
+		}
 		
 		if (_hotUpdateInterval != 0 && time(NULL) - lastCheckUpdate > _hotUpdateInterval)
 		{
@@ -1538,6 +1702,7 @@ void LogerManager::run()
 
 
 	}
+	delete pLog;
 
 	for (int i=0; i <= _lastId; i++)
 	{
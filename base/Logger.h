@@ -5,6 +5,10 @@
 #include <sstream>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 #include <map>
 #include <list>
@@ -50,6 +54,13 @@ const int LOG4Z_LOGGER_MAX = 10;
 //! the max log content length.
 const int LOG4Z_LOG_BUF_SIZE = 2048;
 
+//! per thread ring of pending records, a full ring drops records below
+//! LOG_LEVEL_WARN, the others wait for room.
+const int LOG4Z_RING_SLOTS = 512;
+//! bytes of arguments one record can carry, longer strings are cut and end
+//! in "...". pushLog splits longer text over several records.
+const int LOG4Z_RECORD_PAYLOAD = 448;
+
 //! all logger synchronous output or not
 const bool LOG4Z_ALL_SYNCHRONOUS_OUTPUT = false;
 //! all logger synchronous display to the windows debug output
@@ -59,6 +70,12 @@ const bool LOG4Z_ALL_DEBUGOUTPUT_DISPLAY = false;
 const char* const LOG4Z_DEFAULT_PATH = "./log/";
 //! default log filter level
 const int LOG4Z_DEFAULT_LEVEL = LOG_LEVEL_DEBUG;
+//! compile time log filter level, set by the build (LOG_MIN_LEVEL in cmake).
+//! calls below it are compiled out, arguments are never evaluated.
+#ifndef LOG4Z_MIN_LEVEL
+#define LOG4Z_MIN_LEVEL LOG_LEVEL_TRACE
+#endif
+constexpr int LOG4Z_COMPILED_LEVEL = LOG4Z_MIN_LEVEL;
 //! default logger display
 const bool LOG4Z_DEFAULT_DISPLAY = true;
 //! default logger output to file
@@ -76,6 +93,8 @@ const bool LOG4Z_DEFAULT_SHOWSUFFIX = true;
 
 namespace bt {
 
+struct Log4zRecord;
+
 //! log4z class
 class ILog4zManager
 {
@@ -112,6 +131,9 @@ public:
 	virtual bool prePushLog(LoggerId id, int level) = 0;
 	//! Push log, thread safe.
 	virtual bool pushLog(LoggerId id, int level, const char * log, const char * file = NULL, int line = 0) = 0;
+	//! Push a deferred record into the calling thread's ring, only waits
+	//! for room if the ring is full and the level is LOG_LEVEL_WARN or up.
+	virtual bool pushRecord(Log4zRecord & record) = 0;
 
 	//! set logger's attribute, thread safe.
 	virtual bool enableLogger(LoggerId id, bool enable) = 0;
@@ -134,6 +156,7 @@ public:
 	virtual unsigned long long getStatusTotalWriteCount() = 0;
 	virtual unsigned long long getStatusTotalWriteBytes() = 0;
 	virtual unsigned long long getStatusWaitingCount() = 0;
+	virtual unsigned long long getStatusDroppedCount() = 0;
 	virtual unsigned int getStatusActiveLoggers() = 0;
 };
 
@@ -145,6 +168,7 @@ class Log4zBinary;
 //! base micro.
 #define LOG_STREAM(id, level, log)\
 do{\
+	if constexpr (level >= LOG4Z_COMPILED_LEVEL) \
 	if (bt::ILog4zManager::getPtr()->prePushLog(id,level)) \
 	{\
 		char logBuf[LOG4Z_LOG_BUF_SIZE];\
@@ -178,11 +202,11 @@ do{\
 #ifdef LOG4Z_FORMAT_INPUT_ENABLE
 #define LOG_FORMAT(id, level, logformat, ...) \
 do{ \
+	if constexpr (level >= LOG4Z_COMPILED_LEVEL) \
 	if (bt::ILog4zManager::getPtr()->prePushLog(id,level)) \
 	{\
-		char logbuf[LOG4Z_LOG_BUF_SIZE]; \
-		snprintf(logbuf, LOG4Z_LOG_BUF_SIZE,logformat, ##__VA_ARGS__); \
-		bt::ILog4zManager::getPtr()->pushLog(id, level, logbuf, __FILE__, __LINE__); \
+		if (false) snprintf(NULL, 0, logformat, ##__VA_ARGS__); \
+		bt::log4zFormat(id, level, __FILE__, __LINE__, logformat, ##__VA_ARGS__); \
 	} \
 }while(0)
 
@@ -223,6 +247,106 @@ inline void empty_log_format_function2(const char*, ...){}
 
 namespace bt {
 
+//! deferred format record. the caller only copies the format pointer and
+//! the arguments, snprintf runs later on the log thread. so the format and
+//! __FILE__ must be literals, char* arguments are copied into the payload.
+struct Log4zRecord
+{
+	typedef int (*Formatter)(char * buf, int len, const char * fmt, const char * payload);
+
+	LoggerId _id;
+	int _level;
+	time_t _time;
+	unsigned int _precise;
+	const char * _file;
+	int _line;
+	const char * _fmt;
+	Formatter _format;
+	char _payload[LOG4Z_RECORD_PAYLOAD];
+};
+
+//! scalars and pointers are copied by value.
+template<class T>
+struct Log4zArg
+{
+	static_assert(std::is_trivially_copyable<T>::value, "log argument must be a scalar or a C string");
+	typedef T Type;
+	static constexpr int kFixed = sizeof(T);
+	static inline char * encode(char * p, int & budget, T t){ memcpy(p, &t, sizeof(T)); return p + sizeof(T); }
+	static inline T decode(const char *& p){ T t; memcpy(&t, p, sizeof(T)); p += sizeof(T); return t; }
+};
+
+//! C strings are copied as length + bytes + NUL, cut to what is left of the payload.
+struct Log4zStringArg
+{
+	typedef const char * Type;
+	static constexpr int kFixed = sizeof(unsigned short) + 1;
+	static inline char * encode(char * p, int & budget, const char * s)
+	{
+		if (s == NULL)
+		{
+			s = "(null)";
+		}
+		unsigned short len = (unsigned short)strnlen(s, budget);
+		budget -= len;
+		memcpy(p, &len, sizeof(len));
+		memcpy(p + sizeof(len), s, len);
+		if (s[len] != '\0' && len >= 3)
+		{
+			memcpy(p + sizeof(len) + len - 3, "...", 3);
+		}
+		p[sizeof(len) + len] = '\0';
+		return p + kFixed + len;
+	}
+	static inline const char * decode(const char *& p)
+	{
+		unsigned short len;
+		memcpy(&len, p, sizeof(len));
+		const char * s = p + sizeof(len);
+		p += kFixed + len;
+		return s;
+	}
+};
+template<> struct Log4zArg<const char *> : Log4zStringArg {};
+template<> struct Log4zArg<char *> : Log4zStringArg {};
+
+inline char * log4zEncode(char * p, int & budget){ return p; }
+
+template<class T, class... Rest>
+inline char * log4zEncode(char * p, int & budget, T t, Rest... rest)
+{
+	p = Log4zArg<T>::encode(p, budget, t);
+	return log4zEncode(p, budget, rest...);
+}
+
+//! runs on the log thread, one instance per argument list.
+template<class... Args>
+int log4zFormatRecord(char * buf, int len, const char * fmt, const char * payload)
+{
+	//braced init decodes left to right.
+	std::tuple<typename Log4zArg<Args>::Type...> args{Log4zArg<Args>::decode(payload)...};
+	(void)payload;
+	return std::apply([&](typename Log4zArg<Args>::Type... a){ return snprintf(buf, len, fmt, a...); }, args);
+}
+
+template<class... Args>
+inline bool log4zFormat(LoggerId id, int level, const char * file, int line, const char * fmt, Args... args)
+{
+	constexpr int fixed = (0 + ... + Log4zArg<Args>::kFixed);
+	static_assert(fixed <= LOG4Z_RECORD_PAYLOAD, "too many log arguments");
+
+	Log4zRecord record;
+	record._id = id;
+	record._level = level;
+	record._file = file;
+	record._line = line;
+	record._fmt = fmt;
+	record._format = &log4zFormatRecord<Args...>;
+	int budget = LOG4Z_RECORD_PAYLOAD - fixed;
+	log4zEncode(record._payload, budget, args...);
+	return ILog4zManager::getPtr()->pushRecord(record);
+}
+
 class Log4zBinary
 {
 public:
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "Metrics.h"
+#include "Thread.h"
+
+using namespace bt;
+
+namespace {
+
+const char* const kTickerNames[Metrics::kTickerMax] = {
+    "puts",
+    "gets",
+    "dels",
+    "del_ranges",
+    "merges",
+    "cache_hits",
+    "cache_misses",
+    "push_downs",
+    "push_down_msgs",
+    "split_bufs",
+    "split_nodes",
+    "bytes_read",
+    "bytes_written",
+    "user_bytes",
+    "node_bytes_serialized",
+    "filter_skips",
+    "filter_false_positives",
+    "row_cache_hits",
+    "row_cache_misses",
+    "leaf_compactions",
+    "compaction_dropped_bytes",
+    "pivot_merges",
+    "node_merges",
+    "root_shrinks",
+    "bulk_load_keys",
+    "txn_commits",
+    "txn_retries",
+    "expired_bytes",
+};
+
+const char* const kHistogramNames[Metrics::kHistogramMax] = {
+    "put_micros",
+    "get_micros",
+    "del_micros",
+    "read_micros",
+    "write_micros",
+    "multi_get_micros",
+    "merge_micros",
+};
+
+}
+
+Metrics::Metrics()
+{
+    for(int s = 0; s < kShards; ++s) {
+        Shard& shard = shards_[s];
+        for(int i = 0; i < kTickerMax; ++i)
+            shard.tickers[i].store(0, std::memory_order_relaxed);
+        for(int l = 0; l < kMaxLevels; ++l)
+            shard.pushDownBytes[l].store(0, std::memory_order_relaxed);
+        for(int h = 0; h < kHistogramMax; ++h) {
+            HistogramData& data = shard.histograms[h];
+            data.count.store(0, std::memory_order_relaxed);
+            data.sum.store(0, std::memory_order_relaxed);
+            data.max.store(0, std::memory_order_relaxed);
+            for(int b = 0; b < kBuckets; ++b)
+                data.buckets[b].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+Metrics::Shard& Metrics::shard()
+{
+    return shards_[currentData::getTid() % kShards];
+}
+
+// values below kSubBuckets get a bucket each, above that a power of two
+// is split into kSubBuckets by the bits following the top one.
+int Metrics::bucketFor(uint64_t value)
+{
+    if(value < kSubBuckets)
+        return static_cast<int>(value);
+
+    int exp = 63 - __builtin_clzll(value);
+    int sub = static_cast<int>((value >> (exp - kSubBits)) & (kSubBuckets - 1));
+    return (exp - kSubBits + 1) * kSubBuckets + sub;
+}
+
+// the largest value falling into bucket.
+uint64_t Metrics::bucketLimit(int bucket)
+{
+    if(bucket < kSubBuckets)
+        return bucket;
+
+    int exp = bucket / kSubBuckets + kSubBits - 1;
+    uint64_t sub = bucket % kSubBuckets;
+    uint64_t low = (kSubBuckets + sub) << (exp - kSubBits);
+    return low + (1ULL << (exp - kSubBits)) - 1;
+}
+
+void Metrics::add(Ticker ticker, uint64_t n)
+{
+    shard().tickers[ticker].fetch_add(n, std::memory_order_relaxed);
+}
+
+void Metrics::record(Histogram histogram, uint64_t value)
+{
+    HistogramData& data = shard().histograms[histogram];
+    data.count.fetch_add(1, std::memory_order_relaxed);
+    data.sum.fetch_add(value, std::memory_order_relaxed);
+    data.buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = data.max.load(std::memory_order_relaxed);
+    while(value > max
+            && !data.max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        ;
+}
+
+void Metrics::addPushDownBytes(size_t level, uint64_t bytes)
+{
+    if(level >= static_cast<size_t>(kMaxLevels))
+        level = kMaxLevels - 1;
+    shard().pushDownBytes[level].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::pushDownBytes(size_t level) const
+{
+    uint64_t n = 0;
+    for(int s = 0; s < kShards; ++s)
+        n += shards_[s].pushDownBytes[level].load(std::memory_order_relaxed);
+    return n;
+}
+
+uint64_t Metrics::ticker(Ticker ticker) const
+{
+    uint64_t n = 0;
+    for(int s = 0; s < kShards; ++s)
+        n += shards_[s].tickers[ticker].load(std::memory_order_relaxed);
+    return n;
+}
+
+void Metrics::merge(Histogram histogram, uint64_t* buckets, uint64_t* count,
+        uint64_t* sum, uint64_t* max) const
+{
+    *count = *sum = *max = 0;
+    for(int b = 0; b < kBuckets; ++b)
+        buckets[b] = 0;
+
+    for(int s = 0; s < kShards; ++s) {
+        const HistogramData& data = shards_[s].histograms[histogram];
+        *count += data.count.load(std::memory_order_relaxed);
+        *sum += data.sum.load(std::memory_order_relaxed);
+        uint64_t m = data.max.load(std::memory_order_relaxed);
+        if(m > *max)
+            *max = m;
+        for(int b = 0; b < kBuckets; ++b)
+            buckets[b] += data.buckets[b].load(std::memory_order_relaxed);
+    }
+}
+
+uint64_t Metrics::percentile(Histogram histogram, double p) const
+{
+    uint64_t buckets[kBuckets];
+    uint64_t count, sum, max;
+    merge(histogram, buckets, &count, &sum, &max);
+    if(count == 0)
+        return 0;
+
+    // bucket counts are summed after count, use their own total.
+    uint64_t total = 0;
+    for(int b = 0; b < kBuckets; ++b)
+        total += buckets[b];
+
+    double threshold = total * p / 100.0;
+    uint64_t seen = 0;
+    for(int b = 0; b < kBuckets; ++b) {
+        seen += buckets[b];
+        if(seen > 0 && seen >= threshold)
+            return std::min(bucketLimit(b), max);
+    }
+    return max;
+}
+
+std::string Metrics::toString() const
+{
+    std::string out;
+    char buf[256];
+
+    for(int i = 0; i < kTickerMax; ++i) {
+        snprintf(buf, sizeof(buf), "%s: %lu\n",
+                kTickerNames[i], ticker(static_cast<Ticker>(i)));
+        out += buf;
+    }
+
+    uint64_t buckets[kBuckets];
+    for(int h = 0; h < kHistogramMax; ++h) {
+        Histogram histogram = static_cast<Histogram>(h);
+        uint64_t count, sum, max;
+        merge(histogram, buckets, &count, &sum, &max);
+        snprintf(buf, sizeof(buf),
+                "%s: count %lu avg %.1f p50 %lu p99 %lu p999 %lu max %lu\n",
+                kHistogramNames[h], count,
+                count ? static_cast<double>(sum) / count : 0.0,
+                percentile(histogram, 50), percentile(histogram, 99),
+                percentile(histogram, 99.9), max);
+        out += buf;
+    }
+
+    out += writeAmpString();
+    return out;
+}
+
+// every user byte enters the root once, a push down into level l
+// rewrites it again there. disk amplification counts whole node
+// images, a node rewritten for one new message pays for all of them.
+std::string Metrics::writeAmpString() const
+{
+    std::string out;
+    char buf[256];
+
+    uint64_t user = ticker(kUserBytes);
+    double denom = user ? static_cast<double>(user) : 1.0;
+    uint64_t moved = 0;
+
+    int deepest = 0;
+    for(int l = 0; l < kMaxLevels; ++l) {
+        if(pushDownBytes(l))
+            deepest = l;
+    }
+
+    snprintf(buf, sizeof(buf), "write_amp_level_0: bytes %lu amp 1.00\n", user);
+    out += buf;
+    for(int l = 1; l <= deepest; ++l) {
+        uint64_t bytes = pushDownBytes(l);
+        moved += bytes;
+        snprintf(buf, sizeof(buf), "write_amp_level_%d: bytes %lu amp %.2f\n",
+                l, bytes, bytes / denom);
+        out += buf;
+    }
+
+    snprintf(buf, sizeof(buf),
+            "write_amp_memory: %.2f\n"
+            "write_amp_serialized: %.2f\n"
+            "write_amp_disk: %.2f\n",
+            (user + moved) / denom,
+            ticker(kNodeBytesSerialized) / denom,
+            ticker(kBytesWritten) / denom);
+    out += buf;
+    return out;
+}
@@ -0,0 +1,158 @@
+#ifndef __BT_METRICS_H
+#define __BT_METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <atomic>
+#include <boost/noncopyable.hpp>
+
+namespace bt {
+
+// Counters and latency histograms of one DB, read by
+// DB::getProperty("bt.stats").
+//
+// Updates are relaxed atomic adds on one of kShards cache line aligned
+// shards picked by thread id, so concurrent writers rarely share a line.
+// Readers sum the shards, the result is not a point in time snapshot.
+class Metrics : boost::noncopyable
+{
+public:
+    enum Ticker {
+        kPuts,
+        kGets,
+        kDels,
+        kDelRanges,
+        kMerges,
+        kCacheHits,
+        kCacheMisses,
+        kPushDowns,
+        kPushDownMsgs,
+        kSplitBufs,
+        kSplitNodes,
+        kBytesRead,
+        kBytesWritten,
+        // key + value bytes handed to put/del.
+        kUserBytes,
+        // node images built by Layout::write.
+        kNodeBytesSerialized,
+        // buffers a get passed on a negative filter, and probed on a
+        // positive one without finding the key.
+        kFilterSkips,
+        kFilterFalsePositives,
+        kRowCacheHits,
+        kRowCacheMisses,
+        // leaf deltas folded into their runs, and the bytes of the
+        // deletes, overwritten and expired values they dropped.
+        kLeafCompactions,
+        kCompactionDroppedBytes,
+        // rebalancing after deletes: leaf pivots and sibling nodes
+        // merged, roots replaced by their only child.
+        kPivotMerges,
+        kNodeMerges,
+        kRootShrinks,
+        // pairs written by DB::bulkLoad.
+        kBulkLoadKeys,
+        // transactions committed, and refused on a conflict to be run
+        // again.
+        kTxnCommits,
+        kTxnRetries,
+        // bytes of expired values dropped by push downs and compaction.
+        kExpiredBytes,
+        kTickerMax,
+    };
+
+    enum Histogram {
+        kPutMicros,
+        kGetMicros,
+        kDelMicros,
+        kReadMicros,
+        kWriteMicros,
+        kMultiGetMicros,
+        kMergeMicros,
+        kHistogramMax,
+    };
+
+    Metrics();
+
+    // levels are counted from the root, deeper ones share the last slot.
+    static const int kMaxLevels = 8;
+
+    void add(Ticker ticker, uint64_t n = 1);
+    void record(Histogram histogram, uint64_t value);
+    // message bytes moved by a push down into a node at depth level.
+    void addPushDownBytes(size_t level, uint64_t bytes);
+
+    uint64_t ticker(Ticker ticker) const;
+    uint64_t pushDownBytes(size_t level) const;
+    // value below which p percent of the samples fall, p in [0, 100].
+    uint64_t percentile(Histogram histogram, double p) const;
+    std::string toString() const;
+    // write amplification per level, in memory and on disk.
+    std::string writeAmpString() const;
+
+    static uint64_t nowMicros()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+private:
+    // log bucketed like HDR histograms: 8 linear sub buckets per power
+    // of two, so a bucket is at most 12.5% wide.
+    static const int kSubBits = 3;
+    static const int kSubBuckets = 1 << kSubBits;
+    static const int kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+    static const int kShards = 16;
+
+    static int bucketFor(uint64_t value);
+    static uint64_t bucketLimit(int bucket);
+
+    struct HistogramData
+    {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+        std::atomic<uint64_t> buckets[kBuckets];
+    };
+
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> tickers[kTickerMax];
+        std::atomic<uint64_t> pushDownBytes[kMaxLevels];
+        HistogramData histograms[kHistogramMax];
+    };
+
+    Shard& shard();
+    void merge(Histogram histogram, uint64_t* buckets, uint64_t* count,
+            uint64_t* sum, uint64_t* max) const;
+
+    Shard shards_[kShards];
+};
+
+// records the micros from construction to destruction, metrics may be NULL.
+class MetricsTimer : boost::noncopyable
+{
+public:
+    MetricsTimer(Metrics* metrics, Metrics::Histogram histogram)
+        : metrics_(metrics),
+          histogram_(histogram),
+          start_(metrics ? Metrics::nowMicros() : 0)
+    {}
+
+    ~MetricsTimer()
+    {
+        if(metrics_)
+            metrics_->record(histogram_, Metrics::nowMicros() - start_);
+    }
+
+private:
+    Metrics* metrics_;
+    Metrics::Histogram histogram_;
+    uint64_t start_;
+};
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __BT_PINNABLE_SLICE_H
+#define __BT_PINNABLE_SLICE_H
+
+#include <string>
+#include <boost/noncopyable.hpp>
+
+#include "Slice.h"
+#include "Epoch.h"
+
+namespace bt {
+
+// Result of a zero copy get.
+//
+// Either pinned: the slice points at the value inside the tree and the
+// getting thread stays inside the epoch until reset() or destruction,
+// which keeps the value from being freed. Or self: the value was copied
+// into the handle's own string, e.g. from the row cache.
+//
+// A pinned handle must be reset on the thread that filled it, and a
+// long held pin delays every reclamation of the DB.
+class PinnableSlice : boost::noncopyable
+{
+public:
+    PinnableSlice()
+        : value_(),
+          self_(),
+          epoch_(NULL)
+    {}
+
+    ~PinnableSlice()
+    {
+        reset();
+    }
+
+    // takes over one enter() the caller did on epoch.
+    void pin(EpochManager* epoch, const Slice& value)
+    {
+        assert(epoch_ == NULL);
+        epoch_ = epoch;
+        value_ = value;
+    }
+
+    // fill self() first.
+    void pinSelf()
+    {
+        assert(epoch_ == NULL);
+        value_ = Slice(self_);
+    }
+
+    void reset()
+    {
+        if(epoch_) {
+            epoch_->exit();
+            epoch_ = NULL;
+        }
+        value_ = Slice();
+        self_.clear();
+    }
+
+    bool pinned() const { return epoch_ != NULL; }
+    std::string* self() { return &self_; }
+
+    char* data() const { return value_.data(); }
+    size_t size() const { return value_.size(); }
+    // valid as long as this handle is not reset.
+    const Slice& slice() const { return value_; }
+    std::string toString() const { return value_.toString(); }
+
+private:
+    Slice value_;
+    std::string self_;
+    EpochManager* epoch_;
+};
+
+}
+
+#endif
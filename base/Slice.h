@@ -83,10 +83,12 @@ public:
         return Slice(s, size_, slab);
     }
 
+	// optimistic readers may still hold a copy, the chunk is retired
+	// rather than freed.
 	void release()
 	{
 		if(slab_ != NULL && data_ != NULL)
-			slab_->free(data_);
+			slab_->retire(data_);
 	}
 	
 private:
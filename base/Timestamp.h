@@ -0,0 +1,49 @@
+#ifndef __BT_TIMESTAMP_H
+#define __BT_TIMESTAMP_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+namespace bt {
+
+class Timestamp
+{
+public:
+    Timestamp()
+        : microSecondsSinceEpoch_(0)
+    {}
+
+    explicit Timestamp(int64_t microSecondsSinceEpoch)
+        : microSecondsSinceEpoch_(microSecondsSinceEpoch)
+    {}
+
+    bool valid() const { return microSecondsSinceEpoch_ > 0; }
+    int64_t microSecondsSinceEpoch() const { return microSecondsSinceEpoch_; }
+
+    static Timestamp now()
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return Timestamp(tv.tv_sec * kMicroSecondsPerSecond + tv.tv_usec);
+    }
+
+    static const int64_t kMicroSecondsPerSecond = 1000 * 1000;
+
+private:
+    int64_t microSecondsSinceEpoch_;
+};
+
+inline bool operator<(Timestamp lhs, Timestamp rhs)
+{
+    return lhs.microSecondsSinceEpoch() < rhs.microSecondsSinceEpoch();
+}
+
+// microseconds elapsed from low to high
+inline int64_t timeDifference(Timestamp high, Timestamp low)
+{
+    return high.microSecondsSinceEpoch() - low.microSecondsSinceEpoch();
+}
+
+}
+
+#endif
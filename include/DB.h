@@ -3,6 +3,13 @@
 
 #include "Slice.h"
 #include "Options.h"
+#include "PinnableSlice.h"
+#include "Iterator.h"
+#include "Snapshot.h"
+#include "Transaction.h"
+
+#include <vector>
+#include <string>
 
 namespace bt {
 class DB {
@@ -10,8 +17,51 @@ public:
     static DB* open(const std::string& dbname, const Options& opts);
 	virtual ~DB(){}
     virtual bool put(Slice& key, Slice& value) = 0;
-    virtual bool get(Slice& key, Slice& value) = 0;
+    // the value reads as deleted from expireAt on, in seconds since the
+    // epoch. 0 never expires. a merge applied to it before then expires
+    // with it, an operand still pending then starts from nothing.
+    virtual bool put(Slice& key, Slice& value, uint64_t expireAt) = 0;
+    // value references the stored bytes without a copy, see PinnableSlice.
+    virtual bool get(Slice& key, PinnableSlice* value) = 0;
+    // value is copied into the caller's string.
+    virtual bool get(Slice& key, std::string* value) = 0;
+    // the value as of snapshot, from getSnapshot().
+    virtual bool get(Slice& key, std::string* value, const Snapshot* snapshot) = 0;
+    virtual bool get(Slice& key, PinnableSlice* value, const Snapshot* snapshot) = 0;
+    // looks up every key with one descent per tree, (*statuses)[i] tells
+    // whether keys[i] was found and (*values)[i] holds its value then.
+    virtual void multiGet(const std::vector<Slice>& keys,
+            std::vector<std::string>* values, std::vector<bool>* statuses) = 0;
     virtual bool del(Slice& key) = 0;
+    // applies operand to the key's value with Options::mergeOperator,
+    // without reading it. false if no merge operator is set.
+    virtual bool merge(Slice& key, Slice& operand) = 0;
+    // deletes every key in [begin, end) with one message per tree, the
+    // cost does not grow with the keys covered. false if begin >= end.
+    virtual bool deleteRange(Slice& begin, Slice& end) = 0;
+    // fills an empty DB from iter, keys strictly ascending. the trees
+    // are built bottom up and written once, none of it is buffered.
+    // false if the DB is not empty, the keys are out of order or the DB
+    // is written to meanwhile, nothing is loaded then.
+    // REQUIRES: no concurrent writes.
+    virtual bool bulkLoad(Iterator* iter) = 0;
+
+    // the DB as of now, for consistent reads while writes go on. the
+    // versions it reads are kept, release it when done. a range delete
+    // over several shards is seen in one shard and not yet in another
+    // by a snapshot taken meanwhile.
+    virtual const Snapshot* getSnapshot() = 0;
+    virtual void releaseSnapshot(const Snapshot* snapshot) = 0;
+    // an optimistic transaction, it keeps a snapshot until deleted.
+    // commits over distant keys do not wait for each other.
+    virtual Transaction* beginTransaction() = 0;
+
+    // "bt.flow": write stall counters and pending bytes.
+    // "bt.stats": operation counters and latency percentiles.
+    // "bt.write-amp": bytes rewritten per tree level and to disk
+    //                 relative to the bytes put.
+    // "bt.row-cache": row cache usage and hit rate.
+    virtual bool getProperty(const std::string& property, std::string* value) = 0;
 };
 }
 
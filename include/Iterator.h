@@ -0,0 +1,23 @@
+#ifndef __BT_ITERATOR_H
+#define __BT_ITERATOR_H
+
+#include "Slice.h"
+
+namespace bt {
+
+// Key/value pairs in ascending key order, the input of DB::bulkLoad.
+// key() and value() stay valid until the next call to next().
+class Iterator
+{
+public:
+    virtual ~Iterator() {}
+
+    virtual bool valid() const = 0;
+    virtual Slice key() const = 0;
+    virtual Slice value() const = 0;
+    virtual void next() = 0;
+};
+
+}
+
+#endif
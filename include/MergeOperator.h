@@ -0,0 +1,31 @@
+#ifndef __BT_MERGE_OPERATOR_H
+#define __BT_MERGE_OPERATOR_H
+
+#include <string>
+
+#include "Slice.h"
+
+namespace bt {
+
+// Combines merge operands with a key's value, so updates like counter
+// increments or appends are written blind, without a get first.
+//
+// The tree folds operands into each other as they meet in a buffer,
+// so merge must be associative: merging a then b into v must equal
+// merging into v the result of merging b into a.
+class MergeOperator
+{
+public:
+    virtual ~MergeOperator() {}
+
+    // existing is NULL when the key has no value, or an older operand
+    // when two operands are combined. false drops the update.
+    virtual bool merge(const Slice& key, const Slice* existing,
+            const Slice& operand, std::string* result) const = 0;
+
+    virtual const char* name() const = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __BT_SNAPSHOT_H
+#define __BT_SNAPSHOT_H
+
+#include <stdint.h>
+
+namespace bt {
+
+// A point in the DB's history from DB::getSnapshot(), reads given it
+// see the writes made before it and none of the later ones. The
+// versions it sees are kept until DB::releaseSnapshot().
+class Snapshot
+{
+public:
+    explicit Snapshot(uint64_t sequence) : sequence_(sequence) {}
+
+    // of the last write it sees.
+    uint64_t sequence() const { return sequence_; }
+
+private:
+    uint64_t sequence_;
+};
+
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __BT_TRANSACTION_H
+#define __BT_TRANSACTION_H
+
+#include <string>
+
+#include "Slice.h"
+
+namespace bt {
+
+// A read-modify-write over several keys from DB::beginTransaction().
+//
+// Reads see the DB as of the begin plus the transaction's own writes,
+// the writes stay private until commit(). commit() applies all of them
+// at once if no key read was written since the begin, by a transaction
+// or a plain write, else it applies nothing and the work has to be
+// redone in a new transaction. Not thread safe, delete it when done.
+class Transaction
+{
+public:
+    virtual ~Transaction() {}
+
+    // the key joins the read set, found or not.
+    virtual bool get(Slice& key, std::string* value) = 0;
+    virtual void put(Slice& key, Slice& value) = 0;
+    virtual void del(Slice& key) = 0;
+    // false on a conflict. the transaction is done either way.
+    virtual bool commit() = 0;
+};
+
+}
+
+#endif
@@ -3,20 +3,28 @@
 #include "Layout.h"
 #include "Node.h"
 #include "Mutex.h"
+#include "Epoch.h"
+#include "RowCache.h"
+#include "PinnableSlice.h"
+#include "Metrics.h"
 
 using namespace bt;
 
-BufferTree::BufferTree(const std::string& name, Options& opts,
-        Cache* cache, Layout* layout)
+BufferTree::BufferTree(const std::string& name, size_t shard, Options& opts,
+        Cache* cache, Layout* layout, EpochManager* epoch,
+        SnapshotList* snapshots, RowCache* rowCache)
     : name_(name),
+      shard_(shard),
       opts_(opts),
       cache_(cache),
       root_(NULL),
-      nodeCount_(0),
-      nodeMap_(),
+      appending_(false),
       mutex_(),
       mutexLockPath_(),
-      layout_(layout)
+      layout_(layout),
+      epoch_(epoch),
+      snapshots_(snapshots),
+      rowCache_(rowCache)
 {}
 
 BufferTree::~BufferTree()
@@ -24,38 +32,31 @@ BufferTree::~BufferTree()
 
 bool BufferTree::init()
 {
-    cache_->tie(this, layout_);
-
-    nid_t rootNid = layout_->getRootNid();
-    nodeCount_ = layout_->getNodeCount();
+    nid_t rootNid = layout_->getRootNid(shard_);
 
     if(rootNid == NID_NIL) {
         assert(root_ == NULL);
-        assert(nodeCount_ == 0);
-
-		{
-        MutexLockGuard lock(mutex_);
-		++rootNid;
-    	}
-		
-		root_ = createNode(rootNid);
-        root_->setLeaf(true);
-        root_->createFirstPivot();
+
+		// the root keeps the pin from createNode/getNode until growUp.
+		Node* root = createNode();
+        root->setLeaf(true);
+        root->createFirstPivot();
+        root_.store(root);
+        layout_->setRootNid(shard_, root->nid());
     } else
-		root_ = getNode(rootNid);
+		root_.store(getNode(rootNid));
 
-    return root_ != NULL;
+    return root_.load() != NULL;
 }
 
 void BufferTree::lockPath(const Slice& key, std::vector<Node*>& path)
 {
     MutexLockGuard lock(mutexLockPath_);
 
-    Node* root = root_;
-    root->incRef();
+    Node* root = pinRoot();
     root->writeLock();
 
-    if(root != root_) {
+    if(root != root_.load(std::memory_order_acquire)) {
         root->writeUnlock();
         root->decRef();
     } else {
@@ -67,70 +68,336 @@ void BufferTree::growUp(Node* root)
 {
     MutexLockGuard lock(mutex_);
 
-    root_->decRef();
-    root_ = root;
-    layout_->setRootNid(root_->nid());
+    Node* old = root_.load(std::memory_order_relaxed);
+    root_.store(root, std::memory_order_release);
+    old->decRef();
+    layout_->setRootNid(shard_, root->nid());
+}
+
+void BufferTree::rebalance()
+{
+    EpochGuard guard(epoch_);
+
+    // level by level, a parent merges its children before they are
+    // visited.
+    std::vector<Node*> pending, next;
+    pending.push_back(pinRoot());
+    for(size_t depth = 0; !pending.empty(); ++depth) {
+        for(size_t i = 0; i < pending.size(); ++i) {
+            Node* node = pending[i];
+            node->writeLock();
+            if(!node->dead())
+                node->rebalance(next, depth);
+            node->writeUnlock();
+            node->decRef();
+        }
+        pending.swap(next);
+        next.clear();
+    }
+
+    shrink();
+}
+
+// REQUIRES: inside an epoch.
+void BufferTree::shrink()
+{
+    // no path is locked below a root being replaced.
+    MutexLockGuard lock(mutexLockPath_);
+
+    while(true) {
+        Node* root = pinRoot();
+        root->writeLock();
+
+        Node* child = root->collapse();
+        if(!child) {
+            root->writeUnlock();
+            root->decRef();
+            return;
+        }
+
+        child->setDirty(true);
+        child->writeUnlock();
+        // the child keeps the pin collapse took as the root pin.
+        replaceRoot(root, child);
+        cache_->metrics()->add(Metrics::kRootShrinks);
+    }
 }
 
-Node* BufferTree::createNode(nid_t nid)
+bool BufferTree::empty()
 {
-    // 向Cache申请一个Node结点
-	MutexLockGuard lock(mutex_);
+    EpochGuard guard(epoch_);
+    Node* root = pinRoot();
+    root->readLock();
+    bool empty = root->empty();
+    root->readUnlock();
+    root->decRef();
+    return empty;
+}
 
-	Node* node = cache_->getNode(nid, true);
-    ++nodeCount_;
+bool BufferTree::lockInstall(nid_t nid, InstallLock* lock)
+{
+    // held until the install, no path is locked below the root.
+    mutexLockPath_.lock();
 
-    return node;
+    Node* old = pinRoot();
+    old->writeLock();
+    bool empty = old == root_.load(std::memory_order_acquire) && old->empty();
+    Node* root = empty ? getNode(nid) : NULL;
+    if(!root) {
+        old->writeUnlock();
+        old->decRef();
+        mutexLockPath_.unlock();
+        return false;
+    }
+
+    lock->old = old;
+    lock->root = root;
+    return true;
 }
 
+void BufferTree::installRoot(InstallLock* lock)
+{
+    replaceRoot(lock->old, lock->root);
+    mutexLockPath_.unlock();
+}
+
+void BufferTree::unlockInstall(InstallLock* lock)
+{
+    lock->old->writeUnlock();
+    lock->old->decRef();
+    mutexLockPath_.unlock();
+
+    // only the lock reached it.
+    lock->root->decRef();
+    cache_->dropNode(lock->root);
+}
+
+// root's pin becomes the root pin, old goes away with the caller's pin
+// and its own. REQUIRES: inside an epoch, mutexLockPath_ is held, old
+// is the root and write locked.
+void BufferTree::replaceRoot(Node* old, Node* root)
+{
+    {
+    MutexLockGuard lock(mutex_);
+    root_.store(root, std::memory_order_release);
+    layout_->setRootNid(shard_, root->nid());
+    }
+
+    // writers still holding the old root find it is not the root.
+    old->kill();
+    old->writeUnlock();
+    old->decRef(); // the root pin
+    old->decRef();
+
+    cache_->dropNode(old);
+    layout_->drop(old->nid());
+}
+
+// 向Cache申请一个Node结点, nids come from the layout shared by all shards.
 Node* BufferTree::createNode()
 {
-	MutexLockGuard lock(mutex_);
+	return cache_->getNode(this, layout_->newNid(), true);
+}
 
-	Node* node = cache_->getNode(nodeCount_, true);
-    ++nodeCount_;
+Node* BufferTree::getNode(nid_t nid, bool pin)
+{
+    return cache_->getNode(this, nid, false, pin);
+}
 
-    return node;
+// REQUIRES: inside an epoch, so the root read can not be freed
+// before the pin lands.
+Node* BufferTree::pinRoot()
+{
+    while(true) {
+        Node* root = root_.load(std::memory_order_acquire);
+        root->incRef();
+        // still the root, it was holding the root pin all along.
+        if(root == root_.load(std::memory_order_acquire))
+            return root;
+        root->decRef();
+    }
 }
 
-Node* BufferTree::getNode(nid_t nid)
+bool BufferTree::put(const Slice& key, const Slice& value, uint64_t expiry)
 {
-	MutexLockGuard lock(mutex_);
-    return cache_->getNode(nid, false);
+    cache_->makeRoomForWrite(Msg(Put, key, value, 0, expiry).size() + 8);
+
+    EpochGuard guard(epoch_);
+    Node* root = pinRoot();
+    bool succ = root->put(key, value, expiry);
+    root->decRef();
+
+    // after the write, so a get that read the old value can not fill it.
+    if(rowCache_)
+        rowCache_->erase(key);
+    return succ;
 }
 
-bool BufferTree::put(const Slice& key, const Slice& value)
+bool BufferTree::merge(const Slice& key, const Slice& operand)
 {
-    assert(root_);
+    cache_->makeRoomForWrite(Msg(Merge, key, operand).size() + 8);
 
-    Node* root = root_;
-    root_->incRef();
-    bool succ = root->put(key, value);
+    EpochGuard guard(epoch_);
+    Node* root = pinRoot();
+    bool succ = root->merge(key, operand);
     root->decRef();
 
+    if(rowCache_)
+        rowCache_->erase(key);
     return succ;
 }
 
 bool BufferTree::del(const Slice& key)
 {
-    assert(root_);
+    cache_->makeRoomForWrite(Msg(Del, key).size() + 8);
 
-    Node* root = root_;
-    root->incRef();
+    EpochGuard guard(epoch_);
+    Node* root = pinRoot();
     bool succ = root->del(key);
     root->decRef();
 
+    if(rowCache_)
+        rowCache_->erase(key);
     return succ;
 }
 
-bool BufferTree::get(const Slice& key, Slice& value)
+bool BufferTree::deleteRange(const Slice& begin, const Slice& end)
 {
-    assert(root_);
+    cache_->makeRoomForWrite(16 + begin.size() + end.size());
 
-    Node* root = root_;
-    root->incRef();
-    bool succ = root->get(key, value);
+    EpochGuard guard(epoch_);
+    Node* root = pinRoot();
+    bool succ = root->deleteRange(begin, end);
     root->decRef();
 
+    if(rowCache_)
+        rowCache_->clear();
     return succ;
 }
+
+void BufferTree::lockCommit(const std::vector<Slice>& keys, CommitLock* lock)
+{
+    // must lock from the root, it may be replaced before it is locked.
+    Node* root = pinRoot();
+    root->optionalLock();
+    while(root != root_.load(std::memory_order_acquire)) {
+        root->optionalUnlock();
+        root->decRef();
+        root = pinRoot();
+        root->optionalLock();
+    }
+
+    root->lockPivots(keys, lock->pivots, lock->children);
+    lock->root = root;
+}
+
+uint64_t BufferTree::latest(CommitLock* lock, const Slice& key)
+{
+    return lock->root->latest(key, true);
+}
+
+void BufferTree::write(CommitLock* lock, const Msg& msg)
+{
+    lock->root->writeLocked(msg);
+    lock->written = true;
+}
+
+void BufferTree::unlockKeys(CommitLock* lock)
+{
+    lock->root->unlockPivots(lock->pivots, lock->children);
+    lock->pivots.clear();
+    lock->children.clear();
+}
+
+void BufferTree::unlockCommit(CommitLock* lock)
+{
+    Node* root = lock->root;
+    if(lock->written) {
+        // the push down consumes the lock, like a put's.
+        root->setDirty(true);
+        root->pushDownOrSplit();
+    } else {
+        root->optionalUnlock();
+    }
+    root->decRef();
+    lock->root = NULL;
+}
+
+void BufferTree::multiGet(const std::vector<Slice>& keys, const std::vector<size_t>& batch,
+        std::vector<std::string>* values, std::vector<bool>* found)
+{
+    std::vector<size_t> rest;
+    std::vector<uint64_t> tickets;
+    for(size_t i = 0; i < batch.size(); ++i) {
+        uint64_t ticket = 0;
+        size_t k = batch[i];
+        if(rowCache_ && rowCache_->lookup(keys[k], &(*values)[k], &ticket)) {
+            (*found)[k] = true;
+            continue;
+        }
+        rest.push_back(k);
+        tickets.push_back(ticket);
+    }
+    if(rest.empty())
+        return;
+
+    std::vector<uint64_t> expiries(keys.size());
+    {
+    // one descent for the whole batch under read lock coupling, the
+    // optimistic protocol would restart it on any write on the way.
+    EpochGuard guard(epoch_);
+    Node* root = root_.load(std::memory_order_acquire);
+    while(true) {
+        root->readLock();
+        if(root == root_.load(std::memory_order_acquire))
+            break;
+        root->readUnlock();
+        root = root_.load(std::memory_order_acquire);
+    }
+    std::vector<std::vector<Slice> > operands(keys.size());
+    root->multiGet(keys, rest, values, found, &expiries, &operands);
+    root->readUnlock();
+    }
+
+    if(rowCache_) {
+        for(size_t i = 0; i < rest.size(); ++i) {
+            if((*found)[rest[i]] && expiries[rest[i]] == 0)
+                rowCache_->insert(keys[rest[i]], Slice((*values)[rest[i]]), tickets[i]);
+        }
+    }
+}
+
+bool BufferTree::get(const Slice& key, PinnableSlice* value, uint64_t snapshot)
+{
+    value->reset();
+
+    uint64_t ticket = 0;
+    RowCache* rowCache = snapshot == kMaxSequence ? rowCache_ : NULL;
+    if(rowCache && rowCache->lookup(key, value->self(), &ticket)) {
+        value->pinSelf();
+        return true;
+    }
+
+    // readers take no pins, the epoch keeps whatever they reach alive.
+    // on a hit the epoch is handed to value and left when it is reset,
+    // unless the value was merged into its own string.
+    epoch_->enter();
+    Slice found;
+    uint64_t expiry;
+    std::string* scratch = value->self();
+    if(!root_.load(std::memory_order_acquire)->get(key, found, scratch, snapshot, &expiry)) {
+        epoch_->exit();
+        return false;
+    }
+
+    // the row cache has no clock, a value that expires is not kept.
+    if(rowCache && expiry == 0)
+        rowCache->insert(key, found, ticket);
+    if(found.data() == scratch->data() && !found.empty()) {
+        epoch_->exit();
+        value->pinSelf();
+    } else {
+        value->pin(epoch_, found);
+    }
+    return true;
+}
@@ -4,44 +4,119 @@
 #include <map>
 #include <string>
 #include <vector>
+#include <atomic>
 
 #include "Slice.h"
 #include "Options.h"
 #include "Mutex.h"
+#include "Msg.h"
 
 namespace bt
 {
 class Node;
 class Layout;
 class Cache;
+class EpochManager;
+class RowCache;
+class PinnableSlice;
+class SnapshotList;
+
+// one tree's part of a transaction's commit, see lockCommit().
+struct CommitLock
+{
+    CommitLock() : root(NULL), pivots(), children(), written(false) {}
+
+    Node* root;
+    std::vector<size_t> pivots;
+    std::vector<Node*> children;
+    bool written;
+};
+
+// one tree's part of a bulk load, see lockInstall().
+struct InstallLock
+{
+    InstallLock() : old(NULL), root(NULL) {}
+
+    Node* old;
+    Node* root;
+};
 
 class BufferTree
 {
 public:
-    BufferTree(const std::string& name, Options& opts, Cache* cache, Layout* layout);
+    BufferTree(const std::string& name, size_t shard, Options& opts,
+            Cache* cache, Layout* layout, EpochManager* epoch,
+            SnapshotList* snapshots, RowCache* rowCache = NULL);
     ~BufferTree();
 
     bool init();
     void growUp(Node* root);
-    bool put(const Slice& key, const Slice& value);
+    // one pass merging the nodes and pivots deletes left underfull,
+    // over the cached part of the tree only.
+    void rebalance();
+    // nothing was written to the tree yet.
+    bool empty();
+    // bulk load, the trees in order: holds the empty root write locked
+    // and reads in the bulk loaded root under nid. false if the tree is
+    // not empty anymore, nothing is held then.
+    // REQUIRES: inside an epoch until installRoot() or unlockInstall().
+    bool lockInstall(nid_t nid, InstallLock* lock);
+    // makes the bulk loaded tree the tree.
+    void installRoot(InstallLock* lock);
+    // leaves the tree as it was, the bulk loaded root is dropped.
+    void unlockInstall(InstallLock* lock);
+    // expiry in seconds since the epoch, 0 never expires.
+    bool put(const Slice& key, const Slice& value, uint64_t expiry = 0);
     bool del(const Slice& key);
-    bool get(const Slice& key, Slice& value);
+    bool merge(const Slice& key, const Slice& operand);
+    bool deleteRange(const Slice& begin, const Slice& end);
+    // the writes after snapshot are not seen, the row cache only
+    // holds the newest values.
+    bool get(const Slice& key, PinnableSlice* value, uint64_t snapshot = kMaxSequence);
+    // transactions: no write to the sorted keys enters the tree until
+    // unlockCommit(), their buffers in the root stay locked.
+    // REQUIRES: inside an epoch until unlockCommit().
+    void lockCommit(const std::vector<Slice>& keys, CommitLock* lock);
+    // seq of the newest write to key, see Node::latest().
+    uint64_t latest(CommitLock* lock, const Slice& key);
+    // msg is copied. REQUIRES: msg is stamped, its key locked.
+    void write(CommitLock* lock, const Msg& msg);
+    // lets go of the keys' buffers, the root stays locked.
+    void unlockKeys(CommitLock* lock);
+    // unlocks the root, after pushing down what the writes filled. it
+    // may wait for the root, nothing of a later tree must be held.
+    void unlockCommit(CommitLock* lock);
+    // looks up keys[batch[i]], batch sorted by key.
+    void multiGet(const std::vector<Slice>& keys, const std::vector<size_t>& batch,
+            std::vector<std::string>* values, std::vector<bool>* found);
 
-    Node* createNode(nid_t nid);
 	Node* createNode();
-    Node* getNode(nid_t nid);
+    // writers pin the node against eviction and decRef it when done,
+    // readers inside an epoch need no pin.
+    Node* getNode(nid_t nid, bool pin = true);
+    Node* pinRoot();
     void lockPath(const Slice& key, std::vector<Node*>& path);
 private:
     friend class Node;
+    // the reverse of growUp, a root left with one child hands over to it.
+    void shrink();
+    void replaceRoot(Node* old, Node* root);
+
     std::string name_;
+    size_t shard_;
     Options opts_;
     Cache* cache_;
-    Node* root_;
-    nid_t nodeCount_;
-    std::map<nid_t, Node*> nodeMap_;
+    std::atomic<Node*> root_;
+    // the root's last buffer sees the writes in their order, lower
+    // levels get them in sorted batches. true while they are appends.
+    std::atomic<bool> appending_;
     MutexLock mutex_;
     MutexLock mutexLockPath_;
 	Layout* layout_;
+    EpochManager* epoch_;
+    // shared by the shards, a snapshot covers all of them.
+    SnapshotList* snapshots_;
+    RowCache* rowCache_;
 };
 }
 
@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <map>
+#include <algorithm>
+
+#include "BulkLoader.h"
+#include "BufferTree.h"
+#include "Layout.h"
+#include "Node.h"
+#include "Msg.h"
+#include "Slab.h"
+#include "SortedRun.h"
+
+using namespace bt;
+
+BulkLoader::BulkLoader(BufferTree* tree, const Options& opts, Layout* layout, Slab* slab)
+    : tree_(tree),
+      opts_(opts),
+      layout_(layout),
+      slab_(slab),
+      bufferLimit_(std::max<size_t>(1, opts.maxBufferBytes * opts.bulkLoadFill)),
+      leafLimit_(std::max<size_t>(1, opts.nodeSize * opts.bulkLoadFill)),
+      fanout_(std::max<size_t>(2, opts.maxNodeChildNum * opts.bulkLoadFill)),
+      run_(new SortedRun()),
+      runFirst_(),
+      last_(),
+      count_(0),
+      levels_(),
+      written_()
+{
+}
+
+// the open nodes were never written, the written ones stay for the
+// tree unless abandon() drops them.
+BulkLoader::~BulkLoader()
+{
+    delete run_;
+    for(size_t i = 0; i < levels_.size(); ++i) {
+        if(levels_[i].node)
+            Node::destroy(slab_, levels_[i].node);
+    }
+}
+
+bool BulkLoader::add(const Slice& key, const Slice& value)
+{
+    if(count_ && key.compare(Slice(last_)) <= 0)
+        return false;
+
+    size_t bytes = 8 + key.size() + value.size();
+    if(run_->count() && run_->size() + bytes > bufferLimit_)
+        closeRun();
+    if(run_->count() == 0)
+        runFirst_.assign(key.data(), key.size());
+
+    run_->append(key, value);
+    last_.assign(key.data(), key.size());
+    count_++;
+    return true;
+}
+
+nid_t BulkLoader::finish()
+{
+    if(run_->count())
+        closeRun();
+    if(levels_.empty())
+        return NID_NIL;
+
+    // close the open nodes bottom up until a level has had one node.
+    for(size_t level = 0; ; ++level) {
+        Level& l = levels_[level];
+        if(level + 1 == levels_.size() && l.built == 1) {
+            Node* root = l.node;
+            nid_t nid = root->nid();
+            l.node = NULL;
+            writeNode(root);
+            return nid;
+        }
+        if(l.node)
+            closeNode(level);
+    }
+}
+
+void BulkLoader::closeRun()
+{
+    MsgBuf* buf = new MsgBuf(slab_, opts_.filterBits, opts_.filterBitsPerKey);
+    buf->load(run_);
+    run_ = new SortedRun();
+
+    size_t bytes = 8 + runFirst_.size() + buf->size() + buf->filterSize();
+    addPivot(0, NID_NIL, buf, runFirst_, bytes);
+}
+
+// the first pivot of a level covers everything below its key, like the
+// first pivot of the root.
+void BulkLoader::addPivot(size_t level, nid_t child, MsgBuf* buf,
+        const std::string& first, size_t bytes)
+{
+    if(level == levels_.size())
+        levels_.push_back(Level());
+
+    if(levels_[level].node && full(level, bytes))
+        closeNode(level);
+
+    Level& l = levels_[level];
+    if(!l.node) {
+        char* p = (char*)slab_->alloc(sizeof(Node));
+        l.node = new (p) Node(tree_, layout_->newNid(), slab_);
+        l.node->setLeaf(level == 0);
+        l.first = first;
+        l.pivots = 0;
+        l.bytes = 0;
+        l.built++;
+    }
+
+    Slice key;
+    if(l.built > 1 || l.pivots > 0)
+        key = Slice(const_cast<std::string&>(first)).clone(slab_);
+    if(!buf)
+        buf = new MsgBuf(slab_, opts_.filterBits, opts_.filterBitsPerKey);
+    l.node->appendPivot(child, buf, key);
+    l.pivots++;
+    l.bytes += bytes;
+}
+
+// leaves by bytes, and by fanout like a leaf splitBuf stops at, internal
+// nodes by fanout.
+bool BulkLoader::full(size_t level, size_t bytes)
+{
+    Level& l = levels_[level];
+    if(level > 0)
+        return l.pivots >= fanout_;
+    return l.pivots >= opts_.maxNodeChildNum || l.bytes + bytes > leafLimit_;
+}
+
+void BulkLoader::closeNode(size_t level)
+{
+    Level& l = levels_[level];
+    Node* node = l.node;
+    l.node = NULL;
+
+    std::string first;
+    first.swap(l.first);
+    nid_t nid = node->nid();
+    writeNode(node);
+    addPivot(level + 1, nid, NULL, first, 8 + first.size());
+}
+
+void BulkLoader::abandon()
+{
+    for(size_t i = 0; i < written_.size(); ++i)
+        layout_->drop(written_[i]);
+    written_.clear();
+}
+
+void BulkLoader::writeNode(Node* node)
+{
+    std::map<nid_t, Node*> nodes;
+    nodes[node->nid()] = node;
+    layout_->write(nodes);
+    written_.push_back(node->nid());
+    Node::destroy(slab_, node);
+}
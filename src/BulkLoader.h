@@ -0,0 +1,87 @@
+#ifndef __BT_BULKLOADER_H
+#define __BT_BULKLOADER_H
+
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "Slice.h"
+#include "Options.h"
+
+namespace bt {
+
+class BufferTree;
+class Layout;
+class Slab;
+class Node;
+class SortedRun;
+class MsgBuf;
+
+// Builds the nodes of one tree bottom up from keys in ascending order,
+// for DB::bulkLoad.
+//
+// Leaf buffers are packed as sorted runs to Options::bulkLoadFill of
+// maxBufferBytes, leaves to that share of nodeSize and internal nodes
+// to that share of the fanout, with empty buffers. A node is written
+// through the Layout as soon as it is complete and freed, so nodes go
+// to the file in nid order, and only the open node of each level is
+// in memory. Nothing passes through the cache or a buffer above the
+// leaves.
+class BulkLoader : boost::noncopyable
+{
+public:
+    BulkLoader(BufferTree* tree, const Options& opts, Layout* layout, Slab* slab);
+    ~BulkLoader();
+
+    // false if key does not sort after the one added before.
+    bool add(const Slice& key, const Slice& value);
+    // writes the open nodes, returns the root's nid or NID_NIL if
+    // nothing was added.
+    nid_t finish();
+    size_t count() const { return count_; }
+    // forgets the nodes written, for a load given up on.
+    void abandon();
+
+private:
+    // the open node of a level, with the first key below it.
+    struct Level
+    {
+        Level() : node(NULL), first(), pivots(0), bytes(0), built(0) {}
+
+        Node* node;
+        std::string first;
+        size_t pivots;
+        size_t bytes;
+        // nodes the level has had, the open one included.
+        size_t built;
+    };
+
+    void closeRun();
+    // buf is NULL above the leaves.
+    void addPivot(size_t level, nid_t child, MsgBuf* buf,
+            const std::string& first, size_t bytes);
+    bool full(size_t level, size_t bytes);
+    void closeNode(size_t level);
+    void writeNode(Node* node);
+
+    BufferTree* tree_;
+    Options opts_;
+    Layout* layout_;
+    Slab* slab_;
+
+    size_t bufferLimit_;
+    size_t leafLimit_;
+    size_t fanout_;
+
+    SortedRun* run_;
+    std::string runFirst_;
+    std::string last_;
+    size_t count_;
+    // leaves first.
+    std::vector<Level> levels_;
+    std::vector<nid_t> written_;
+};
+
+}
+
+#endif
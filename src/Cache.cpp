@@ -1,29 +1,41 @@
 #include <boost/bind.hpp>
 #include <assert.h>
+#include <algorithm>
 
 #include "Cache.h"
 #include "Thread.h"
 #include "Logger.h"
 #include "Node.h"
 #include "Layout.h"
+#include "Slab.h"
+#include "Epoch.h"
+#include "Metrics.h"
 
 using namespace bt;
 
-Cache::Cache(const Options& opts, Slab* slab)
+Cache::Cache(const Options& opts, Slab* slab, Metrics* metrics)
     : opts_(opts),
       cacheSize_(0),
+      mutex_(),
+      workerCond_(mutex_),
       alive_(false),
       worker_(NULL),
       slab_(slab),
       readBuf_(),
-      usedNodesLock_()
+      usedNodesLock_(),
+      flow_(opts),
+      metrics_(metrics),
+      index_(new Index(64))
 {
-	// ensure hold a node(16K * 16 default).
-	readBuf_.ensureWritableBytes(opts_.maxNodeMsg * opts_.maxNodeChildNum);
+	// ensure hold a node.
+	readBuf_.ensureWritableBytes(opts_.nodeSize);
 }
 
 Cache::~Cache()
-{}
+{
+    flush();
+    destroyIndex(NULL, index_.load(std::memory_order_relaxed));
+}
 
 bool Cache::init()
 {
@@ -39,94 +51,261 @@ bool Cache::init()
     return true;
 }
 
-void Cache::tie(BufferTree* tree, Layout* layout)
+void Cache::tie(Layout* layout)
 {
-    assert(tree && layout);
+    assert(layout);
 
-    tree_ = tree;
     layout_ = layout;
 
     //lastCheckpoint = Timestamp::now();
 }
 
-Node* Cache::getNode(nid_t nid, bool newNode)
+// the pin is taken under usedNodesLock_, so evictFromMemory never
+// drops a node a writer is about to modify.
+Node* Cache::getNode(BufferTree* tree, nid_t nid, bool newNode, bool pin)
 {
-    Node* n = NULL;
-	
+	// readers need no pin, only a miss takes the lock.
+	if(!newNode && !pin) {
+		Node* n = findNode(nid);
+		if(n)
+			return n;
+	}
+
 	MutexLockGuard lock(usedNodesLock_);
-	
+	return getNodeLocked(tree, nid, newNode, pin);
+}
+
+void Cache::getNodes(BufferTree* tree, const std::vector<nid_t>& nids,
+        std::vector<Node*>& nodes)
+{
+	MutexLockGuard lock(usedNodesLock_);
+
+	std::vector<nid_t> missing;
+	for(size_t i = 0; i < nids.size(); ++i) {
+		if(nodes_.find(nids[i]) == nodes_.end())
+			missing.push_back(nids[i]);
+	}
+	// the reads below find the extents in the page cache or on the way.
+	if(missing.size() > 1)
+		layout_->prefetch(missing);
+
+	for(size_t i = 0; i < nids.size(); ++i)
+		nodes.push_back(getNodeLocked(tree, nids[i], false, false));
+}
+
+Node* Cache::getNodeLocked(BufferTree* tree, nid_t nid, bool newNode, bool pin)
+{
+    Node* n = NULL;
+
+    if(!newNode) {
+		NodeMap::iterator iter = nodes_.find(nid);
+		if(iter != nodes_.end()) {
+			//LOGFMTI("find a node in memory.");
+			usedNodes_.splice(usedNodes_.begin(), usedNodes_, iter->second);
+			n = *usedNodes_.begin();
+			if(pin)
+				n->incRef();
+			metrics_->add(Metrics::kCacheHits);
+			return n;
+		}
+	}
+
     if(newNode) {
         // get a new node
         char* p = (char*)slab_->alloc(sizeof(Node));
-		n = new (p) Node(tree_, nid, slab_);
-        usedNodes_.push_front(n);
+		n = new (p) Node(tree, nid, slab_);
 	} else {
-		NodeMap::iterator iter = nodes_.find(nid);
-		if(iter == nodes_.end()) {
-			LOGFMTI("cannot find node in memory.");
-			// need to get node from disk
-			readBuf_.retrieveAll();
-			bool ret = layout_->find(nid, readBuf_);
-			if(!ret) {
-				LOGFMTA("cannot find error");
-				return NULL;
-			}
-			char* p = (char*)slab_->alloc(sizeof(Node));
-			n = new (p) Node(tree_, nid, slab_);
-
-			n->deserialize(readBuf_);
-			usedNodes_.push_front(n);
-		} else {
-			//LOGFMTI("find a node in memory.");
-			usedNodes_.splice(usedNodes_.begin(), usedNodes_, nodes_[nid]);
+		LOGFMTD("cannot find node in memory.");
+		metrics_->add(Metrics::kCacheMisses);
+		// need to get node from disk
+		readBuf_.retrieveAll();
+		bool ret = layout_->find(nid, readBuf_);
+		if(!ret) {
+			LOGFMTE("cannot find error");
+			return NULL;
 		}
+		char* p = (char*)slab_->alloc(sizeof(Node));
+		n = new (p) Node(tree, nid, slab_);
+
+		n->deserialize(readBuf_);
 	}
+	if(pin)
+		n->incRef();
 
-	cacheSize_ += (*usedNodes_.begin())->writeBackSize();
+	// only nodes entering the cache are accounted, a hit must not grow it.
 	evictFromMemory();
-	
+	cacheSize_ += n->writeBackSize();
+
+	usedNodes_.push_front(n);
     nodes_[nid] = usedNodes_.begin();
-    return *usedNodes_.begin();
+    indexInsert(n);
+    return n;
+}
+
+Node* Cache::findNode(nid_t nid)
+{
+	Index* index = index_.load(std::memory_order_acquire);
+	IndexEntry* e = index->buckets[nid & index->mask].load(std::memory_order_acquire);
+	for(; e; e = e->next.load(std::memory_order_acquire)) {
+		if(e->nid == nid) {
+			e->node->setReferenced();
+			metrics_->add(Metrics::kCacheHits);
+			return e->node;
+		}
+	}
+	return NULL;
+}
+
+void Cache::Index::link(nid_t nid, Node* node)
+{
+	std::atomic<IndexEntry*>& head = buckets[nid & mask];
+	head.store(new IndexEntry(nid, node, head.load(std::memory_order_relaxed)),
+			std::memory_order_release);
+	count++;
+}
+
+void Cache::indexInsert(Node* node)
+{
+	Index* index = index_.load(std::memory_order_relaxed);
+	if(index->count >= index->buckets.size()) {
+		// readers still in the old index finish their walk there.
+		Index* grown = new Index(index->buckets.size() * 2);
+		for(size_t b = 0; b < index->buckets.size(); ++b) {
+			IndexEntry* e = index->buckets[b].load(std::memory_order_relaxed);
+			for(; e; e = e->next.load(std::memory_order_relaxed))
+				grown->link(e->nid, e->node);
+		}
+		index_.store(grown, std::memory_order_release);
+		slab_->epoch()->retire(destroyIndex, NULL, index);
+		index = grown;
+	}
+	index->link(node->nid(), node);
+}
+
+void Cache::indexErase(nid_t nid)
+{
+	Index* index = index_.load(std::memory_order_relaxed);
+	std::atomic<IndexEntry*>* link = &index->buckets[nid & index->mask];
+	IndexEntry* e = link->load(std::memory_order_relaxed);
+	for(; e; link = &e->next, e = link->load(std::memory_order_relaxed)) {
+		if(e->nid == nid) {
+			link->store(e->next.load(std::memory_order_relaxed), std::memory_order_release);
+			index->count--;
+			slab_->epoch()->retire(destroyIndexEntry, NULL, e);
+			return;
+		}
+	}
 }
+
+void Cache::destroyIndex(void* arg, void* ptr)
+{
+	Index* index = static_cast<Index*>(ptr);
+	for(size_t b = 0; b < index->buckets.size(); ++b) {
+		IndexEntry* e = index->buckets[b].load(std::memory_order_relaxed);
+		while(e) {
+			IndexEntry* next = e->next.load(std::memory_order_relaxed);
+			delete e;
+			e = next;
+		}
+	}
+	delete index;
+}
+
+void Cache::destroyIndexEntry(void* arg, void* ptr)
+{
+	delete static_cast<IndexEntry*>(ptr);
+}
+
 // 先读取赃的结点并写入磁盘
 // 再根据结点的访问顺序，从内存中去除？
 void Cache::writeBack()
 {
-    std::list<Node*>::iterator it, itEnd;
-	
+	std::vector<Node*> nodes;
     std::map<nid_t, Node*> dirtyNodes;
-    while(alive_) {
+    bool alive = true;
 
-		// lock the usedNodes_ to find dirty nodes.
+    while(alive) {
+		{
+		MutexLockGuard lock(mutex_);
+		if(alive_)
+			workerCond_.waitForMicros(1000 * 100); // 100ms
+		alive = alive_;
+		}
+
+		// free what evictions and buffer flushes retired, even when
+		// no writer is around to do it.
+		slab_->epoch()->reclaim();
+		// nodes evicted while the sweep inspects them stay allocated.
+		EpochGuard guard(slab_->epoch());
+
+		// snapshot usedNodes_, so nodes are inspected without holding
+		// usedNodesLock_ (getNode is called with node locks held).
 		{
 		MutexLockGuard lock(usedNodesLock_);
-		itEnd = usedNodes_.end();
-        for(it = usedNodes_.begin(); it != itEnd; ++it) {
-            if((*it)->dirty()) {
-                dirtyNodes[(*it)->nid()] = *it;
-            }
-        }
+		nodes.assign(usedNodes_.begin(), usedNodes_.end());
+		}
+
+		size_t dirtyBytes = 0, bufferedBytes = 0, cacheBytes = 0;
+		for(size_t i = 0; i < nodes.size(); ++i) {
+			Node* node = nodes[i];
+			cacheBytes += node->writeBackSize();
+			if(node->dirty()) {
+				dirtyNodes[node->nid()] = node;
+				dirtyBytes += node->writeBackSize();
+			}
+			if(!node->isLeaf())
+				bufferedBytes += node->size();
+		}
+		flow_.setPending(dirtyBytes, bufferedBytes);
+
+		// nodes grow after they enter the cache, resync the estimate.
+		{
+		MutexLockGuard lock(usedNodesLock_);
+		cacheSize_ = cacheBytes;
 		}
 		
-		LOGFMTI("Cache::writeBack flush nodes [%lu]", dirtyNodes.size());
+		LOGFMTD("Cache::writeBack flush nodes [%lu] dirty bytes [%lu] buffered bytes [%lu]",
+				dirtyNodes.size(), dirtyBytes, bufferedBytes);
 		
-        if(dirtyNodes.size())
+        if(dirtyNodes.size()) {
             flushDirtyNodes(dirtyNodes);
-
-        ::usleep(1000 * 100); // 100ms
+            flow_.flushed(dirtyBytes);
+            dirtyNodes.clear();
+        }
+		nodes.clear();
     }
 }
 
-void Cache::flushDirtyNodes(std::map<nid_t, Node*>& dirtyNodes)
+void Cache::makeRoomForWrite(size_t bytes)
 {
-    layout_->write(dirtyNodes);
+	flow_.addPending(bytes);
+	if(flow_.state() == FlowControl::kNormal)
+		return;
+
+	{
+	// wake up the write back thread instead of waiting for its timer.
+	MutexLockGuard lock(mutex_);
+	workerCond_.notify();
+	}
 
+	flow_.delayWrite();
+}
+
+void Cache::flushDirtyNodes(std::map<nid_t, Node*>& dirtyNodes)
+{
 	std::map<nid_t, Node*>::iterator it, itEnd = dirtyNodes.end();
+	// clear dirty before serializing, a write racing with it
+	// dirties the node again instead of being lost.
 	for(it = dirtyNodes.begin(); it != itEnd; ++it) {
 		Node* node = it->second;
+        node->setFlushing(true);
 		node->setDirty(false);
-        node->setFlushing(false);
 	}
+
+    layout_->write(dirtyNodes);
+
+	for(it = dirtyNodes.begin(); it != itEnd; ++it)
+        it->second->setFlushing(false);
 }
 
 void Cache::evictFromMemory()
@@ -134,25 +313,69 @@ void Cache::evictFromMemory()
 	size_t limitedMem = opts_.cacheLimitMem; // default 256M
 	Node* node = NULL;
 	
-	std::list<Node*>::reverse_iterator it = usedNodes_.rbegin(), itEnd = usedNodes_.rend();
-	std::list<Node*>::iterator iter;
-	
-	while(cacheSize_ >= limitedMem && it != itEnd) {
-		node = *it;
-		//node->writeLock();
-		if(node->dirty()) {
+	// from the tail, cur is past the node looked at. a node lock free
+	// readers hit since the last pass goes to the front once, like a
+	// locked hit does.
+	std::list<Node*>::iterator cur = usedNodes_.end(), iter;
+	size_t chances = usedNodes_.size();
+	while(cacheSize_ >= limitedMem && cur != usedNodes_.begin()) {
+		iter = cur;
+		node = *--iter;
+		if(chances && node->clearReferenced()) {
+			--chances;
+			usedNodes_.splice(usedNodes_.begin(), usedNodes_, iter);
+		} else if(node->evictable()) {
 			nodes_.erase(node->nid());
-			cacheSize_ -= node->writeBackSize();
-			iter = usedNodes_.erase((++it).base());
-			it = std::list<Node*>::reverse_iterator(iter);
+			indexErase(node->nid());
+			cacheSize_ -= std::min(cacheSize_, node->writeBackSize());
+			usedNodes_.erase(iter);
+			// lock free readers may still be inside it.
+			slab_->epoch()->retire(Node::destroy, slab_, node);
 		} else
-			++it;
-		//node->writeUnlock();
+			cur = iter;
 	}	
 }
 
+Node* Cache::peekNode(nid_t nid)
+{
+	MutexLockGuard lock(usedNodesLock_);
+	NodeMap::iterator iter = nodes_.find(nid);
+	if(iter == nodes_.end())
+		return NULL;
+
+	Node* n = *iter->second;
+	n->incRef();
+	return n;
+}
+
+void Cache::dropNode(Node* node)
+{
+	MutexLockGuard lock(usedNodesLock_);
+	NodeMap::iterator iter = nodes_.find(node->nid());
+	if(iter == nodes_.end())
+		return;
+
+	cacheSize_ -= std::min(cacheSize_, node->writeBackSize());
+	usedNodes_.erase(iter->second);
+	nodes_.erase(iter);
+	indexErase(node->nid());
+	// lock free readers and pinning writers may still be inside it.
+	slab_->epoch()->retire(Node::destroy, slab_, node);
+}
+
 void Cache::flush()
 {
-	;
+    {
+    MutexLockGuard lock(mutex_);
+    alive_ = false;
+    workerCond_.notify();
+    }
+    flow_.shutdown();
+
+    if(worker_) {
+        worker_->join();
+        delete worker_;
+        worker_ = NULL;
+    }
 }
 
@@ -2,12 +2,16 @@
 #define __BT_CACHE_H
 
 #include <list>
+#include <vector>
+#include <atomic>
 #include <boost/unordered_map.hpp>
 
 #include "Mutex.h"
 #include "Options.h"
 #include "RWLock.h"
 #include "Buffer.h"
+#include "Condition.h"
+#include "FlowControl.h"
 
 namespace bt {
 
@@ -16,6 +20,7 @@ class Thread;
 class Layout;
 class Slab;
 class Node;
+class Metrics;
 
 struct CacheNode
 {
@@ -28,27 +33,80 @@ struct CacheNode
 
 class Cache {
 public:
-    Cache(const Options& opts, Slab* slab);
+    Cache(const Options& opts, Slab* slab, Metrics* metrics);
     ~Cache();
 
     bool init();
-    void tie(BufferTree* tree, Layout* layout);
-    Node* getNode(nid_t nid, bool newNode);
+    void tie(Layout* layout);
+    // shards share the cache, a node built here belongs to tree.
+    Node* getNode(BufferTree* tree, nid_t nid, bool newNode, bool pin = true);
+    // unpinned nodes for a reader inside an epoch, the ones not cached
+    // are read in one go, ordered by their place on disk.
+    void getNodes(BufferTree* tree, const std::vector<nid_t>& nids,
+            std::vector<Node*>& nodes);
+    // a cached node, pinned, or NULL. it is not moved up the LRU list.
+    Node* peekNode(nid_t nid);
+    // a cached node for a reader inside an epoch, or NULL, without a
+    // lock: a hit only sets the node's reference bit.
+    Node* findNode(nid_t nid);
+    // a node merged away leaves the cache without a write back.
+    void dropNode(Node* node);
+    // stops the write back thread after a last pass writes every dirty
+    // node. the trees must outlive it, serializing a leaf compacts it.
     void flush();
 
+    // throttles a write of bytes to the root if write back is behind.
+    void makeRoomForWrite(size_t bytes);
+    FlowControl* flowControl() { return &flow_; }
+    Metrics* metrics() { return metrics_; }
+
 	void writeBack();
 	void flushDirtyNodes(std::map<nid_t, Node*>& dirtyNodes);
 	void evictFromMemory();
 
 private:
+    // nodes_ for lock free readers. the chains change under
+    // usedNodesLock_, unlinked entries and outgrown indexes are retired
+    // through the epoch.
+    struct IndexEntry
+    {
+        IndexEntry(nid_t n, Node* nd, IndexEntry* nx)
+            : nid(n), node(nd), next(nx)
+        {}
+
+        nid_t nid;
+        Node* node;
+        std::atomic<IndexEntry*> next;
+    };
+
+    struct Index
+    {
+        // n is a power of two.
+        explicit Index(size_t n) : mask(n - 1), count(0), buckets(n) {}
+
+        void link(nid_t nid, Node* node);
+
+        size_t mask;
+        size_t count;
+        std::vector<std::atomic<IndexEntry*> > buckets;
+    };
+
+    // REQUIRES: usedNodesLock_ is held.
+    Node* getNodeLocked(BufferTree* tree, nid_t nid, bool newNode, bool pin);
+    // REQUIRES: usedNodesLock_ is held.
+    void indexInsert(Node* node);
+    void indexErase(nid_t nid);
+    static void destroyIndex(void* arg, void* ptr);
+    static void destroyIndexEntry(void* arg, void* ptr);
+
     Options opts_;
     size_t cacheSize_;
     MutexLock mutex_;
+    Cond workerCond_;
 
     bool alive_;
     Thread* worker_;
     Layout* layout_;
-    BufferTree* tree_;
 
     typedef boost::unordered_map<nid_t, std::list<Node*>::iterator> NodeMap;
     NodeMap nodes_;
@@ -57,6 +115,9 @@ private:
 	Slab* slab_;
 	Buffer readBuf_;
 	MutexLock usedNodesLock_;
+	FlowControl flow_;
+	Metrics* metrics_;
+	std::atomic<Index*> index_;
 };
 }
 #endif
@@ -1,15 +1,42 @@
+#include <stdio.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+
 #include "DBImpl.h"
 #include "Logger.h"
 #include "Layout.h"
 #include "Cache.h"
 #include "BufferTree.h"
 #include "Slice.h"
+#include "Slab.h"
+#include "RowCache.h"
+#include "PinnableSlice.h"
+#include "Thread.h"
+#include "BulkLoader.h"
+#include "TransactionImpl.h"
+#include "Epoch.h"
 
 using namespace bt;
 
 DBImpl::~DBImpl()
 {
-    delete bufferTree_;
+    // the trees go away under the rebalancer otherwise.
+    {
+    MutexLockGuard lock(mutex_);
+    alive_ = false;
+    cond_.notify();
+    }
+    if(rebalancer_) {
+        rebalancer_->join();
+        delete rebalancer_;
+    }
+
+    // the last write back still reaches into the trees.
+    if(cache_)
+        cache_->flush();
+    for(size_t i = 0; i < trees_.size(); ++i)
+        delete trees_[i];
+    delete rowCache_;
     delete cache_;
     delete layout_;
 	delete slab_;
@@ -18,32 +45,77 @@ DBImpl::~DBImpl()
 bool DBImpl::init()
 {
 	LOGFMTI("DBImpl::init SLAB_SIZE: %d", SLAB_SIZE);
+    opts_.sanitize();
+	LOGFMTI("DBImpl::init node size %lu, fanout %lu, buffer %lu bytes",
+			opts_.nodeSize, opts_.maxNodeChildNum, opts_.maxBufferBytes);
 	slab_ = new Slab();
 	if(!slab_->init(SLAB_SIZE)) {// default 256M
 		LOGFMTF("init slab error");
 		return false;
 	}
-    layout_ = new Layout(name_);
+    layout_ = new Layout(name_, &metrics_);
     if(!layout_->init()) {
 		LOGFMTF("init table error");
         return false;
     }
 
-    cache_ = new Cache(opts_, slab_);
+    cache_ = new Cache(opts_, slab_, &metrics_);
+    cache_->tie(layout_);
     if(!cache_->init()) {
 		LOGFMTF("init cache error");
         return false;
     }
 
-    bufferTree_ = new BufferTree(name_, opts_, cache_, layout_);
-    if(!bufferTree_->init()) {
-		LOGFMTF("init buffer tree error");
-        return false;
+    if(opts_.shards == 0)
+        opts_.shards = 1;
+    if(!opts_.shardBoundaries.empty()
+            && opts_.shardBoundaries.size() != opts_.shards - 1) {
+		LOGFMTW("DBImpl::init expect %lu shard boundaries, got %lu, hash keys instead",
+				opts_.shards - 1, opts_.shardBoundaries.size());
+        opts_.shardBoundaries.clear();
+    }
+
+    if(opts_.rowCacheSize)
+        rowCache_ = new RowCache(opts_.rowCacheSize, &metrics_);
+
+    for(size_t i = 0; i < opts_.shards; ++i) {
+        BufferTree* tree = new BufferTree(name_, i, opts_, cache_, layout_,
+                slab_->epoch(), &snapshots_, rowCache_);
+        trees_.push_back(tree);
+        if(!tree->init()) {
+			LOGFMTF("init buffer tree [%lu] error", i);
+            return false;
+        }
+    }
+
+    if(opts_.rebalanceIntervalMs) {
+        alive_ = true;
+        rebalancer_ = new Thread(boost::bind(&DBImpl::rebalance, this));
+        rebalancer_->start();
     }
 
     return true;
 }
 
+void DBImpl::rebalance()
+{
+    bool alive = true;
+
+    while(alive) {
+        {
+        MutexLockGuard lock(mutex_);
+        if(alive_)
+            cond_.waitForMicros(1000 * opts_.rebalanceIntervalMs);
+        alive = alive_;
+        }
+        if(!alive)
+            break;
+
+        for(size_t i = 0; i < trees_.size(); ++i)
+            trees_[i]->rebalance();
+    }
+}
+
 DB* bt::DB::open(const std::string& name, const Options& opts)
 {
     DBImpl* db = new DBImpl(name, opts);
@@ -56,17 +128,383 @@ DB* bt::DB::open(const std::string& name, const Options& opts)
     return db;
 }
 
+// FNV-1a
+static uint32_t hashKey(const Slice& key)
+{
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < key.size(); ++i) {
+        h ^= static_cast<uint8_t>(key[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// range shards keep keys ordered across trees, so a scan only has to
+// visit them in turn; hashed shards spread skewed keys evenly.
+size_t DBImpl::shardIndex(const Slice& key)
+{
+    if(trees_.size() == 1)
+        return 0;
+
+    const std::vector<std::string>& bounds = opts_.shardBoundaries;
+    if(bounds.empty())
+        return hashKey(key) % trees_.size();
+
+    size_t lo = 0, hi = bounds.size();
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(key.compare(Slice(const_cast<std::string&>(bounds[mid]))) < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+BufferTree* DBImpl::shardFor(const Slice& key)
+{
+    return trees_[shardIndex(key)];
+}
+
 bool DBImpl::put(Slice& key, Slice& value)
 {
-    return bufferTree_->put(key, value);
+    MetricsTimer timer(&metrics_, Metrics::kPutMicros);
+    metrics_.add(Metrics::kPuts);
+    metrics_.add(Metrics::kUserBytes, key.size() + value.size());
+    return shardFor(key)->put(key, value);
+}
+
+bool DBImpl::put(Slice& key, Slice& value, uint64_t expireAt)
+{
+    MetricsTimer timer(&metrics_, Metrics::kPutMicros);
+    metrics_.add(Metrics::kPuts);
+    metrics_.add(Metrics::kUserBytes, key.size() + value.size());
+    return shardFor(key)->put(key, value, expireAt);
+}
+
+bool DBImpl::get(Slice& key, PinnableSlice* value)
+{
+    MetricsTimer timer(&metrics_, Metrics::kGetMicros);
+    metrics_.add(Metrics::kGets);
+    return shardFor(key)->get(key, value);
+}
+
+bool DBImpl::get(Slice& key, std::string* value)
+{
+    MetricsTimer timer(&metrics_, Metrics::kGetMicros);
+    metrics_.add(Metrics::kGets);
+
+    PinnableSlice pinned;
+    if(!shardFor(key)->get(key, &pinned))
+        return false;
+    value->assign(pinned.data(), pinned.size());
+    return true;
+}
+
+bool DBImpl::get(Slice& key, std::string* value, const Snapshot* snapshot)
+{
+    MetricsTimer timer(&metrics_, Metrics::kGetMicros);
+    metrics_.add(Metrics::kGets);
+
+    PinnableSlice pinned;
+    if(!shardFor(key)->get(key, &pinned, snapshot->sequence()))
+        return false;
+    value->assign(pinned.data(), pinned.size());
+    return true;
+}
+
+bool DBImpl::get(Slice& key, PinnableSlice* value, const Snapshot* snapshot)
+{
+    MetricsTimer timer(&metrics_, Metrics::kGetMicros);
+    metrics_.add(Metrics::kGets);
+    return shardFor(key)->get(key, value, snapshot->sequence());
+}
+
+const Snapshot* DBImpl::getSnapshot()
+{
+    return snapshots_.acquire();
+}
+
+void DBImpl::releaseSnapshot(const Snapshot* snapshot)
+{
+    snapshots_.release(snapshot);
+}
+
+Transaction* DBImpl::beginTransaction()
+{
+    return new TransactionImpl(this, getSnapshot());
+}
+
+namespace {
+
+bool sliceOrder(const Slice& a, const Slice& b)
+{
+    return a.compare(b) < 0;
+}
+
+}
+
+// every buffer a key goes to is locked before the reads are checked,
+// so a write to them either is seen or waits for the commit. the
+// writes share one sequence number, a snapshot sees all or none.
+// trees are locked in order, no two commits wait for each other.
+bool DBImpl::commit(const std::vector<Slice>& reads, const std::vector<Msg>& writes,
+        uint64_t since)
+{
+    // the reads were all at one snapshot, nothing to apply.
+    if(writes.empty()) {
+        metrics_.add(Metrics::kTxnCommits);
+        return true;
+    }
+
+    size_t pending = 0;
+    std::vector<std::vector<Slice> > keys(trees_.size());
+    for(size_t i = 0; i < reads.size(); ++i)
+        keys[shardIndex(reads[i])].push_back(reads[i]);
+    for(size_t i = 0; i < writes.size(); ++i) {
+        keys[shardIndex(writes[i].key())].push_back(writes[i].key());
+        pending += writes[i].size() + 8;
+    }
+    cache_->makeRoomForWrite(pending);
+
+    EpochGuard guard(slab_->epoch());
+    std::vector<CommitLock> locks(trees_.size());
+    for(size_t t = 0; t < trees_.size(); ++t) {
+        if(keys[t].empty())
+            continue;
+        std::sort(keys[t].begin(), keys[t].end(), sliceOrder);
+        trees_[t]->lockCommit(keys[t], &locks[t]);
+    }
+
+    bool clean = true;
+    for(size_t i = 0; clean && i < reads.size(); ++i) {
+        size_t t = shardIndex(reads[i]);
+        clean = trees_[t]->latest(&locks[t], reads[i]) <= since;
+    }
+    if(clean) {
+        uint64_t seq = snapshots_.next();
+        for(size_t i = 0; i < writes.size(); ++i) {
+            Msg msg = writes[i];
+            msg.setSeq(seq);
+            size_t t = shardIndex(msg.key());
+            trees_[t]->write(&locks[t], msg);
+        }
+    }
+
+    // the keys first, the roots last to first: a push down waiting in
+    // one tree holds no lock of the trees after it.
+    for(size_t t = 0; t < trees_.size(); ++t) {
+        if(locks[t].root)
+            trees_[t]->unlockKeys(&locks[t]);
+    }
+    for(size_t t = trees_.size(); t-- > 0; ) {
+        if(locks[t].root)
+            trees_[t]->unlockCommit(&locks[t]);
+    }
+
+    if(!clean) {
+        metrics_.add(Metrics::kTxnRetries);
+        return false;
+    }
+
+    // after the writes, like BufferTree::put.
+    if(rowCache_) {
+        for(size_t i = 0; i < writes.size(); ++i)
+            rowCache_->erase(writes[i].key());
+    }
+    size_t bytes = 0;
+    for(size_t i = 0; i < writes.size(); ++i)
+        bytes += writes[i].key().size() + writes[i].value().size();
+    metrics_.add(Metrics::kTxnCommits);
+    metrics_.add(Metrics::kUserBytes, bytes);
+    return true;
+}
+
+namespace {
+
+struct KeyOrder
+{
+    const std::vector<Slice>& keys;
+    KeyOrder(const std::vector<Slice>& k) : keys(k) {}
+    bool operator()(size_t a, size_t b) const
+    {
+        return keys[a].compare(keys[b]) < 0;
+    }
+};
+
 }
 
-bool DBImpl::get(Slice& key, Slice& value)
+void DBImpl::multiGet(const std::vector<Slice>& keys, std::vector<std::string>* values,
+        std::vector<bool>* statuses)
 {
-    return bufferTree_->get(key, value);
+    MetricsTimer timer(&metrics_, Metrics::kMultiGetMicros);
+    metrics_.add(Metrics::kGets, keys.size());
+
+    values->assign(keys.size(), std::string());
+    statuses->assign(keys.size(), false);
+
+    std::vector<size_t> order(keys.size());
+    for(size_t i = 0; i < keys.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), KeyOrder(keys));
+
+    // split the sorted batch by shard, each keeps the key order.
+    std::vector<std::vector<size_t> > batches(trees_.size());
+    for(size_t i = 0; i < order.size(); ++i)
+        batches[shardIndex(keys[order[i]])].push_back(order[i]);
+
+    for(size_t t = 0; t < trees_.size(); ++t) {
+        if(!batches[t].empty())
+            trees_[t]->multiGet(keys, batches[t], values, statuses);
+    }
+}
+
+bool DBImpl::merge(Slice& key, Slice& operand)
+{
+    if(opts_.mergeOperator == NULL)
+        return false;
+
+    MetricsTimer timer(&metrics_, Metrics::kMergeMicros);
+    metrics_.add(Metrics::kMerges);
+    metrics_.add(Metrics::kUserBytes, key.size() + operand.size());
+    return shardFor(key)->merge(key, operand);
 }
 
 bool DBImpl::del(Slice& key)
 {
-    return bufferTree_->del(key);
+    MetricsTimer timer(&metrics_, Metrics::kDelMicros);
+    metrics_.add(Metrics::kDels);
+    metrics_.add(Metrics::kUserBytes, key.size());
+    return shardFor(key)->del(key);
+}
+
+bool DBImpl::deleteRange(Slice& begin, Slice& end)
+{
+    if(begin.compare(end) >= 0)
+        return false;
+
+    MetricsTimer timer(&metrics_, Metrics::kDelMicros);
+    metrics_.add(Metrics::kDelRanges);
+    metrics_.add(Metrics::kUserBytes, begin.size() + end.size());
+
+    // hashed shards may all hold keys of the range, boundaries
+    // limit it to the shards between begin's and end's.
+    size_t first = 0, last = trees_.size() - 1;
+    if(!opts_.shardBoundaries.empty()) {
+        first = shardIndex(begin);
+        last = shardIndex(end);
+    }
+
+    bool succ = true;
+    for(size_t t = first; t <= last; ++t)
+        succ = trees_[t]->deleteRange(begin, end) && succ;
+    return succ;
+}
+
+// every tree gets a loader, the keys of a shard reach it in order.
+// hashed shards would take keys out of order as long as each shard's
+// are in order, they are checked here. the trees change only once all
+// of them are built, all together or none: a failed load drops what
+// it wrote.
+bool DBImpl::bulkLoad(Iterator* iter)
+{
+    for(size_t t = 0; t < trees_.size(); ++t) {
+        if(!trees_[t]->empty()) {
+            LOGFMTW("DBImpl::bulkLoad shard [%lu] is not empty", t);
+            return false;
+        }
+    }
+
+    std::vector<BulkLoader*> loaders;
+    for(size_t t = 0; t < trees_.size(); ++t)
+        loaders.push_back(new BulkLoader(trees_[t], opts_, layout_, slab_));
+
+    bool succ = true;
+    uint64_t bytes = 0;
+    std::string last;
+    bool first = true;
+    for(; succ && iter->valid(); iter->next()) {
+        Slice key = iter->key();
+        Slice value = iter->value();
+        if(!first && key.compare(Slice(last)) <= 0) {
+            succ = false;
+            break;
+        }
+        succ = loaders[shardIndex(key)]->add(key, value);
+        last.assign(key.data(), key.size());
+        first = false;
+        bytes += key.size() + value.size();
+    }
+    if(!succ)
+        LOGFMTW("DBImpl::bulkLoad keys out of order");
+
+    std::vector<nid_t> roots(loaders.size(), NID_NIL);
+    for(size_t t = 0; succ && t < loaders.size(); ++t)
+        roots[t] = loaders[t]->finish();
+
+    // the roots are locked in order like a commit's, no tree changes
+    // until every one of them is still empty.
+    {
+    EpochGuard guard(slab_->epoch());
+    std::vector<InstallLock> locks(trees_.size());
+    for(size_t t = 0; succ && t < trees_.size(); ++t) {
+        if(roots[t] != NID_NIL && !trees_[t]->lockInstall(roots[t], &locks[t])) {
+            LOGFMTW("DBImpl::bulkLoad shard [%lu] was written to", t);
+            succ = false;
+        }
+    }
+    for(size_t t = trees_.size(); t-- > 0; ) {
+        if(!locks[t].root)
+            continue;
+        if(succ)
+            trees_[t]->installRoot(&locks[t]);
+        else
+            trees_[t]->unlockInstall(&locks[t]);
+    }
+    }
+
+    for(size_t t = 0; t < loaders.size(); ++t) {
+        if(succ)
+            metrics_.add(Metrics::kBulkLoadKeys, loaders[t]->count());
+        else
+            loaders[t]->abandon();
+        delete loaders[t];
+    }
+    if(succ)
+        metrics_.add(Metrics::kUserBytes, bytes);
+    return succ;
+}
+
+bool DBImpl::getProperty(const std::string& property, std::string* value)
+{
+    if(property == "bt.flow") {
+        *value = cache_->flowControl()->stats().toString();
+        return true;
+    }
+
+    if(property == "bt.stats") {
+        *value = metrics_.toString();
+        return true;
+    }
+
+    if(property == "bt.row-cache") {
+        uint64_t hits = metrics_.ticker(Metrics::kRowCacheHits);
+        uint64_t misses = metrics_.ticker(Metrics::kRowCacheMisses);
+        char buf[256];
+        snprintf(buf, sizeof(buf),
+                "capacity: %lu\nusage: %lu\nhits: %lu\nmisses: %lu\nhit_rate: %.4f\n",
+                rowCache_ ? rowCache_->capacity() : 0,
+                rowCache_ ? rowCache_->usage() : 0,
+                hits, misses,
+                hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0);
+        *value = buf;
+        return true;
+    }
+
+    if(property == "bt.write-amp") {
+        *value = metrics_.writeAmpString();
+        return true;
+    }
+
+    return false;
 }
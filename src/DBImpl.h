@@ -1,7 +1,14 @@
 #ifndef __BT_DB_IMPL_H
 #define __BT_DB_IMPL_H
 
+#include <vector>
+
 #include "DB.h"
+#include "Metrics.h"
+#include "Mutex.h"
+#include "Condition.h"
+#include "SnapshotList.h"
+#include "Msg.h"
 
 namespace bt {
 
@@ -9,6 +16,8 @@ class BufferTree;
 class Cache;
 class Layout;
 class Slab;
+class RowCache;
+class Thread;
 
 class DBImpl : public DB
 {
@@ -18,24 +27,61 @@ public:
           opts_(opts),
           layout_(NULL),
           cache_(NULL),
-          bufferTree_(NULL),
-          slab_(new Slab())
+          rowCache_(NULL),
+          trees_(),
+          slab_(new Slab()),
+          metrics_(),
+          snapshots_(),
+          mutex_(),
+          cond_(mutex_),
+          alive_(false),
+          rebalancer_(NULL)
     {}
     ~DBImpl();
 
     bool init();
     bool put(Slice& key, Slice& value);
-    bool get(Slice& key, Slice& value);
+    bool put(Slice& key, Slice& value, uint64_t expireAt);
+    bool get(Slice& key, PinnableSlice* value);
+    bool get(Slice& key, std::string* value);
+    bool get(Slice& key, std::string* value, const Snapshot* snapshot);
+    bool get(Slice& key, PinnableSlice* value, const Snapshot* snapshot);
+    void multiGet(const std::vector<Slice>& keys, std::vector<std::string>* values,
+            std::vector<bool>* statuses);
     bool del(Slice& key);
+    bool merge(Slice& key, Slice& operand);
+    bool deleteRange(Slice& begin, Slice& end);
+    bool bulkLoad(Iterator* iter);
+    const Snapshot* getSnapshot();
+    void releaseSnapshot(const Snapshot* snapshot);
+    Transaction* beginTransaction();
+    // applies writes if none of reads was written after since. each
+    // key is written once. see TransactionImpl.
+    bool commit(const std::vector<Slice>& reads, const std::vector<Msg>& writes,
+            uint64_t since);
+    bool getProperty(const std::string& property, std::string* value);
 
 private:
+    size_t shardIndex(const Slice& key);
+    BufferTree* shardFor(const Slice& key);
+    // the background thread merging what deletes left underfull.
+    void rebalance();
+
     std::string name_;
     Options opts_;
 
     Layout* layout_;
     Cache* cache_;
-    BufferTree* bufferTree_;
+    RowCache* rowCache_;
+    std::vector<BufferTree*> trees_;
 	Slab* slab_;
+    Metrics metrics_;
+    SnapshotList snapshots_;
+
+    MutexLock mutex_;
+    Cond cond_;
+    bool alive_;
+    Thread* rebalancer_;
 };
 
 }
@@ -0,0 +1,99 @@
+#include "Filter.h"
+
+using namespace bt;
+
+BloomFilter::BloomFilter(size_t bits, size_t bitsPerKey)
+    : words_(NULL),
+      nwords_((bits + 63) / 64),
+      probes_(bitsPerKey * 69 / 100) // ln 2 bits per key is optimal
+{
+    if(probes_ < 1)
+        probes_ = 1;
+    if(probes_ > 30)
+        probes_ = 30;
+
+    if(nwords_) {
+        words_ = new std::atomic<uint64_t>[nwords_];
+        clear();
+    }
+}
+
+BloomFilter::~BloomFilter()
+{
+    delete[] words_;
+}
+
+// FNV-1a 64 with a final mix, the probes are derived from both halves.
+uint64_t BloomFilter::hash(const Slice& key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < key.size(); ++i) {
+        h ^= static_cast<uint8_t>(key[i]);
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+void BloomFilter::add(const Slice& key)
+{
+    if(!nwords_)
+        return;
+
+    uint64_t h = hash(key);
+    uint32_t h1 = static_cast<uint32_t>(h);
+    uint32_t delta = static_cast<uint32_t>(h >> 32) | 1;
+    uint64_t bits = nwords_ * 64;
+    for(size_t i = 0; i < probes_; ++i) {
+        uint64_t bit = h1 % bits;
+        words_[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+        h1 += delta;
+    }
+}
+
+bool BloomFilter::mayContain(const Slice& key) const
+{
+    if(!nwords_)
+        return true;
+
+    uint64_t h = hash(key);
+    uint32_t h1 = static_cast<uint32_t>(h);
+    uint32_t delta = static_cast<uint32_t>(h >> 32) | 1;
+    uint64_t bits = nwords_ * 64;
+    for(size_t i = 0; i < probes_; ++i) {
+        uint64_t bit = h1 % bits;
+        if(!(words_[bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64))))
+            return false;
+        h1 += delta;
+    }
+    return true;
+}
+
+void BloomFilter::clear()
+{
+    for(size_t i = 0; i < nwords_; ++i)
+        words_[i].store(0, std::memory_order_relaxed);
+}
+
+void BloomFilter::encode(Buffer& writer) const
+{
+    writer.appendInt32(nwords_);
+    for(size_t i = 0; i < nwords_; ++i)
+        writer.appendInt64(words_[i].load(std::memory_order_relaxed));
+}
+
+bool BloomFilter::decode(Buffer& reader)
+{
+    uint32_t nwords = reader.readInt32();
+    if(nwords != nwords_) {
+        for(size_t i = 0; i < nwords; ++i)
+            reader.readInt64();
+        return false;
+    }
+
+    for(size_t i = 0; i < nwords_; ++i)
+        words_[i].store(reader.readInt64(), std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef __BT_FILTER_H
+#define __BT_FILTER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <boost/noncopyable.hpp>
+
+#include "Slice.h"
+#include "Buffer.h"
+
+namespace bt {
+
+// Bloom filter over the keys of one MsgBuf, so a point lookup can pass
+// a buffer without locking and searching it.
+//
+// Bits are only set with atomic ors, lock free readers see a key once
+// its add() is visible. clear() is not atomic as a whole, readers must
+// validate the owner's version afterwards like they do for the list.
+class BloomFilter : boost::noncopyable
+{
+public:
+    // bits == 0 disables the filter, mayContain() is always true.
+    explicit BloomFilter(size_t bits, size_t bitsPerKey);
+    ~BloomFilter();
+
+    void add(const Slice& key);
+    bool mayContain(const Slice& key) const;
+    void clear();
+
+    bool enabled() const { return nwords_ != 0; }
+    // bytes of encode().
+    size_t encodedSize() const { return 4 + nwords_ * 8; }
+    void encode(Buffer& writer) const;
+    // false if the stored filter has another size, the caller must
+    // add() its keys again.
+    bool decode(Buffer& reader);
+
+private:
+    static uint64_t hash(const Slice& key);
+
+    std::atomic<uint64_t>* words_;
+    size_t nwords_;
+    size_t probes_;
+};
+
+}
+
+#endif
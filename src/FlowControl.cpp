@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "FlowControl.h"
+#include "Logger.h"
+#include "Timestamp.h"
+
+using namespace bt;
+
+std::string FlowStats::toString() const
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+            "dirty_bytes: %lu\nbuffered_bytes: %lu\n"
+            "slowdowns: %lu\nslowdown_micros: %lu\n"
+            "stops: %lu\nstop_micros: %lu\n",
+            dirtyBytes, bufferedBytes,
+            slowdowns, slowdownMicros,
+            stops, stopMicros);
+    return buf;
+}
+
+FlowControl::FlowControl(const Options& opts)
+    : opts_(opts),
+      dirtyBytes_(0),
+      bufferedBytes_(0),
+      mutex_(),
+      cond_(mutex_),
+      shutdown_(false),
+      stats_()
+{}
+
+void FlowControl::addPending(size_t bytes)
+{
+    dirtyBytes_.fetch_add(bytes, std::memory_order_relaxed);
+    bufferedBytes_.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void FlowControl::setPending(size_t dirtyBytes, size_t bufferedBytes)
+{
+    MutexLockGuard lock(mutex_);
+    dirtyBytes_.store(dirtyBytes, std::memory_order_relaxed);
+    bufferedBytes_.store(bufferedBytes, std::memory_order_relaxed);
+
+    if(state() != kStop)
+        cond_.notify_all();
+}
+
+void FlowControl::flushed(size_t bytes)
+{
+    MutexLockGuard lock(mutex_);
+    // writers keep adding meanwhile.
+    size_t dirty = dirtyBytes_.load(std::memory_order_relaxed);
+    while(!dirtyBytes_.compare_exchange_weak(dirty, dirty - std::min(bytes, dirty),
+                std::memory_order_relaxed))
+        ;
+
+    if(state() != kStop)
+        cond_.notify_all();
+}
+
+FlowControl::State FlowControl::state() const
+{
+    size_t dirty = dirtyBytes_.load(std::memory_order_relaxed);
+    size_t buffered = bufferedBytes_.load(std::memory_order_relaxed);
+    if(dirty >= opts_.writeStopBytes || buffered >= opts_.bufferStopBytes)
+        return kStop;
+    if(dirty >= opts_.writeSlowdownBytes || buffered >= opts_.bufferSlowdownBytes)
+        return kSlowdown;
+    return kNormal;
+}
+
+// how far into the slowdown band we are, 0.0 ~ 1.0
+double FlowControl::slowdownRatio() const
+{
+    size_t dirty = dirtyBytes_.load(std::memory_order_relaxed);
+    size_t buffered = bufferedBytes_.load(std::memory_order_relaxed);
+    double ratio = 0.0;
+
+    if(dirty > opts_.writeSlowdownBytes
+            && opts_.writeStopBytes > opts_.writeSlowdownBytes) {
+        ratio = (double)(dirty - opts_.writeSlowdownBytes)
+            / (opts_.writeStopBytes - opts_.writeSlowdownBytes);
+    }
+    if(buffered > opts_.bufferSlowdownBytes
+            && opts_.bufferStopBytes > opts_.bufferSlowdownBytes) {
+        double r = (double)(buffered - opts_.bufferSlowdownBytes)
+            / (opts_.bufferStopBytes - opts_.bufferSlowdownBytes);
+        if(r > ratio)
+            ratio = r;
+    }
+
+    return ratio > 1.0 ? 1.0 : ratio;
+}
+
+void FlowControl::delayWrite()
+{
+    if(state() == kNormal)
+        return;
+
+    int64_t delay = 0;
+    {
+    MutexLockGuard lock(mutex_);
+
+    State now = state();
+    if(now == kNormal || shutdown_)
+        return;
+
+    if(now == kStop) {
+        LOGFMTW("FlowControl::delayWrite stop writes, dirty [%lu] buffered [%lu]",
+                dirtyBytes_.load(std::memory_order_relaxed),
+                bufferedBytes_.load(std::memory_order_relaxed));
+
+        Timestamp start = Timestamp::now();
+        ++stats_.stops;
+        // wait for the write back thread, recheck every 100ms
+        // in case a wakeup was missed.
+        while(state() == kStop && !shutdown_)
+            cond_.waitForMicros(100 * 1000);
+        stats_.stopMicros += timeDifference(Timestamp::now(), start);
+
+        if(state() != kSlowdown || shutdown_)
+            return;
+    }
+
+    ++stats_.slowdowns;
+    // grow the delay linearly through the slowdown band.
+    delay = static_cast<int64_t>(opts_.writeSlowdownMicros * slowdownRatio());
+    if(delay <= 0)
+        delay = 1;
+    stats_.slowdownMicros += delay;
+    }
+
+    ::usleep(delay);
+}
+
+void FlowControl::shutdown()
+{
+    MutexLockGuard lock(mutex_);
+    shutdown_ = true;
+    cond_.notify_all();
+}
+
+FlowStats FlowControl::stats()
+{
+    MutexLockGuard lock(mutex_);
+    FlowStats stats = stats_;
+    stats.dirtyBytes = dirtyBytes_.load(std::memory_order_relaxed);
+    stats.bufferedBytes = bufferedBytes_.load(std::memory_order_relaxed);
+    return stats;
+}
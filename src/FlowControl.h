@@ -0,0 +1,77 @@
+#ifndef __BT_FLOW_CONTROL_H
+#define __BT_FLOW_CONTROL_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <boost/noncopyable.hpp>
+
+#include "Mutex.h"
+#include "Condition.h"
+#include "Options.h"
+
+namespace bt {
+
+struct FlowStats
+{
+    size_t dirtyBytes;
+    size_t bufferedBytes;
+    uint64_t slowdowns;
+    uint64_t stops;
+    uint64_t slowdownMicros;
+    uint64_t stopMicros;
+
+    FlowStats()
+        : dirtyBytes(0), bufferedBytes(0),
+          slowdowns(0), stops(0),
+          slowdownMicros(0), stopMicros(0)
+    {}
+
+    std::string toString() const;
+};
+
+// Throttles writers when the write back thread falls behind.
+// Pending bytes are the node images Cache::writeBack samples each sweep,
+// writers add what they buffer in between so a burst is seen before the
+// next sweep. Writers touch them without the lock, only a stalled one
+// takes it.
+class FlowControl : boost::noncopyable
+{
+public:
+    enum State {
+        kNormal,
+        kSlowdown,
+        kStop,
+    };
+
+    explicit FlowControl(const Options& opts);
+
+    // bytes a write adds to the root's buffers.
+    void addPending(size_t bytes);
+    // the sweep's measure, it replaces what writers added since.
+    void setPending(size_t dirtyBytes, size_t bufferedBytes);
+    void flushed(size_t bytes);
+    State state() const;
+
+    // called by BufferTree before a write enters the root.
+    void delayWrite();
+    void shutdown();
+
+    FlowStats stats();
+
+private:
+    double slowdownRatio() const;
+
+    Options opts_;
+    std::atomic<size_t> dirtyBytes_;
+    std::atomic<size_t> bufferedBytes_;
+    MutexLock mutex_;
+    Cond cond_;
+    bool shutdown_;
+    // the stall counters, guarded by mutex_.
+    FlowStats stats_;
+};
+
+}
+
+#endif
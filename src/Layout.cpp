@@ -2,37 +2,44 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string>
+#include <algorithm>
 
 #include "Layout.h"
 #include "Logger.h"
 #include "Node.h"
 #include "BufferTree.h"
+#include "Metrics.h"
 
 using namespace bt;
 
-Layout::Layout(std::string& name)
+Layout::Layout(std::string& name, Metrics* metrics)
     : name_(name),
       curDataId_(0),
-      rootNodeId_(0),
+      rootNodeIds_(),
       maxNodeId_(0),
       curFd_(-1),
       curMetaFd_(-1),
       curPath_(DATA_PATH),
       metaPath_(META_PATH),
+      metadataLock_(),
       metadata_(1024),
+      writeLock_(),
+      dataEnd_(0),
       writeBuf_(),
-      tree_(NULL)
+      tree_(NULL),
+      metrics_(metrics)
 {
 	curPath_ += name;
 	metaPath_ += name;
-	
-	// ensure hold 4 nodes(1M = 256K * 4).
-	writeBuf_.ensureWritableBytes(1024 * 1024 * 1024);
+	// writeBuf_ grows to the largest node image on demand.
 }
 
 Layout::~Layout()
 {
-
+    if(curFd_ >= 0)
+        close(curFd_);
+    if(curMetaFd_ >= 0)
+        close(curMetaFd_);
 }
 
 bool Layout::findDataFile()
@@ -40,30 +47,40 @@ bool Layout::findDataFile()
     return false;
 }
 
+// the files are opened once here and never switched, readers on cache
+// misses and the write back thread share the fds through pread/pwrite.
 bool Layout::init()
 {
+	curPath_ = curPath_ + "_" + std::string(1, '0');
+    curFd_ = open(curPath_.data(), O_RDWR | O_LARGEFILE | O_CREAT);
+    if(curFd_ < 0) {
+		LOGFMTA("Layout::init open curfd error [%d]", curFd_);
+		return false;
+	}
+
+	curMetaFd_ = open(metaPath_.data(), O_RDWR | O_LARGEFILE | O_CREAT);
+    if(curMetaFd_ < 0) {
+		LOGFMTA("Layout::init open curMetaFd_ error [%d]", curMetaFd_);
+		return false;
+	}
+
     if(findDataFile()){
         if(!loadMetadata(10))
             return false;
-    } else {
-		curPath_ = curPath_ + "_" + std::string(1, '0');
-        curFd_ = open(curPath_.data(), O_RDWR | O_LARGEFILE | O_CREAT);
-        if(curFd_ < 0) {
-			LOGFMTA("Layout::init open curfd error [%d]", curFd_);
-			return false;
-		}
-
-		curMetaFd_ = open(metaPath_.data(), O_RDWR | O_LARGEFILE | O_CREAT);
-        if(curMetaFd_ < 0) {
-			LOGFMTA("Layout::init open curMetaFd_ error [%d]", curMetaFd_);
-			return false;
-		}
     }
 
-
     return true;
 }
 
+int Layout::fdFor(const std::string& path)
+{
+    if(path == curPath_)
+        return curFd_;
+    if(path == metaPath_)
+        return curMetaFd_;
+    return -1;
+}
+
 bool Layout::loadMetadata(size_t len)
 {
     //结合系统缓存实现元数据信息的持久化
@@ -75,18 +92,27 @@ bool Layout::loadMetadata(size_t len)
         return false;
     }
 
-    rootNodeId_ = writeBuf_.readInt32();
+    uint32_t shards = writeBuf_.readInt32();
     maxNodeId_ = writeBuf_.readInt32();
     curDataId_ = writeBuf_.readInt32();
 
+    // shard roots follow the fixed header.
+    readFile(metaPath_, 16, shards * 4, writeBuf_);
+    rootNodeIds_.resize(shards);
+    for(size_t i = 0; i < shards; ++i)
+        rootNodeIds_[i] = writeBuf_.readInt32();
+
     Postion nodePos;
 	readFile(metaPath_, HEADER, maxNodeId_ * POSTION_SIZE, writeBuf_);
 	
     for(size_t i = 0; i < maxNodeId_; ++i) {
         nodePos.dataId = writeBuf_.readInt8();
-        nodePos.offset = writeBuf_.readInt32();
+        nodePos.offset = writeBuf_.readInt64();
         nodePos.size = writeBuf_.readInt32();
+        nodePos.capacity = writeBuf_.readInt32();
         metadata_.push_back(nodePos);
+        if(nodePos.offset + nodePos.capacity > dataEnd_)
+            dataEnd_ = nodePos.offset + nodePos.capacity;
     }
 
 
@@ -98,16 +124,20 @@ bool Layout::flushMetadata()
 {
 	writeBuf_.retrieveAll();
     writeBuf_.appendInt32(MAGIC);
-    writeBuf_.appendInt32(rootNodeId_);
+    writeBuf_.appendInt32(rootNodeIds_.size());
     writeBuf_.appendInt32(maxNodeId_);
     writeBuf_.appendInt32(curDataId_);
+    for(size_t i = 0; i < rootNodeIds_.size(); ++i)
+        writeBuf_.appendInt32(rootNodeIds_[i]);
 
-	writeFile(metaPath_, 0, 16, writeBuf_);
+    assert(writeBuf_.readableBytes() <= HEADER);
+	writeFile(metaPath_, 0, writeBuf_.readableBytes(), writeBuf_);
 
     for(size_t i = 0; i < metadata_.size(); ++i) {
         writeBuf_.appendInt8(metadata_[i].dataId);
-        writeBuf_.appendInt32(metadata_[i].offset);
+        writeBuf_.appendInt64(metadata_[i].offset);
         writeBuf_.appendInt32(metadata_[i].size);
+        writeBuf_.appendInt32(metadata_[i].capacity);
     }
 
     writeFile(metaPath_, HEADER, metadata_.size() * POSTION_SIZE, writeBuf_);
@@ -136,23 +166,69 @@ bool Layout::flushData(std::vector<Node*>& nodes)
 bool Layout::find(nid_t nid, Buffer& buf)
 {
     // 从元数据中找到结点位置信息
-    Postion nodePos = metadata_[nid];
+    Postion nodePos;
+    {
+    MutexLockGuard lock(metadataLock_);
+    if(nid >= metadata_.size())
+        return false;
+    nodePos = metadata_[nid];
+    }
+    if(nodePos.size == 0)
+        return false;
 
     std::string path = DATA_PATH + name_ + "_" + std::string(1, (nodePos.dataId + '0'));
-    LOGFMTI("Layout::find path: %s", path.c_str());
+    LOGFMTT("Layout::find path: %s", path.c_str());
 	
     readFile(path, nodePos.offset, nodePos.size, buf);
 
     return true;
 }
 
+void Layout::prefetch(const std::vector<nid_t>& nids)
+{
+	std::vector<std::pair<uint64_t, uint32_t> > extents;
+	{
+	MutexLockGuard lock(metadataLock_);
+	for(size_t i = 0; i < nids.size(); ++i) {
+		if(nids[i] >= metadata_.size())
+			continue;
+		const Postion& pos = metadata_[nids[i]];
+		if(pos.size && pos.dataId == static_cast<char>(curDataId_))
+			extents.push_back(std::make_pair(pos.offset, pos.size));
+	}
+	}
+
+	std::sort(extents.begin(), extents.end());
+	for(size_t i = 0; i < extents.size(); ++i)
+		posix_fadvise(curFd_, extents[i].first, extents[i].second, POSIX_FADV_WILLNEED);
+}
+
+// keep the extent while the image fits, else take a new one at the end
+// of the file with a quarter of slack so a growing node does not move
+// on every write. the old extent is not reused.
+Postion Layout::allocate(nid_t nid, uint32_t size)
+{
+	{
+	MutexLockGuard lock(metadataLock_);
+	if(nid < metadata_.size() && metadata_[nid].capacity >= size)
+		return Postion(curDataId_, metadata_[nid].offset, size, metadata_[nid].capacity);
+	}
+
+	uint64_t capacity = size + size / 4;
+	capacity = (capacity + EXTENT_ALIGN - 1) / EXTENT_ALIGN * EXTENT_ALIGN;
+	Postion pos(curDataId_, dataEnd_, size, static_cast<uint32_t>(capacity));
+	dataEnd_ += capacity;
+	return pos;
+}
+
 // FIXME sort the nodes??
 int Layout::write(std::map<nid_t, Node*>& dirtyNodes)
 {
+	MutexLockGuard writeLock(writeLock_);
 
 	Node* node;
 	nid_t nid;
-	size_t offset;
+	Postion pos;
     size_t size = 0;
 	writeBuf_.retrieveAll();
 
@@ -193,41 +269,49 @@ int Layout::write(std::map<nid_t, Node*>& dirtyNodes)
 		node = it0->second;
 		nid = it0->first;
 		node->readLock();
+		if(node->dead()) {
+			node->readUnlock();
+			continue;
+		}
 		node->serialize(writeBuf_);
 		node->readUnlock();
 
-		offset = nid * (256 * 1024);
 		size = writeBuf_.readableBytes();
-		LOGFMTI("Layout::write offset, size: (%lu, %lu)", offset, size);
-		writeFile(curPath_, offset, size, writeBuf_);
+		pos = allocate(nid, size);
+		metrics_->add(Metrics::kNodeBytesSerialized, size);
+		LOGFMTT("Layout::write offset, size: (%lu, %lu)", pos.offset, size);
+		writeFile(curPath_, pos.offset, size, writeBuf_);
 
 		//update the metadata
-		if(nid > metadata_.size()) {
-			metadata_.push_back(Postion(curDataId_, offset, size));
-		} else 
-			metadata_[nid] = Postion(curDataId_, offset, size);
+		MutexLockGuard lock(metadataLock_);
+		if(nid >= metadata_.size())
+			metadata_.resize(nid + 1);
+		metadata_[nid] = pos;
 	}
 
 	return 0;
 }
 
-bool Layout::readFile(std::string& path, uint32_t offset, uint32_t size, Buffer& data)
+bool Layout::readFile(std::string& path, uint64_t offset, uint32_t size, Buffer& data)
 {
-    if(path != curPath_) {
-        close(curFd_);
-		curFd_ = open(path.data(), O_RDWR | O_LARGEFILE | O_CREAT);
-        if(curFd_ < 0) {
-			LOGFMTA("Layout::readFile open curfd error [%d]", curFd_);
-			return false;
-		}
-        curPath_ = path;
-    }
+    int fd = fdFor(path);
+    if(fd < 0) {
+		LOGFMTA("Layout::readFile no open file [%s]", path.c_str());
+		return false;
+	}
 
-    int ret = pread(curFd_, data.beginWrite(), size, offset);
+    // evicted nodes are read back, they can outgrow the initial buffer.
+    data.ensureWritableBytes(size);
+    int ret;
+    {
+    MetricsTimer timer(metrics_, Metrics::kReadMicros);
+    ret = pread(fd, data.beginWrite(), size, offset);
+    }
 	if(ret != (int)size) {
 		LOGFMTA("Layout::readFile error [%d]", ret);
 		return false;
 	}
+	metrics_->add(Metrics::kBytesRead, size);
 
 	data.updateWriterIndex(size);
 
@@ -235,40 +319,60 @@ bool Layout::readFile(std::string& path, uint32_t offset, uint32_t size, Buffer&
 }
 
 
-bool Layout::writeFile(std::string& path, uint32_t offset, uint32_t size, Buffer& data)
+bool Layout::writeFile(std::string& path, uint64_t offset, uint32_t size, Buffer& data)
 {
-    if(path != curPath_) {
-        close(curFd_);
-		curFd_ = open(path.data(), O_RDWR | O_LARGEFILE | O_CREAT);
-        if(curFd_ < 0) {
-			LOGFMTA("Layout::readFile open curfd error [%d]", curFd_);
-			return false;
-		}
-        curPath_ = path;
-    }
+    int fd = fdFor(path);
+    if(fd < 0) {
+		LOGFMTA("Layout::writeFile no open file [%s]", path.c_str());
+		return false;
+	}
 
-    int ret = pwrite(curFd_, data.beginRead(), size, offset);
+    int ret;
+    {
+    MetricsTimer timer(metrics_, Metrics::kWriteMicros);
+    ret = pwrite(fd, data.beginRead(), size, offset);
+    }
 	if(ret != (int)size) {
 		LOGFMTA("Layout::readFile error [%d]", ret);
 		return false;
 	}
+	metrics_->add(Metrics::kBytesWritten, size);
 
 	data.updateReadIndex(size);
 	
 	return true;
 }
 
-nid_t Layout::getRootNid()
+nid_t Layout::getRootNid(size_t shard)
 {
-	return rootNodeId_;
+	MutexLockGuard lock(metadataLock_);
+	return shard < rootNodeIds_.size() ? rootNodeIds_[shard] : NID_NIL;
 }
 
 nid_t Layout::getNodeCount()
 {
+	MutexLockGuard lock(metadataLock_);
 	return maxNodeId_;
 }
 
-void Layout::setRootNid(nid_t rootId)
+void Layout::setRootNid(size_t shard, nid_t rootId)
+{
+	MutexLockGuard lock(metadataLock_);
+	if(shard >= rootNodeIds_.size())
+		rootNodeIds_.resize(shard + 1, NID_NIL);
+	rootNodeIds_[shard] = rootId;
+}
+
+// the extent is not reused, like the ones a node outgrows.
+void Layout::drop(nid_t nid)
+{
+	MutexLockGuard lock(metadataLock_);
+	if(nid < metadata_.size())
+		metadata_[nid] = Postion();
+}
+
+nid_t Layout::newNid()
 {
-	rootNodeId_ = rootId;
+	MutexLockGuard lock(metadataLock_);
+	return ++maxNodeId_;
 }
@@ -3,12 +3,14 @@
 #include <stdint.h>
 #include <map>
 #include <deque>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 #include <boost/function.hpp>
 
 #include "Buffer.h"
 #include "Options.h"
+#include "Mutex.h"
 
 
 namespace bt
@@ -17,29 +19,36 @@ namespace bt
 #define DATA_PATH "/buffertree/data/data_"
 #define META_PATH "/buffertree/data/meta_"
 
+// a node image lives in an extent of capacity bytes at offset, it is
+// rewritten in place while it fits and moved to the end of the file
+// once it outgrows it.
 struct Postion
 {
 	char dataId;
-	uint32_t offset;
+	uint64_t offset;
 	uint32_t size;
+	uint32_t capacity;
 	Postion()
-		: dataId(0), offset(0), size(0)
+		: dataId(0), offset(0), size(0), capacity(0)
 		{}
-	Postion(char dataId_, uint32_t offset_, uint32_t size_)
-		: dataId(dataId_), offset(offset_), size(size_)
+	Postion(char dataId_, uint64_t offset_, uint32_t size_, uint32_t capacity_)
+		: dataId(dataId_), offset(offset_), size(size_), capacity(capacity_)
 		{}
 };
 
 class Node;
 class BufferTree;
+class Metrics;
 
-#define POSTION_SIZE sizeof(Postion)
+// serialized: dataId, offset, size, capacity.
+#define POSTION_SIZE (1 + 8 + 4 + 4)
+#define EXTENT_ALIGN 4096
 #define HEADER 512
 
 class Layout : boost::noncopyable
 {
 public:
-    Layout(std::string& name);
+    Layout(std::string& name, Metrics* metrics);
     ~Layout();
 
 	bool findDataFile();
@@ -47,25 +56,42 @@ public:
 	bool loadMetadata(size_t len);
 	bool flushMetadata();
 	bool find(nid_t nid, Buffer& buf);
+	// start reading the extents of nids, in file order.
+	void prefetch(const std::vector<nid_t>& nids);
 	int write(std::map<nid_t, Node*>& dirtyNodes);
-	bool readFile(std::string& path, uint32_t offset, uint32_t size, Buffer& data);
-	bool writeFile(std::string& path, uint32_t offset, uint32_t size, Buffer& data);
-	nid_t getRootNid();
+	bool readFile(std::string& path, uint64_t offset, uint32_t size, Buffer& data);
+	bool writeFile(std::string& path, uint64_t offset, uint32_t size, Buffer& data);
+	// the fd init() opened for path, -1 if none.
+	int fdFor(const std::string& path);
+	Postion allocate(nid_t nid, uint32_t size);
+	// every shard has its own root, nids are shared by all of them.
+	nid_t getRootNid(size_t shard);
 	nid_t getNodeCount();
-	void setRootNid(nid_t rootId);
+	void setRootNid(size_t shard, nid_t rootId);
+	// forgets a node merged away, find() fails for it from now on.
+	void drop(nid_t nid);
+	nid_t newNid();
 
 private:
 	std::string name_;
 	size_t curDataId_;
-	nid_t rootNodeId_;
-	nid_t maxNodeId_;
+	std::vector<nid_t> rootNodeIds_; // GUARDED BY metadataLock_
+	nid_t maxNodeId_; // GUARDED BY metadataLock_
+	// fixed once init() returns.
 	int curFd_;
 	int curMetaFd_;
 	std::string curPath_;
 	std::string metaPath_;
-	std::vector<Postion> metadata_;
-	Buffer writeBuf_;
+	// find() runs on cache misses while the write back thread
+	// grows metadata_.
+	MutexLock metadataLock_;
+	std::vector<Postion> metadata_; // GUARDED BY metadataLock_
+	// the write back thread and bulk loads both write.
+	MutexLock writeLock_;
+	uint64_t dataEnd_; // GUARDED BY writeLock_
+	Buffer writeBuf_; // GUARDED BY writeLock_
 	BufferTree* tree_;
+	Metrics* metrics_;
 };
 }
 
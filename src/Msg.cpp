@@ -1,14 +1,72 @@
+#include <time.h>
+#include <algorithm>
+
 #include "Msg.h"
 #include "Slab.h"
 #include "Mutex.h"
+#include "MergeOperator.h"
+#include "Epoch.h"
+#include "SnapshotList.h"
 
 using namespace bt;
 
-MsgBuf::MsgBuf(Slab* slab)
+namespace {
+
+bool pinned(const SnapshotList* snapshots, uint64_t older, uint64_t newer)
+{
+    return snapshots && snapshots->pinned(older, newer);
+}
+
+// a tombstone's begin or end, compared without a copy.
+Slice bound(const std::string& s)
+{
+    return Slice(const_cast<char*>(s.data()), s.size());
+}
+
+// seq of the newest of ranges over key, 0 if none.
+uint64_t covering(const MsgBuf::Ranges& ranges, const Slice& key)
+{
+    uint64_t seq = 0;
+    for(size_t i = 0; i < ranges.size(); ++i) {
+        const RangeTombstone& r = ranges[i];
+        if(key.compare(bound(r.begin)) >= 0 && key.compare(bound(r.end)) < 0)
+            seq = std::max(seq, r.seq);
+    }
+    return seq;
+}
+
+bool beginOrder(const RangeTombstone& a, const RangeTombstone& b)
+{
+    return a.begin < b.begin;
+}
+
+// what a run entry takes in the block.
+size_t entrySize(const SortedRun* run, size_t i)
+{
+    return 8 + run->key(i).size() + run->value(i).size() + (run->expiry(i) ? 8 : 0);
+}
+
+}
+
+uint64_t bt::nowSeconds()
+{
+    return time(NULL);
+}
+
+MsgBuf::MsgBuf(Slab* slab, size_t filterBits, size_t filterBitsPerKey)
     : slab_(slab),
       list_(Compare(), slab),
       mutex_(),
-      size_(0)
+      version_(0),
+      size_(0),
+      filter_(filterBits, filterBitsPerKey),
+      epoch_(slab->epoch()),
+      ranges_(NULL),
+      run_(NULL),
+      runCount_(0),
+      runBytes_(0),
+      kept_(0),
+      appends_(0)
 {
 }
 
@@ -24,21 +82,49 @@ MsgBuf::~MsgBuf()
     }
 
     list_.clear();
+    delete ranges_.load(std::memory_order_relaxed);
+    delete run_.load(std::memory_order_relaxed);
 }
 
+void MsgBuf::destroy(void* arg, void* ptr)
+{
+    delete static_cast<MsgBuf*>(ptr);
+}
+
+void MsgBuf::destroyRanges(void* arg, void* ptr)
+{
+    delete static_cast<RangeSet*>(ptr);
+}
+
+// a key overwritten in the delta counts twice until the next compaction.
 size_t MsgBuf::count()
 {
-    return list_.count();
+    return list_.count() + runCount_;
+}
+
+size_t MsgBuf::deletes()
+{
+    size_t dels = 0;
+    Iterator iter(&list_);
+    for(iter.seekToFirst(); iter.valid(); iter.next()) {
+        if(iter.key().type() == Del)
+            dels++;
+    }
+    return dels;
 }
 
 size_t MsgBuf::size()
 {
-    return 4 + size_;
+    const RangeSet* set = ranges_.load(std::memory_order_acquire);
+    return 4 + size_.load(std::memory_order_relaxed) + 4 + (set ? set->bytes : 0)
+        + 4 + runBytes_.load(std::memory_order_relaxed);
 }
 
 size_t MsgBuf::memUsage()
 {
-    return list_.memUsage() + sizeof(MsgBuf);
+    const RangeSet* set = ranges_.load(std::memory_order_acquire);
+    return list_.memUsage() + sizeof(MsgBuf) + filter_.encodedSize()
+        + (set ? set->bytes : 0) + runBytes_.load(std::memory_order_relaxed);
 }
 
 void MsgBuf::clear()
@@ -46,96 +132,729 @@ void MsgBuf::clear()
     assert(mutex_.isLockedByThisThread());
 
     list_.clear();
-    size_ = 0;
+    filter_.clear();
+    size_.store(0, std::memory_order_relaxed);
+    kept_ = 0;
+    publish(NULL);
+
+    if(hasRanges()) {
+        Ranges none;
+        setRanges(none);
+    }
+}
+
+const MsgBuf::Ranges& MsgBuf::ranges() const
+{
+    static const Ranges none;
+    const RangeSet* set = ranges_.load(std::memory_order_relaxed);
+    return set ? set->ranges : none;
+}
+
+void MsgBuf::setRanges(Ranges& ranges)
+{
+    RangeSet* set = NULL;
+    if(!ranges.empty()) {
+        set = new RangeSet();
+        set->ranges.swap(ranges);
+        std::string end;
+        for(size_t i = 0; i < set->ranges.size(); ++i) {
+            const RangeTombstone& r = set->ranges[i];
+            set->bytes += 16 + r.begin.size() + r.end.size();
+            if(i > 0 && r.begin < end)
+                set->overlapping = true;
+            if(i == 0 || end < r.end)
+                end = r.end;
+        }
+    }
+
+    RangeSet* old = ranges_.exchange(set, std::memory_order_acq_rel);
+    if(old)
+        epoch_->retire(destroyRanges, NULL, old);
+}
+
+void MsgBuf::insertRange(const Slice& begin, const Slice& end, uint64_t seq,
+        bool bottom, const SnapshotList* snapshots)
+{
+    assert(mutex_.isLockedByThisThread());
+
+    Msg fake(Nop, begin, Slice(), kMaxSequence);
+    Iterator iter(&list_);
+    iter.seek(fake);
+
+    std::vector<Msg> dead;
+    while(iter.valid() && iter.key().key().compare(end) < 0) {
+        Msg msg = iter.key();
+        if(msg.seq() < seq && !pinned(snapshots, msg.seq(), seq))
+            dead.push_back(msg);
+        iter.next();
+    }
+    for(size_t i = 0; i < dead.size(); ++i) {
+        list_.erase(dead[i]);
+        subSize(dead[i].size() + 8);
+        dead[i].release();
+    }
+
+    // the run is older than any snapshot, none reads it if none is
+    // older than the tombstone either.
+    if(bottom && !pinned(snapshots, 0, seq)) {
+        SortedRun* run = run_.load(std::memory_order_relaxed);
+        size_t first = run ? run->lowerBound(begin) : 0;
+        size_t last = run ? run->lowerBound(end) : 0;
+        if(first == last)
+            return;
+
+        SortedRun* next = new SortedRun();
+        for(size_t i = 0; i < run->count(); ++i) {
+            if(i < first || i >= last)
+                next->append(run->key(i), run->value(i), run->expiry(i));
+        }
+        publish(next);
+        return;
+    }
+
+    // drop the tombstones it covers, unless a snapshot reads between
+    // the two. one sticking out is kept, the newer seq would hide the
+    // messages written after it there, pushed down after this one.
+    std::string b = begin.toString(), e = end.toString();
+    const Ranges& current = ranges();
+    Ranges merged;
+    merged.reserve(current.size() + 1);
+    for(size_t i = 0; i < current.size(); ++i) {
+        const RangeTombstone& r = current[i];
+        if(r.begin < b || e < r.end || r.seq > seq || pinned(snapshots, r.seq, seq))
+            merged.push_back(r);
+    }
+    merged.push_back(RangeTombstone(b, e, seq));
+    std::stable_sort(merged.begin(), merged.end(), beginOrder);
+    setRanges(merged);
+}
+
+uint64_t MsgBuf::rangeCovering(const Slice& key, uint64_t snapshot)
+{
+    const RangeSet* set = ranges_.load(std::memory_order_acquire);
+    if(!set)
+        return 0;
+
+    // the ranges starting at or before key, only the last one of them
+    // can hold it while they are disjoint.
+    const Ranges& ranges = set->ranges;
+    size_t lo = 0, hi = ranges.size();
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(key.compare(bound(ranges[mid].begin)) >= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    uint64_t seq = 0;
+    for(size_t i = lo; i-- > 0; ) {
+        const RangeTombstone& r = ranges[i];
+        if(key.compare(bound(r.end)) < 0 && r.seq <= snapshot)
+            seq = std::max(seq, r.seq);
+        if(!set->overlapping)
+            break;
+    }
+    return seq;
+}
+
+uint64_t MsgBuf::rangeAfter(const Slice& key, uint64_t seq)
+{
+    const RangeSet* set = ranges_.load(std::memory_order_acquire);
+    if(!set)
+        return 0;
+
+    const Ranges& ranges = set->ranges;
+    uint64_t after = 0;
+    for(size_t i = 0; i < ranges.size() && key.compare(bound(ranges[i].begin)) >= 0; ++i) {
+        const RangeTombstone& r = ranges[i];
+        if(key.compare(bound(r.end)) < 0 && r.seq > seq && (after == 0 || r.seq < after))
+            after = r.seq;
+    }
+    return after;
 }
 
-void MsgBuf::insert(const Msg& msg)
+uint64_t MsgBuf::latest(const Slice& key)
 {
     assert(mutex_.isLockedByThisThread());
 
+    uint64_t seq = rangeCovering(key);
+    Msg fake(Nop, key, Slice(), kMaxSequence);
+    Iterator iter(&list_);
+    iter.seek(fake);
+    if(iter.valid() && iter.key().key() == key)
+        seq = std::max(seq, iter.key().seq());
+    return seq;
+}
+
+void MsgBuf::insert(const Msg& msg, const MergeOperator* merger, bool bottom,
+        const SnapshotList* snapshots)
+{
+    assert(mutex_.isLockedByThisThread());
+
+    // lands on the newest version of the key, all older than msg.
     Iterator iter(&list_);
     Msg got;
-    bool release = false;
+    bool has = false;
+    bool older = false;
     iter.seek(msg);
-    if(iter.valid()) {
+    if(iter.valid() && iter.key().key() == msg.key()) {
         got = iter.key();
+        has = true;
+        assert(got.seq() < msg.seq());
+
+        Iterator next = iter;
+        next.next();
+        older = next.valid() && next.key().key() == msg.key();
+    }
 
-        if(got.key() == msg.key()) {
-            size_ -= got.size();
-            release = true;
+    // without a message of the key the run holds the older value, a
+    // Put does not need it.
+    SortedRun* run = run_.load(std::memory_order_relaxed);
+    bool append = !iter.valid()
+        && (!run || run->key(run->count() - 1).compare(msg.key()) < 0);
+    appends_.store(append ? appends_.load(std::memory_order_relaxed) + 1 : 0,
+            std::memory_order_relaxed);
+
+    // got is replaced unless a snapshot reads it. a tombstone kept for
+    // a snapshot may have deleted it already, or the run's value. one
+    // newer than msg came down first and is not msg's business.
+    bool keep = has && pinned(snapshots, got.seq(), msg.seq());
+    uint64_t deleted = rangeCovering(msg.key(), msg.seq());
+    bool live = has && got.seq() >= deleted;
+
+    Slice based;
+    uint64_t expiry = 0;
+    bool inRun = bottom && run && deleted == 0
+        && msg.type() != Put && run->find(msg.key(), &based, &expiry);
+    Msg prev = live ? got : Msg(Put, msg.key(), based, 0, expiry);
+    bool exists = live || inRun;
+    // an operand on an expired value starts over, like on a Del.
+    if(msg.type() == Merge && exists && prev.expired(nowSeconds()))
+        prev = Msg(Del, prev.key(), Slice(), prev.seq());
+    // an operand on a kept one stays apart, folded it would carry the
+    // kept operand down a second time.
+    bool stacked = keep && live && !bottom && got.type() == Merge;
+
+    Msg put = msg;
+    if(msg.type() == Merge && merger && (exists || bottom) && !stacked) {
+        // an older operand combines into a newer one, a value or the
+        // bottom of the tree resolves it.
+        Slice existing = prev.value();
+        bool older = exists && prev.type() != Del;
+        bool operand = older && prev.type() == Merge;
+
+        std::string result;
+        bool ok = merger->merge(msg.key(), older ? &existing : NULL, msg.value(), &result);
+        MsgType type = Put;
+        if(ok && operand) {
+            if(bottom) {
+                std::string resolved;
+                ok = merger->merge(msg.key(), NULL, Slice(result), &resolved);
+                result.swap(resolved);
+            } else {
+                type = Merge;
+            }
         }
+        if(!ok) {
+            // dropped, whatever was there stays.
+            msg.value().release();
+            msg.key().release();
+            return;
+        }
+        // the value keeps the expiry of the one it was merged into.
+        put = Msg(type, msg.key(), Slice(result).clone(slab_), msg.seq(),
+                type == Put && older ? prev.expiry() : 0);
+        msg.value().release();
     }
-    list_.insert(msg);
-    size_ += msg.size() + 8; //add string length for deserialize
-    if(release)
+
+    // versions older than got show once it is gone.
+    bool hides = inRun || keep || older;
+    if(put.type() == Del && bottom && !hides) {
+        // nothing below for the tombstone to hide.
+        if(has && !keep) {
+            list_.erase(got);
+            subSize(got.size() + 8);
+            got.release();
+        }
+        put.key().release();
+        return;
+    }
+
+    // set before the message is visible, a reader that finds it
+    // also passes the filter.
+    if(!has)
+        filter_.add(put.key());
+    // in before got goes, a lock free reader finds one of them.
+    list_.insert(put);
+    addSize(put.size() + 8); //add string length for deserialize
+    if(has && !keep) {
+        list_.erase(got);
+        subSize(got.size() + 8);
         got.release();
+    }
+}
+
+bool MsgBuf::needCompaction(bool writeBack) const
+{
+    size_t delta = list_.count() - std::min(kept_, list_.count());
+    if(writeBack)
+        return delta * 4 >= runCount_ && delta > 0;
+    return delta >= kMinCompaction && delta * 2 >= runCount_;
 }
 
-void MsgBuf::resize(size_t size)
+// versions up to the oldest snapshot look the same to every reader,
+// the newest of them per key is folded and the older ones dropped.
+// the newer ones stay in the delta as long as a snapshot reads them,
+// and tombstones newer than the oldest snapshot stay too.
+bool MsgBuf::compact(size_t* dropped, const SnapshotList* snapshots, size_t* expired)
 {
     assert(mutex_.isLockedByThisThread());
 
-    list_.resize(size);
+    if(list_.count() == 0 && !hasRanges())
+        return false;
+
+    uint64_t bound = snapshots ? snapshots->oldest() : kMaxSequence;
+    const Ranges& current = ranges();
+    Ranges folded, ranges;
+    for(size_t r = 0; r < current.size(); ++r)
+        (current[r].seq <= bound ? folded : ranges).push_back(current[r]);
+    if(list_.count() == 0 && folded.empty())
+        return false;
+
+    SortedRun* run = run_.load(std::memory_order_relaxed);
+    SortedRun* next = new SortedRun();
+    size_t i = 0, n = run ? run->count() : 0;
+    std::vector<Msg> kept;
+    uint64_t now = nowSeconds();
+    size_t droppedBytes = 0, expiredBytes = 0;
+    for(size_t r = 0; r < folded.size(); ++r)
+        droppedBytes += folded[r].begin.size() + folded[r].end.size() + 8;
 
-    size_ = 0;
     Iterator iter(&list_);
     iter.seekToFirst();
+    while(iter.valid() || i < n) {
+        int cmp = !iter.valid() ? 1 : (i == n ? -1 : iter.key().key().compare(run->key(i)));
+        if(cmp > 0) {
+            uint64_t expiry = run->expiry(i);
+            if(expiry && expiry <= now)
+                expiredBytes += entrySize(run, i);
+            else if(covering(folded, run->key(i)) == 0)
+                next->append(run->key(i), run->value(i), expiry);
+            else
+                droppedBytes += entrySize(run, i);
+            ++i;
+            continue;
+        }
+
+        // the versions of one key, newest first.
+        Slice key = iter.key().key();
+        Msg base;
+        bool based = false;
+        uint64_t newer = 0;
+        for(; iter.valid() && iter.key().key() == key; iter.next()) {
+            Msg msg = iter.key();
+            if(msg.seq() > bound) {
+                if(newer == 0 || pinned(snapshots, msg.seq(), newer))
+                    kept.push_back(msg);
+                else
+                    droppedBytes += msg.size();
+            } else if(!based) {
+                base = msg;
+                based = true;
+            } else {
+                droppedBytes += msg.size();
+            }
+            newer = msg.seq();
+        }
+
+        // merges were resolved on their way into the leaf.
+        assert(!based || base.type() != Merge);
+        uint64_t deleted = covering(folded, key);
+        if(based && base.seq() >= deleted) {
+            if(base.type() == Put && base.expired(now))
+                expiredBytes += base.size();
+            else if(base.type() == Put)
+                next->append(key, base.value(), base.expiry());
+            else
+                droppedBytes += base.size();
+        } else if(!based && cmp == 0 && deleted == 0) {
+            uint64_t expiry = run->expiry(i);
+            if(expiry && expiry <= now)
+                expiredBytes += entrySize(run, i);
+            else
+                next->append(run->key(i), run->value(i), expiry);
+        } else if(based) {
+            droppedBytes += base.size();
+        }
+        // a run entry is gone unless it was copied over above.
+        if(cmp == 0 && (based || deleted))
+            droppedBytes += entrySize(run, i);
+        if(cmp == 0)
+            ++i;
+    }
+
+    // the new run is visible before the delta goes, a lock free reader
+    // missing the key in one finds it in the other.
+    publish(next);
 
+    std::vector<Msg> gone;
+    size_t k = 0;
+    iter.seekToFirst();
     while(iter.valid()) {
-        size_ += iter.key().size() + 8; //add string length for deserialize
+        Msg msg = iter.key();
+        if(k < kept.size() && msg.seq() == kept[k].seq() && msg.key() == kept[k].key())
+            ++k;
+        else
+            gone.push_back(msg);
         iter.next();
     }
+    if(kept.empty()) {
+        list_.clear();
+        size_.store(0, std::memory_order_relaxed);
+    } else {
+        for(size_t g = 0; g < gone.size(); ++g) {
+            list_.erase(gone[g]);
+            subSize(gone[g].size() + 8);
+        }
+    }
+    for(size_t g = 0; g < gone.size(); ++g)
+        gone[g].release();
+    kept_ = kept.size();
+
+    if(!folded.empty())
+        setRanges(ranges);
+
+    *dropped = droppedBytes + expiredBytes;
+    if(expired)
+        *expired = expiredBytes;
+    return true;
+}
+
+bool MsgBuf::splittable()
+{
+    SortedRun* run = run_.load(std::memory_order_acquire);
+    if(run && run->count() >= 2)
+        return true;
+
+    Iterator iter(&list_);
+    iter.seekToFirst();
+    if(!iter.valid())
+        return false;
+    Slice first = iter.key().key();
+    if(run && run->count() == 1 && !(run->key(0) == first))
+        return true;
+    iter.seekToLast();
+    return iter.valid() && !(iter.key().key() == first);
 }
 
-bool MsgBuf::find(Slice key, Msg& msg)
+Slice MsgBuf::split(MsgBuf* right, size_t limit)
 {
     assert(mutex_.isLockedByThisThread());
 
-	Slice value = Slice();
-    Msg fake(Nop, key, value);
+    // the keys of the run and of the versions left in the delta, in
+    // order, with the bytes each takes.
+    SortedRun* run = run_.load(std::memory_order_relaxed);
+    std::vector<Slice> keys;
+    std::vector<size_t> bytes;
+    size_t i = 0, n = run ? run->count() : 0;
     Iterator iter(&list_);
+    iter.seekToFirst();
+    while(iter.valid() || i < n) {
+        int cmp = !iter.valid() ? 1 : (i == n ? -1 : iter.key().key().compare(run->key(i)));
+        Slice key = cmp > 0 ? run->key(i) : iter.key().key();
+        size_t b = 0;
+        if(cmp >= 0) {
+            b += entrySize(run, i);
+            ++i;
+        }
+        for(; cmp <= 0 && iter.valid() && iter.key().key() == key; iter.next())
+            b += iter.key().size() + 8;
+        keys.push_back(key);
+        bytes.push_back(b);
+    }
+    assert(keys.size() >= 2);
+
+    size_t middle = keys.size() / 2;
+    if(limit) {
+        size_t total = size() - runBytes_.load(std::memory_order_relaxed) - size_.load(std::memory_order_relaxed);
+        for(middle = 0; middle < keys.size() - 1; ++middle) {
+            total += bytes[middle];
+            if(middle > 0 && total > limit)
+                break;
+        }
+    }
+    Slice split = keys[middle];
+
+    size_t cut = run ? run->lowerBound(split) : 0;
+    SortedRun* lower = new SortedRun();
+    SortedRun* upper = new SortedRun();
+    for(size_t r = 0; r < n; ++r) {
+        if(r < cut) {
+            lower->append(run->key(r), run->value(r), run->expiry(r));
+        } else {
+            upper->append(run->key(r), run->value(r), run->expiry(r));
+            right->filter_.add(run->key(r));
+        }
+    }
+    right->publish(upper);
+
+    // versions kept for snapshots and tombstones follow their keys.
+    std::vector<Msg> moved;
+    Msg fake(Nop, split, Slice(), kMaxSequence);
+    for(iter.seek(fake); iter.valid(); iter.next())
+        moved.push_back(iter.key());
+    for(size_t m = 0; m < moved.size(); ++m) {
+        right->list_.insert(moved[m]);
+        right->addSize(moved[m].size() + 8);
+        right->filter_.add(moved[m].key());
+    }
+    right->kept_ = moved.size();
+
+    if(hasRanges()) {
+        std::string s = split.toString();
+        const Ranges& current = ranges();
+        Ranges lowerRanges, upperRanges;
+        for(size_t r = 0; r < current.size(); ++r) {
+            const RangeTombstone& range = current[r];
+            if(range.begin < s)
+                lowerRanges.push_back(RangeTombstone(range.begin, std::min(range.end, s), range.seq));
+            if(s < range.end)
+                upperRanges.push_back(RangeTombstone(std::max(range.begin, s), range.end, range.seq));
+        }
+        std::stable_sort(upperRanges.begin(), upperRanges.end(), beginOrder);
+        right->setRanges(upperRanges);
+        setRanges(lowerRanges);
+    }
 
-    iter.seek(fake);
+    // the keys making the streak moved right, the next ones follow them.
+    right->appends_.store(appends_.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+
+    // drop the keys moved out. the old run is only retired, its keys
+    // stay readable here, the moved messages are readable on the right
+    // before they go.
+    filter_.clear();
+    for(size_t r = 0; r < cut; ++r)
+        filter_.add(run->key(r));
+    publish(lower);
+    for(size_t m = 0; m < moved.size(); ++m) {
+        list_.erase(moved[m]);
+        subSize(moved[m].size() + 8);
+    }
+    kept_ -= std::min(kept_, moved.size());
+    for(iter.seekToFirst(); iter.valid(); iter.next())
+        filter_.add(iter.key().key());
 
-    if(iter.valid() && iter.key().key() == key) {
-        msg = iter.key();
-        return true;
+    return right->firstKey();
+}
+
+Slice MsgBuf::firstKey()
+{
+    assert(mutex_.isLockedByThisThread());
+
+    Iterator iter(&list_);
+    iter.seekToFirst();
+    SortedRun* run = run_.load(std::memory_order_relaxed);
+    if(!run)
+        return iter.valid() ? iter.key().key() : Slice();
+    if(!iter.valid() || run->key(0).compare(iter.key().key()) < 0)
+        return run->key(0);
+    return iter.key().key();
+}
+
+void MsgBuf::absorb(MsgBuf* right, bool bottom, const SnapshotList* snapshots)
+{
+    assert(mutex_.isLockedByThisThread());
+    assert(right->mutex_.isLockedByThisThread());
+
+    if(bottom) {
+        size_t dropped;
+        compact(&dropped, snapshots);
+        right->compact(&dropped, snapshots);
+
+        SortedRun* upper = right->run_.load(std::memory_order_relaxed);
+        if(upper) {
+            SortedRun* run = run_.load(std::memory_order_relaxed);
+            SortedRun* next = new SortedRun();
+            for(size_t i = 0; run && i < run->count(); ++i)
+                next->append(run->key(i), run->value(i), run->expiry(i));
+            for(size_t i = 0; i < upper->count(); ++i) {
+                next->append(upper->key(i), upper->value(i), upper->expiry(i));
+                filter_.add(upper->key(i));
+            }
+            publish(next);
+            right->publish(NULL);
+        }
+    }
+
+    // what compaction left for snapshots moves like a buffer's messages.
+    takeMessages(right);
+}
+
+void MsgBuf::takeMessages(MsgBuf* right)
+{
+    // right's keys all sort after ours, so do its tombstones.
+    if(right->hasRanges()) {
+        Ranges ranges(this->ranges());
+        ranges.insert(ranges.end(), right->ranges().begin(), right->ranges().end());
+        setRanges(ranges);
+        Ranges none;
+        right->setRanges(none);
+    }
+
+    // the messages move, right must not release them.
+    Iterator iter(&right->list_);
+    iter.seekToFirst();
+    while(iter.valid()) {
+        Msg msg = iter.key();
+        filter_.add(msg.key());
+        list_.insert(msg);
+        addSize(msg.size() + 8);
+        iter.next();
+    }
+    kept_ += right->kept_;
+    right->list_.clear();
+    right->size_.store(0, std::memory_order_relaxed);
+    right->kept_ = 0;
+    right->filter_.clear();
+}
+
+void MsgBuf::load(SortedRun* run)
+{
+    assert(count() == 0);
+
+    for(size_t i = 0; i < run->count(); ++i)
+        filter_.add(run->key(i));
+    publish(run);
+}
+
+void MsgBuf::publish(SortedRun* run)
+{
+    if(run && run->count() == 0) {
+        delete run;
+        run = NULL;
     }
 
+    SortedRun* old = run_.exchange(run, std::memory_order_acq_rel);
+    runCount_ = run ? run->count() : 0;
+    runBytes_.store(run ? run->size() : 0, std::memory_order_relaxed);
+    if(old)
+        epoch_->retire(SortedRun::destroy, NULL, old);
+}
+
+bool MsgBuf::find(Slice key, Msg& msg, std::vector<Slice>& operands,
+        uint64_t snapshot, uint64_t deleted)
+{
+    assert(mutex_.isLockedByThisThread());
+    return peek(key, msg, operands, snapshot, deleted);
+}
+
+// the run is older than every snapshot, only the delta has versions
+// a snapshot may not see.
+bool MsgBuf::peek(Slice key, Msg& msg, std::vector<Slice>& operands,
+        uint64_t snapshot, uint64_t deleted)
+{
+	Slice value = Slice();
+    Msg fake(Nop, key, value, snapshot);
+    Iterator iter(&list_);
+
+    for(iter.seek(fake); iter.valid() && iter.key().key() == key; iter.next()) {
+        Msg version = iter.key();
+        if(version.seq() < deleted)
+            return false;
+        if(version.type() != Merge) {
+            msg = version;
+            // hides the older versions like the Del it becomes.
+            if(version.expiry() && version.expired(nowSeconds()))
+                msg = Msg(Del, version.key(), Slice(), version.seq());
+            return true;
+        }
+        operands.push_back(version.value());
+    }
+    if(deleted)
+        return false;
+
+    SortedRun* run = run_.load(std::memory_order_acquire);
+    if(run) {
+        size_t i = run->lowerBound(key);
+        if(i < run->count() && run->key(i) == key) {
+            msg = Msg(Put, run->key(i), run->value(i), 0, run->expiry(i));
+            if(msg.expiry() && msg.expired(nowSeconds()))
+                msg = Msg(Del, run->key(i));
+            return true;
+        }
+    }
     return false;
 }
 
 bool MsgBuf::deserialize(Buffer& reader)
 {
     MutexLockGuard lock(mutex_);
+    bool filtered = filter_.decode(reader);
     uint32_t count = reader.readInt32();
 
-    if(count == 0)
-        return true;
-
     for(size_t i = 0; i < count; ++i) {
         uint32_t type;
         Slice value;
 		type = reader.readInt32();
+		uint64_t seq = reader.readInt64();
+		uint64_t expiry = 0;
+		if(type & kExpires) {
+			expiry = reader.readInt64();
+			type &= ~kExpires;
+		}
 		std::string keyStr(reader.readString());
-		Slice key(keyStr);
-        if(type == Put) {
+		Slice key = Slice(keyStr).clone(slab_);
+        if(type == Put || type == Merge) {
 			std::string valueStr(reader.readString());
-            value = Slice(valueStr);
+            value = Slice(valueStr).clone(slab_);
         }
 
-        Msg msg((MsgType)type, key, value);
+        Msg msg((MsgType)type, key, value, seq, expiry);
+        if(!filtered)
+            filter_.add(key);
         list_.insert(msg);
-        size_ += msg.size() + 8; // add string length
+        addSize(msg.size() + 8); // add string length
     }
 
+    deserializeRanges(reader);
+
+    // a compacted leaf is read back as one block.
+    uint32_t runSize = reader.readInt32();
+    if(runSize) {
+        SortedRun* run = SortedRun::decode(reader.peek(), runSize);
+        reader.retrieve(runSize);
+        for(size_t i = 0; !filtered && i < run->count(); ++i)
+            filter_.add(run->key(i));
+        publish(run);
+    }
     return true;
 }
 
+// REQUIRES: mutex_ is held.
+void MsgBuf::deserializeRanges(Buffer& reader)
+{
+    uint32_t count = reader.readInt32();
+    if(count == 0)
+        return;
+
+    Ranges ranges;
+    for(size_t i = 0; i < count; ++i) {
+        std::string begin(reader.readString());
+        std::string end(reader.readString());
+        uint64_t seq = reader.readInt64();
+        ranges.push_back(RangeTombstone(begin, end, seq));
+    }
+    setRanges(ranges);
+}
+
 bool MsgBuf::serialize(Buffer& writer)
 {
     MutexLockGuard lock(mutex_);
 
+	filter_.encode(writer);
+
 	int count = list_.count();
 	writer.appendInt32(list_.count());
 
@@ -146,12 +865,15 @@ bool MsgBuf::serialize(Buffer& writer)
         Msg msg = iter.key();
         uint8_t type = msg.type();
 		
-		writer.appendInt32(type);
+		writer.appendInt32(msg.expiry() ? type | kExpires : type);
+		writer.appendInt64(msg.seq());
+		if(msg.expiry())
+			writer.appendInt64(msg.expiry());
 		writer.appendInt32(msg.key().size());
 		writer.append(msg.key().data(), msg.key().size());
 
-        if(type == Put) {
-			writer.appendInt32(msg.key().size());
+        if(type == Put || type == Merge) {
+			writer.appendInt32(msg.value().size());
 			writer.append(msg.value().data(), msg.value().size());
         }
 
@@ -159,5 +881,20 @@ bool MsgBuf::serialize(Buffer& writer)
         iter.next();
     }
     assert(count == 0);
+
+    const Ranges& ranges = this->ranges();
+    writer.appendInt32(ranges.size());
+    for(size_t i = 0; i < ranges.size(); ++i) {
+        writer.appendInt32(ranges[i].begin.size());
+        writer.append(ranges[i].begin.data(), ranges[i].begin.size());
+        writer.appendInt32(ranges[i].end.size());
+        writer.append(ranges[i].end.data(), ranges[i].end.size());
+        writer.appendInt64(ranges[i].seq);
+    }
+
+    SortedRun* run = run_.load(std::memory_order_relaxed);
+    writer.appendInt32(runBytes_.load(std::memory_order_relaxed));
+    if(run)
+        writer.append(run->data(), run->size());
     return true;
 }
@@ -2,29 +2,53 @@
 #define __BT_MSG_H
 
 #include <vector>
+#include <string>
+#include <utility>
+#include <atomic>
 
 #include "Slice.h"
 #include "Skiplist.h"
 #include "Mutex.h"
 #include "Buffer.h"
+#include "Filter.h"
+#include "SortedRun.h"
 
 namespace bt {
 enum MsgType {
     Nop,
     Put,
     Del,
+    // an operand for Options::mergeOperator, applied on top of the
+    // older messages of the key.
+    Merge,
 };
 
+// newer than every message, seeks with it find the newest version.
+static const uint64_t kMaxSequence = ~0ULL;
+
+// expiry times are seconds since the epoch, 0 never expires.
+uint64_t nowSeconds();
+
 class Slab;
+class MergeOperator;
+class EpochManager;
+class SnapshotList;
 
+// seq orders the versions of a key, it is stamped when the write enters
+// the tree and kept as the message moves down. the compacted run of a
+// leaf counts as sequence 0, older than any message.
+// a Put may carry an expiry, from then on it reads as a Del.
 class Msg
 {
 public:
-    Msg() : type_(Nop) {}
-    Msg(MsgType type, Slice key, Slice value = Slice())
+    Msg() : type_(Nop), seq_(0), expiry_(0) {}
+    Msg(MsgType type, Slice key, Slice value = Slice(), uint64_t seq = 0,
+            uint64_t expiry = 0)
         : type_(type),
           key_(key),
-          value_(value)
+          value_(value),
+          seq_(seq),
+          expiry_(expiry)
     {}
 	~Msg()
 	{}
@@ -32,9 +56,12 @@ public:
     {
         size_t size = 0;
         size += 4;
+        size += 8;
         size += key_.size();
-        if(type_ == Put)
+        if(hasValue())
             size += value_.size();
+        if(expiry_)
+            size += 8;
         return size;
     }
 
@@ -48,50 +75,223 @@ public:
     Slice key() const { return key_; }
     Slice value() const { return value_; }
     MsgType type() const { return type_; }
+    bool hasValue() const { return type_ == Put || type_ == Merge; }
+    uint64_t seq() const { return seq_; }
+    void setSeq(uint64_t seq) { seq_ = seq; }
+    uint64_t expiry() const { return expiry_; }
+    bool expired(uint64_t now) const { return expiry_ != 0 && expiry_ <= now; }
 
 private:
     MsgType type_;
     Slice key_;
     Slice value_;
+    uint64_t seq_;
+    uint64_t expiry_;
 };
 
+// by key, the versions of a key newest first. a seek for (key, s) lands
+// on the newest version written at or before s.
 class Compare
 {
 public:
     int operator()(const Msg& a, const Msg& b) const
     {
-        return a.key().compare(b.key());
+        int cmp = a.key().compare(b.key());
+        if(cmp != 0)
+            return cmp;
+        if(a.seq() == b.seq())
+            return 0;
+        return a.seq() > b.seq() ? -1 : 1;
     }
 };
 
+// deletes [begin, end) as of seq.
+struct RangeTombstone
+{
+    RangeTombstone() : begin(), end(), seq(0) {}
+    RangeTombstone(const std::string& b, const std::string& e, uint64_t s)
+        : begin(b), end(e), seq(s)
+    {}
+
+    std::string begin;
+    std::string end;
+    uint64_t seq;
+};
+
+// the range tombstones of a buffer as lock free readers see them, never
+// changed once published.
+struct RangeSet
+{
+    RangeSet() : ranges(), overlapping(false), bytes(0) {}
+
+    // sorted by begin, disjoint unless overlapping because a snapshot
+    // kept an older tombstone apart from a newer one.
+    std::vector<RangeTombstone> ranges;
+    bool overlapping;
+    size_t bytes;
+};
+
+// Messages buffered in front of one child, or the data of one leaf
+// pivot. A leaf buffer keeps its compacted data in a SortedRun and the
+// messages newer than it in the skiplist, the delta.
+//
+// A key has one version per buffer unless a snapshot reads an older
+// one, snapshots passed as NULL means there are none. Reads at a
+// snapshot see the newest version written up to it.
 class MsgBuf
 {
 public:
     typedef SkipList<Msg, Compare> List;
     typedef List::Iterator Iterator;
+    typedef std::vector<RangeTombstone> Ranges;
 
-    MsgBuf(Slab* slab);
+    // filterBits == 0 builds no filter.
+    MsgBuf(Slab* slab, size_t filterBits = 0, size_t filterBitsPerKey = 0);
     ~MsgBuf();
+    // EpochManager::Deleter.
+    static void destroy(void* arg, void* ptr);
 
     size_t count();
+    // the Del messages of the delta, REQUIRES: locked.
+    size_t deletes();
     size_t size();
     size_t memUsage();
     void clear();
-    bool find(Slice key, Msg& msg);
-    void insert(const Msg& msg);
+    // walks the versions of key visible at snapshot, newest first, and
+    // stops at the ones a tombstone at deleted hides. a Merge sits on
+    // the next older version, its operand goes to operands. true if a
+    // Put or Del ends the walk, in msg. an expired Put comes as a Del.
+    bool find(Slice key, Msg& msg, std::vector<Slice>& operands,
+            uint64_t snapshot = kMaxSequence, uint64_t deleted = 0);
+    // lock free find, REQUIRES the caller is inside an epoch and
+    // validates the version read before.
+    bool peek(Slice key, Msg& msg, std::vector<Slice>& operands,
+            uint64_t snapshot = kMaxSequence, uint64_t deleted = 0);
+    // false if key is surely not buffered, lock free like peek().
+    bool mayContain(const Slice& key) const { return filter_.mayContain(key); }
+    // bytes serialize() writes besides size().
+    size_t filterSize() const { return filter_.encodedSize(); }
+    // a Merge is folded into an older message of its key, unless that
+    // is a Merge kept for a snapshot, and turned into a Put at the
+    // bottom of the tree where nothing older exists.
+    // at the bottom a Del is kept only while it hides an older version.
+    // REQUIRES: msg is newer than every buffered version of its key.
+    void insert(const Msg& msg, const MergeOperator* merger = NULL, bool bottom = false,
+            const SnapshotList* snapshots = NULL);
+    // deletes [begin, end) as of seq: drops the older messages in it
+    // and, unless at the bottom of the tree, keeps a range tombstone
+    // hiding the older levels. a leaf keeps it too while a snapshot
+    // older than it reads its run.
+    void insertRange(const Slice& begin, const Slice& end, uint64_t seq,
+            bool bottom = false, const SnapshotList* snapshots = NULL);
+    // seq of the newest range tombstone over key visible at snapshot,
+    // 0 if none. it hides the older messages of this buffer and all of
+    // the levels below. lock free like peek(), validate the version
+    // afterwards.
+    uint64_t rangeCovering(const Slice& key, uint64_t snapshot = kMaxSequence);
+    // seq of the oldest range tombstone over key newer than seq, 0 if
+    // none. the snapshots from then on do not read a version at seq.
+    uint64_t rangeAfter(const Slice& key, uint64_t seq);
+    // seq of the newest version of key or range tombstone over it, 0
+    // if there is none or the run has it. REQUIRES: locked.
+    uint64_t latest(const Slice& key);
+    bool hasRanges() const { return ranges_.load(std::memory_order_acquire) != NULL; }
+    // REQUIRES: locked.
+    const Ranges& ranges() const;
     bool deserialize(Buffer& reader);
     bool serialize(Buffer& writer);
 
-    void resize(size_t size);
-    void lock() { mutex_.lock(); }
-    void unlock() { mutex_.unlock(); }
+    // leaf buffers only, REQUIRES: locked.
+    // folds the delta into a new run, dropping deletes, expired values
+    // and the values they shadow. versions newer than a snapshot stay
+    // in the delta. false if there is nothing to fold, else *dropped is
+    // the size() given back, *expired the part expired values took.
+    bool compact(size_t* dropped, const SnapshotList* snapshots = NULL,
+            size_t* expired = NULL);
+    // a write back compacts smaller deltas than an insert.
+    bool needCompaction(bool writeBack = false) const;
+    // two keys at least, lock free.
+    bool splittable();
+    // keeps the lower half of the keys, or with limit as many as fit
+    // in limit bytes, moves the rest to the empty right and returns the
+    // first of them. both keep at least one key.
+    // REQUIRES: compacted, splittable().
+    Slice split(MsgBuf* right, size_t limit = 0);
+    Slice firstKey();
+    // takes over everything of right, whose keys all sort after ours,
+    // and leaves it empty. REQUIRES: both locked.
+    void absorb(MsgBuf* right, bool bottom, const SnapshotList* snapshots = NULL);
+    // bulk loading: run becomes the content of a new leaf buffer.
+    void load(SortedRun* run);
+    // the last inserts all sorted after every key buffered, as with
+    // timestamps or sequence ids.
+    bool appending() const { return appends_.load(std::memory_order_relaxed) >= kMinAppends; }
+    // version_ is odd while a writer holds the lock.
+    void lock() { mutex_.lock(); version_.fetch_add(1, std::memory_order_acq_rel); }
+    void unlock() { version_.fetch_add(1, std::memory_order_release); mutex_.unlock(); }
+
+    bool readVersion(uint64_t& version)
+    {
+        version = version_.load(std::memory_order_acquire);
+        return (version & 1) == 0;
+    }
+    bool validateVersion(uint64_t version)
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version_.load(std::memory_order_relaxed) == version;
+    }
 
     List* skiplist() { return &list_; }
 private:
+    // a delta this small is not worth a new run.
+    static const size_t kMinCompaction = 32;
+    // set in the type of a serialized message followed by its expiry.
+    static const uint32_t kExpires = 1U << 8;
+    // random keys rarely make this many new maximums in a row.
+    static const size_t kMinAppends = 16;
+
+    void deserializeRanges(Buffer& reader);
+    // REQUIRES: locked, the old run is retired.
+    void publish(SortedRun* run);
+    // REQUIRES: locked, ranges sorted by begin. the old set is retired.
+    void setRanges(Ranges& ranges);
+    static void destroyRanges(void* arg, void* ptr);
+    // moves the messages of right after ours, REQUIRES: both locked.
+    void takeMessages(MsgBuf* right);
+    // REQUIRES: locked.
+    void addSize(size_t bytes)
+    {
+        size_.store(size_.load(std::memory_order_relaxed) + bytes,
+                std::memory_order_relaxed);
+    }
+    void subSize(size_t bytes)
+    {
+        size_.store(size_.load(std::memory_order_relaxed) - bytes,
+                std::memory_order_relaxed);
+    }
+
 	Slab* slab_;
     List list_;	
     MutexLock mutex_;
-    size_t size_;
+    std::atomic<uint64_t> version_;
+    // changed under mutex_, read without it by the write back sweep.
+    std::atomic<size_t> size_;
+    BloomFilter filter_;
+    // the tombstones and the run are replaced as a whole under mutex_
+    // and retired through the epoch, lock free readers do not bump
+    // version_. ranges_ is NULL while there are none.
+    EpochManager* epoch_;
+    std::atomic<RangeSet*> ranges_;
+    // older than every message of the list.
+    std::atomic<SortedRun*> run_;
+    size_t runCount_;
+    std::atomic<size_t> runBytes_;
+    // versions the last compaction left in the delta for snapshots,
+    // they do not make the next one due.
+    size_t kept_;
+    // inserts in a row past the largest key, kept across clear() so a
+    // push down does not end the streak.
+    std::atomic<size_t> appends_;
 };
 }
 
@@ -1,21 +1,54 @@
+#include <algorithm>
+
 #include "Logger.h"
 #include "Node.h"
 #include "BufferTree.h"
 #include "Mutex.h"
+#include "Slab.h"
+#include "Cache.h"
+#include "Layout.h"
+#include "Metrics.h"
+#include "MergeOperator.h"
+#include "SnapshotList.h"
 
 using namespace bt;
 
+// share of a node or buffer an append split leaves on the left, the
+// left part no longer grows so it is kept nearly full.
+static const double kAppendSplitRatio = 0.9;
+
+static bool seqOrder(const RangeTombstone& a, const RangeTombstone& b)
+{
+    return a.seq < b.seq;
+}
+
 Node::Node(BufferTree* tree, nid_t self, Slab* slab)
     : tree_(tree),
-      self_(self),
-      refcnt_(0),
-      dirty_(false),
-      flushing_(false),
-      slab_(slab)
-{}
+      slab_(slab),
+      pivots_(),
+      rwlock_(),
+      version_(0),
+      state_(0),
+      bufferedSize_(0),
+      imageSize_(0),
+      self_(self)
+{
+}
 
 Node::~Node()
-{}
+{
+    for(size_t i = 0; i < pivots_.size(); ++i) {
+        delete pivots_[i].buf;
+        pivots_[i].leftKey.release();
+    }
+}
+
+void Node::destroy(void* slab, void* ptr)
+{
+    Node* node = static_cast<Node*>(ptr);
+    node->~Node();
+    static_cast<Slab*>(slab)->free(ptr);
+}
 
 void Node::createFirstPivot()
 {
@@ -28,9 +61,168 @@ void Node::createFirstPivot()
     writeUnlock();
 }
 
-bool Node::get(const Slice& key, Slice& value, Node* parent)
+bool Node::readVersion(uint64_t& version)
+{
+    version = version_.load(std::memory_order_acquire);
+    return (version & 1) == 0;
+}
+
+bool Node::validateVersion(uint64_t version)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version_.load(std::memory_order_relaxed) == version;
+}
+
+// Optimistic lock coupling: walk down without taking node or buffer locks,
+// validate each node's version after reading its pivot and again after the
+// child's version is read, restart from the root on conflict.
+// Merge operands met on the way are collected newest first, the walk
+// goes on until a value, a delete or the bottom resolves them.
+// Each buffer is read as of snapshot, a range tombstone in it hides its
+// older versions of the key and ends the walk.
+// REQUIRES: inside an epoch, this is the root.
+Node::GetResult Node::getOptimistic(const Slice& key, Slice& value,
+        std::vector<Slice>& operands, uint64_t snapshot, uint64_t& expiry)
+{
+    Node* node = this;
+    uint64_t version;
+
+    operands.clear();
+
+    if(!node->readVersion(version))
+        return kRestart;
+    // a root split bumps the version before growUp, so once this holds
+    // a stale root is caught by validation.
+    if(tree_->root_.load(std::memory_order_acquire) != this)
+        return kRestart;
+
+    while(true) {
+        size_t index = node->findPivot(key);
+        Pivot pivot = node->pivots_[index];
+        if(!node->validateVersion(version))
+            return kRestart;
+
+        MsgBuf* buf = pivot.buf;
+        uint64_t bufVersion;
+        if(!buf->readVersion(bufVersion))
+            return kRestart;
+
+        Msg lookup;
+        bool filtered = !buf->mayContain(key);
+        uint64_t deleted = buf->rangeCovering(key, snapshot);
+        size_t met = operands.size();
+        bool found = !filtered && buf->peek(key, lookup, operands, snapshot, deleted);
+        if(!buf->validateVersion(bufVersion))
+            return kRestart;
+        if(!found && operands.size() == met)
+            countFilter(filtered);
+
+        if(found) {
+            // the buffer may have been split away from this pivot.
+            if(!node->validateVersion(version))
+                return kRestart;
+            // overwritten values are retired, not freed, so the value
+            // stays readable as long as the caller's epoch.
+            if(lookup.type() == Put) {
+                value = lookup.value();
+                expiry = lookup.expiry();
+                return kFound;
+            }
+            return kNotFound;
+        }
+
+        if(deleted || pivot.childNid == NID_NIL)
+            return node->validateVersion(version) ? kNotFound : kRestart;
+
+        // a child merged away after the pivot was read is gone from
+        // disk too, validation would fail anyway.
+        Node* child = tree_->getNode(pivot.childNid, false);
+        if(!child)
+            return kRestart;
+
+        uint64_t childVersion;
+        if(!child->readVersion(childVersion))
+            return kRestart;
+        if(!node->validateVersion(version))
+            return kRestart;
+
+        node = child;
+        version = childVersion;
+    }
+}
+
+bool Node::get(const Slice& key, Slice& value, std::string* scratch,
+        uint64_t snapshot, uint64_t* expiry)
+{
+    static const int kMaxOptimisticRetries = 8;
+
+    std::vector<Slice> operands;
+    uint64_t none;
+    if(!expiry)
+        expiry = &none;
+    *expiry = 0;
+    Node* root = this;
+    for(int i = 0; i < kMaxOptimisticRetries; ++i) {
+        GetResult result = root->getOptimistic(key, value, operands, snapshot, *expiry);
+        if(result != kRestart)
+            return resolve(key, result == kFound, value, operands, scratch);
+
+        root = tree_->root_.load(std::memory_order_acquire);
+    }
+
+    // heavy write contention, fall back to lock coupling.
+    while(true) {
+        root->readLock();
+        if(root == tree_->root_.load(std::memory_order_acquire))
+            break;
+        root->readUnlock();
+        root = tree_->root_.load(std::memory_order_acquire);
+    }
+    operands.clear();
+    bool found = root->getLocked(key, value, operands, snapshot, *expiry);
+    return resolve(key, found, value, operands, scratch);
+}
+
+bool Node::resolve(const Slice& key, bool found, Slice& value,
+        const std::vector<Slice>& operands, std::string* scratch)
+{
+    if(operands.empty())
+        return found;
+
+    if(!applyMerges(key, found ? &value : NULL, operands, scratch))
+        return false;
+    value = Slice(*scratch);
+    return true;
+}
+
+// folds operands, newest first, onto base. false if no value results,
+// an operand the merge operator rejects is skipped.
+bool Node::applyMerges(const Slice& key, const Slice* base,
+        const std::vector<Slice>& operands, std::string* result)
+{
+    const MergeOperator* merger = tree_->opts_.mergeOperator;
+    std::string cur, next;
+    bool has = base != NULL;
+    if(has)
+        cur.assign(base->data(), base->size());
+
+    for(size_t i = operands.size(); merger && i-- > 0; ) {
+        Slice existing(cur);
+        next.clear();
+        if(!merger->merge(key, has ? &existing : NULL, operands[i], &next))
+            continue;
+        cur.swap(next);
+        has = true;
+    }
+
+    result->swap(cur);
+    return has;
+}
+
+// REQUIRES: this node is read locked, parent (if any) is read locked.
+bool Node::getLocked(const Slice& key, Slice& value, std::vector<Slice>& operands,
+        uint64_t snapshot, uint64_t& expiry, Node* parent)
 {
-    readLock();
     if(parent) {
         parent->readUnlock();
     }
@@ -38,40 +230,150 @@ bool Node::get(const Slice& key, Slice& value, Node* parent)
     size_t index = findPivot(key);
     MsgBuf* buf = pivots_[index].buf;
 
-    buf->lock();
+    // a writer holding the buffer may have stamped key already, a
+    // snapshot taken since then waits for it instead of missing it.
+    uint64_t bufVersion;
+    bool filtered = buf->readVersion(bufVersion) && !buf->mayContain(key)
+            && buf->validateVersion(bufVersion);
+    if(!filtered)
+        buf->lock();
 
     Msg lookup;
-    if(buf->find(key, lookup) && lookup.key() == key) {
-        if(lookup.type() == Put) {
-            value = lookup.value().clone(slab_);
-            buf->unlock();
-            readUnlock();
-            return true;
-        } else {
-            buf->unlock();
-            readUnlock();
-            return false;
-        }
+    uint64_t deleted = buf->rangeCovering(key, snapshot);
+    size_t met = operands.size();
+    bool hit = !filtered && buf->find(key, lookup, operands, snapshot, deleted);
+    if(!hit && operands.size() == met)
+        countFilter(filtered);
+    if(hit && lookup.type() == Put) {
+        value = lookup.value();
+        expiry = lookup.expiry();
+        buf->unlock();
+        readUnlock();
+        return true;
+    } else if(hit) {
+        buf->unlock();
+        readUnlock();
+        return false;
     }
-    buf->unlock();
+    if(!filtered)
+        buf->unlock();
 
-    if(pivots_[index].childNid == NID_NIL) {
+    if(deleted || pivots_[index].childNid == NID_NIL) {
         readUnlock();
         return false;
     }
 
-    Node* node = tree_->getNode(pivots_[index].childNid);
+    Node* node = tree_->getNode(pivots_[index].childNid, false);
     assert(node);
 
-    bool exists = node->get(key, value, this);
-    //node->decRef();
+    node->readLock();
+    return node->getLocked(key, value, operands, snapshot, expiry, this);
+}
+
+// one pass over the sorted batch: keys reaching the same pivot probe
+// its buffer under one lock, those not resolved there are handed on to
+// the child, whose nodes are fetched together before descending.
+void Node::multiGet(const std::vector<Slice>& keys, const std::vector<size_t>& batch,
+        std::vector<std::string>* values, std::vector<bool>* found,
+        std::vector<uint64_t>* expiries, std::vector<std::vector<Slice> >* operands)
+{
+    std::vector<size_t> pivots;
+    std::vector<std::vector<size_t> > groups;
+    MsgBuf* locked = NULL;
+    size_t index = 0;
+
+    for(size_t i = 0; i < batch.size(); ++i) {
+        const Slice& key = keys[batch[i]];
+        while(index + 1 < pivots_.size() && key.compare(pivots_[index + 1].leftKey) >= 0) {
+            if(locked) {
+                locked->unlock();
+                locked = NULL;
+            }
+            ++index;
+        }
+
+        MsgBuf* buf = pivots_[index].buf;
+        bool filtered = !buf->mayContain(key);
+        if(!filtered && locked != buf) {
+            buf->lock();
+            locked = buf;
+        }
+        uint64_t deleted = buf->rangeCovering(key);
+        std::vector<Slice>& met = (*operands)[batch[i]];
+        size_t before = met.size();
+        Msg lookup;
+        if(!filtered && buf->find(key, lookup, met, kMaxSequence, deleted)) {
+            Slice value = lookup.value();
+            if(lookup.type() == Put)
+                (*expiries)[batch[i]] = lookup.expiry();
+            resolveInto(key, lookup.type() == Put ? &value : NULL,
+                    batch[i], values, found, operands);
+            continue;
+        }
+        if(met.size() == before)
+            countFilter(filtered);
+
+        if(pivots_[index].childNid == NID_NIL || deleted) {
+            resolveInto(key, NULL, batch[i], values, found, operands);
+            continue;
+        }
+        if(pivots.empty() || pivots.back() != index) {
+            pivots.push_back(index);
+            groups.push_back(std::vector<size_t>());
+        }
+        groups.back().push_back(batch[i]);
+    }
+    if(locked)
+        locked->unlock();
+
+    if(pivots.empty())
+        return;
 
-    return exists;
+    std::vector<nid_t> nids;
+    for(size_t i = 0; i < pivots.size(); ++i)
+        nids.push_back(pivots_[pivots[i]].childNid);
+    std::vector<Node*> children;
+    tree_->cache_->getNodes(tree_, nids, children);
+
+    for(size_t i = 0; i < children.size(); ++i) {
+        Node* child = children[i];
+        assert(child);
+        child->readLock();
+        child->multiGet(keys, groups[i], values, found, expiries, operands);
+        child->readUnlock();
+    }
 }
 
-bool Node::put(const Slice& key, const Slice& value)
+void Node::resolveInto(const Slice& key, const Slice* base, size_t k,
+        std::vector<std::string>* values, std::vector<bool>* found,
+        std::vector<std::vector<Slice> >* operands)
 {
-    return write(Msg(Put, key.clone(slab_), value.clone(slab_)));
+    if((*operands)[k].empty()) {
+        if(base) {
+            (*values)[k].assign(base->data(), base->size());
+            (*found)[k] = true;
+        }
+        return;
+    }
+    (*found)[k] = applyMerges(key, base, (*operands)[k], &(*values)[k]);
+}
+
+void Node::countFilter(bool filtered)
+{
+    if(tree_->opts_.filterBits == 0)
+        return;
+    Metrics* metrics = tree_->cache_->metrics();
+    metrics->add(filtered ? Metrics::kFilterSkips : Metrics::kFilterFalsePositives);
+}
+
+MsgBuf* Node::newBuf()
+{
+    return new MsgBuf(slab_, tree_->opts_.filterBits, tree_->opts_.filterBitsPerKey);
+}
+
+bool Node::put(const Slice& key, const Slice& value, uint64_t expiry)
+{
+    return write(Msg(Put, key.clone(slab_), value.clone(slab_), 0, expiry));
 }
 
 bool Node::del(const Slice& key)
@@ -79,34 +381,73 @@ bool Node::del(const Slice& key)
     return write(Msg(Del, key.clone(slab_)));
 }
 
+bool Node::merge(const Slice& key, const Slice& operand)
+{
+    return write(Msg(Merge, key.clone(slab_), operand.clone(slab_)));
+}
+
 bool Node::write(const Msg& msg)
 {
     assert(pivots_.size());
     optionalLock();
 
     // must insert from root node.
-    if(tree_->root_->nid() != self_) {
+    if(tree_->root_.load(std::memory_order_acquire) != this) {
         optionalUnlock();
-        return tree_->root_->write(msg);
+
+        Node* root = tree_->pinRoot();
+        bool succ = root->write(msg);
+        root->decRef();
+        return succ;
     }
 
 	size_t idx = findPivot(msg.key());
-	LOGFMTA("Node::write findPivot indx [%lu]", idx);
-    insertMsg(idx, msg);
+	LOGFMTT("Node::write findPivot indx [%lu]", idx);
+    insertMsg(idx, msg, true);
+    setDirty(true);
+
+    if(idx + 1 == pivots_.size()) {
+        bool appending = pivots_[idx].buf->appending();
+        if(tree_->appending_.load(std::memory_order_relaxed) != appending)
+            tree_->appending_.store(appending, std::memory_order_relaxed);
+    }
+
+    pushDownOrSplit();
+    return true;
+}
+
+bool Node::deleteRange(const Slice& begin, const Slice& end)
+{
+    assert(pivots_.size());
+    optionalLock();
+
+    if(tree_->root_.load(std::memory_order_acquire) != this) {
+        optionalUnlock();
+
+        Node* root = tree_->pinRoot();
+        bool succ = root->deleteRange(begin, end);
+        root->decRef();
+        return succ;
+    }
+
+    insertRange(begin, end);
     setDirty(true);
 
     pushDownOrSplit();
     return true;
 }
 
-void Node::pushDownOrSplit()
+void Node::pushDownOrSplit(size_t depth)
 {
     int index = -1;
     // find which Pivot need to split
     for(size_t i = 0; i < pivots_.size(); ++i) {
 		// > 16*1024
-		LOGFMTI("Node::pushDownOrSplit [%lu,     %lu]", i, pivots_[i].buf->size());
-        if(pivots_[i].buf->size() > tree_->opts_.maxNodeMsg) {
+		LOGFMTT("Node::pushDownOrSplit [%lu,     %lu]", i, pivots_[i].buf->size());
+        if(pivots_[i].buf->size() > tree_->opts_.maxBufferBytes) {
+            // one key bigger than the limit can not be split.
+            if(pivots_[i].childNid == NID_NIL && !pivots_[i].buf->splittable())
+                continue;
             index = i;
             break;
         }
@@ -119,77 +460,203 @@ void Node::pushDownOrSplit()
         // if have child, flush data to the childs.
         MsgBuf* buf = pivots_[index].buf;
         Node* node = tree_->getNode(pivots_[index].childNid);
-        node->pushDown(buf, this);
-        //node->decRef();
+        node->pushDown(buf, this, depth + 1);
+        node->decRef();
     } else {
         // if no child, split the Pivot.
         splitBuf(pivots_[index].buf);
     }
 
     optionalLock();
-    pushDownOrSplit();
+    pushDownOrSplit(depth);
 }
 
-void Node::insertMsg(size_t index, const Msg& msg)
+// a snapshot taken after the stamp finds the buffer locked or the
+// message in it.
+void Node::insertMsg(size_t index, const Msg& msg, bool stamp)
 {
     MsgBuf* buf = pivots_[index].buf;
 
     buf->lock();
-    buf->insert(msg);
+    Msg stamped = msg;
+    if(stamp)
+        stamped.setSeq(tree_->snapshots_->next());
+    insertLocked(buf, stamped);
     buf->unlock();
 }
 
+// REQUIRES: buf is ours and locked.
+void Node::insertLocked(MsgBuf* buf, const Msg& msg)
+{
+    buf->insert(msg, tree_->opts_.mergeOperator, isLeaf(), tree_->snapshots_);
+    if(isLeaf() && buf->needCompaction())
+        compact(buf);
+}
+
+// the node below a pivot is locked before its buffer, in the order a
+// push down takes them, and the pivots left to right.
+void Node::lockPivots(const std::vector<Slice>& keys, std::vector<size_t>& pivots,
+        std::vector<Node*>& children)
+{
+    for(size_t i = 0; i < keys.size(); ++i) {
+        size_t index = findPivot(keys[i]);
+        if(!pivots.empty() && pivots.back() == index)
+            continue;
+
+        Node* child = NULL;
+        if(pivots_[index].childNid != NID_NIL) {
+            child = tree_->getNode(pivots_[index].childNid);
+            child->readLock();
+        }
+        pivots_[index].buf->lock();
+        pivots.push_back(index);
+        children.push_back(child);
+    }
+}
+
+void Node::unlockPivots(const std::vector<size_t>& pivots,
+        const std::vector<Node*>& children)
+{
+    for(size_t i = pivots.size(); i-- > 0; ) {
+        pivots_[pivots[i]].buf->unlock();
+        if(children[i]) {
+            children[i]->readUnlock();
+            children[i]->decRef();
+        }
+    }
+}
+
+// the first buffer on the way down holding anything of key has the
+// newest of it, the levels below only get older messages.
+uint64_t Node::latest(const Slice& key, bool locked)
+{
+    size_t index = findPivot(key);
+    MsgBuf* buf = pivots_[index].buf;
+
+    if(!locked)
+        buf->lock();
+    uint64_t seq = buf->latest(key);
+    if(!locked)
+        buf->unlock();
+    if(seq || pivots_[index].childNid == NID_NIL)
+        return seq;
+
+    Node* child = tree_->getNode(pivots_[index].childNid);
+    if(!locked)
+        child->readLock();
+    seq = child->latest(key, false);
+    if(!locked)
+        child->readUnlock();
+    child->decRef();
+    return seq;
+}
+
+void Node::writeLocked(const Msg& msg)
+{
+    Msg copy(msg.type(), msg.key().clone(slab_), msg.value().clone(slab_), msg.seq(),
+            msg.expiry());
+    insertLocked(pivots_[findPivot(msg.key())].buf, copy);
+}
+
+// REQUIRES: buf is a leaf buffer and locked.
+void Node::compact(MsgBuf* buf)
+{
+    size_t dropped, expired;
+    if(!buf->compact(&dropped, tree_->snapshots_, &expired))
+        return;
+
+    Metrics* metrics = tree_->cache_->metrics();
+    metrics->add(Metrics::kLeafCompactions);
+    metrics->add(Metrics::kCompactionDroppedBytes, dropped);
+    metrics->add(Metrics::kExpiredBytes, expired);
+}
+
+// clips [begin, end) to each pivot it overlaps, so a buffer never holds
+// a tombstone reaching past its own keys. leaves apply it in place.
+// the buffers are locked left to right, a snapshot sees the delete in
+// all of them or in none.
+void Node::insertRange(const Slice& begin, const Slice& end, uint64_t seq)
+{
+    std::vector<size_t> indexes;
+    std::vector<Slice> firsts, lasts;
+    for(size_t i = findPivot(begin); i < pivots_.size(); ++i) {
+        Slice first = begin, last = end;
+        if(i > 0 && first.compare(pivots_[i].leftKey) < 0)
+            first = pivots_[i].leftKey;
+        if(i + 1 < pivots_.size() && pivots_[i + 1].leftKey.compare(last) < 0)
+            last = pivots_[i + 1].leftKey;
+        if(first.compare(last) >= 0)
+            break;
+
+        indexes.push_back(i);
+        firsts.push_back(first);
+        lasts.push_back(last);
+        pivots_[i].buf->lock();
+    }
+
+    if(seq == 0)
+        seq = tree_->snapshots_->next();
+    for(size_t k = 0; k < indexes.size(); ++k) {
+        MsgBuf* buf = pivots_[indexes[k]].buf;
+        buf->insertRange(firsts[k], lasts[k], seq, isLeaf(), tree_->snapshots_);
+        buf->unlock();
+    }
+}
+
 void Node::splitBuf(MsgBuf* buf)
 {
-    assert(isLeaf_);
+    assert(isLeaf());
 
     // if pivot bigger than 16K
-    if(buf->size() <= tree_->opts_.maxNodeMsg) {
+    if(buf->size() <= tree_->opts_.maxBufferBytes) {
         writeUnlock();
         return;
     }
 
-	LOGFMTI("############# Node::splitBuf ############ ");
-
     MsgBuf* buf0 = buf;
-    MsgBuf* buf1 = new MsgBuf(slab_);
 
     buf0->lock();
-
-    MsgBuf::Iterator iter(buf0->skiplist());
-
-    iter.seekToFirst();
-    assert(iter.valid());
-    Msg msg = iter.key();
-
-    iter.seekToMiddle();
-    assert(iter.valid());
-    Msg middle = iter.key();
-
-    buf1->lock();
-    while(iter.valid()) {
-        buf1->insert(iter.key());
-        iter.next();
+    // dropped deletes and overwritten values may bring it under the limit.
+    compact(buf0);
+    if(buf0->size() <= tree_->opts_.maxBufferBytes || !buf0->splittable()) {
+        buf0->unlock();
+        writeUnlock();
+        return;
     }
 
-    size_t sz = buf0->size();
-    buf0->resize(buf0->count() / 2);
+	LOGFMTD("############# Node::splitBuf ############ ");
+    tree_->cache_->metrics()->add(Metrics::kSplitBufs);
 
-    addPivot(NID_NIL, buf1, middle.key().clone(slab_));
+    std::string first = buf0->firstKey().toString();
 
-    assert(buf0->size() + buf1->size() >= sz);
+    if(pivots_.size() == maxPivots()) {
+        // no room for another pivot until the pending node split lands.
+        buf0->unlock();
+        writeUnlock();
+    } else {
+        MsgBuf* buf1 = newBuf();
 
-    buf1->unlock();
-    buf0->unlock();
+        buf1->lock();
+        // an append split fills the left nearly up, the next appends
+        // go to the right.
+        size_t limit = 0;
+        if(buf0 == pivots_.back().buf && appending())
+            limit = static_cast<size_t>(tree_->opts_.maxBufferBytes * kAppendSplitRatio);
+        Slice middle = buf0->split(buf1, limit);
+        addPivot(NID_NIL, buf1, middle.clone(slab_));
 
-    setDirty(true);
-    writeUnlock();
+        buf1->unlock();
+        buf0->unlock();
+
+        setDirty(true);
+        writeUnlock();
+    }
 
 	// lock the nodes from root to leaf.
     std::vector<Node*> lockedPath;
-    tree_->lockPath(msg.key(), lockedPath);
+    tree_->lockPath(Slice(first), lockedPath);
 
-	LOGFMTI("Node::splitBuf lockedPath size: %lu", lockedPath.size());
+	LOGFMTT("Node::splitBuf lockedPath size: %lu", lockedPath.size());
 
     if(!lockedPath.empty()) {
         Node* node = lockedPath.back();
@@ -197,46 +664,95 @@ void Node::splitBuf(MsgBuf* buf)
     }
 }
 
+// REQUIRES: this node is write locked.
 void Node::addPivot(nid_t child, MsgBuf* buf, Slice key)
 {
-    MutexLockGuard lock(pivotsMutex_);
     if(key.size() == 0) {
         assert(buf == NULL);
         assert(pivots_.size() == 0);
 
-        buf = new MsgBuf(slab_);
+        buf = newBuf();
+        growPivots(1);
         pivots_.push_back(Pivot(child, buf, key));
     } else {
         assert(pivots_.size());
         if(buf == NULL) {
-            buf = new MsgBuf(slab_);
+            buf = newBuf();
         }
         size_t idx = findPivot(key);
-		LOGFMTI("Node::addPivot findPivot indx [%lu]", idx);
-        // FIXME
+		LOGFMTT("Node::addPivot findPivot indx [%lu]", idx);
+        growPivots(pivots_.size() + 1);
         pivots_.insert(pivots_.begin() + idx + 1, Pivot(child, buf, key));
     }
 
     setDirty(true);
 }
 
+void Node::appendPivot(nid_t child, MsgBuf* buf, Slice key)
+{
+    assert(pivots_.empty() || pivots_.back().leftKey.compare(key) < 0);
+    assert(pivots_.size() < maxPivots());
+
+    growPivots(pivots_.size() + 1);
+    pivots_.push_back(Pivot(child, buf, key));
+}
+
+// REQUIRES: this node is write locked, or not published yet.
+void Node::growPivots(size_t n)
+{
+    assert(n <= maxPivots());
+    pivots_.grow(n, tree_->epoch_);
+}
+
+// the pivots one node can take before its pending split lands.
+size_t Node::maxPivots()
+{
+    return 2 * tree_->opts_.maxNodeChildNum + 2;
+}
+
+void PivotArray::grow(size_t n, EpochManager* epoch)
+{
+    std::vector<Pivot>* old = array_.load(std::memory_order_relaxed);
+    if(n <= old->capacity())
+        return;
+
+    std::vector<Pivot>* array = new std::vector<Pivot>();
+    array->reserve(std::max(n, 2 * old->capacity()));
+    array->assign(old->begin(), old->end());
+    array_.store(array, std::memory_order_release);
+    epoch->retire(destroy, NULL, old);
+}
+
+void PivotArray::destroy(void* arg, void* array)
+{
+    delete static_cast<std::vector<Pivot>*>(array);
+}
+
+// REQUIRES: this node is locked.
+bool Node::empty()
+{
+    if(!isLeaf() || pivots_.size() != 1)
+        return false;
+    MsgBuf* buf = pivots_[0].buf;
+    return buf->count() == 0 && !buf->hasRanges();
+}
+
 size_t Node::findPivot(const Slice& key)
 {
 	size_t pivots = pivots_.size();
 	if(pivots == 0)
 		return 0;
-	size_t pivot = 0;
 
-	for(size_t i = 0; i < pivots; i++) {
-		LOGFMTA("Node::findPivot indx [%s,    %s]", std::string(key.data(), key.size()).c_str(), 
-			std::string(pivots_[i].leftKey.data(), pivots_[i].leftKey.size()).c_str());
+	// appends go past the last pivot, spare them the scan.
+	if(pivots > 1 && key.compare(pivots_[pivots - 1].leftKey) >= 0)
+		return pivots - 1;
+
+	// pivots_[0] has an empty leftKey and covers everything below pivots_[1].
+	for(size_t i = 1; i < pivots; i++) {
 		if(key.compare(pivots_[i].leftKey) < 0)
-			return pivot;
-		pivot++;
+			return i - 1;
 	}
-	if(pivot > (pivots - 1))
-		return pivots - 1;
-	return pivot;
+	return pivots - 1;
 }
 
 void Node::lockPath(const Slice& key, std::vector<Node*>& path)
@@ -244,63 +760,93 @@ void Node::lockPath(const Slice& key, std::vector<Node*>& path)
     path.push_back(this);
 
     size_t index = findPivot(key);
-	LOGFMTI("Node::lockPath findPivot index [%lu]", index);
+	LOGFMTT("Node::lockPath findPivot index [%lu]", index);
 
     if(pivots_[index].childNid != NID_NIL) {
         Node* node = tree_->getNode(pivots_[index].childNid);
 
         node->writeLock();
-        node->pushDownLocked(pivots_[index].buf, this);
+        node->pushDownLocked(pivots_[index].buf, this, path.size());
         node->lockPath(key, path);
     }
 }
 
-void Node::pushDown(MsgBuf* buf, Node* parent)
+void Node::pushDown(MsgBuf* buf, Node* parent, size_t depth)
 {
     optionalLock();
 
-    pushDownLocked(buf, parent);
+    pushDownLocked(buf, parent, depth);
     parent->readUnlock();
 
-    pushDownOrSplit();
+    pushDownOrSplit(depth);
 }
 
 
-void Node::pushDownLocked(MsgBuf* buf, Node* parent)
+void Node::pushDownLocked(MsgBuf* buf, Node* parent, size_t depth)
 {
     buf->lock();
 
-    if(buf->count() == 0) {
+    if(buf->count() == 0 && !buf->hasRanges()) {
         buf->unlock();
         return;
     }
 
-    size_t idx = 1;
-    size_t i = 0, j = 0;
-    MsgBuf::Iterator slow(buf->skiplist());
-    MsgBuf::Iterator fast(buf->skiplist());
-
-    slow.seekToFirst();
-    fast.seekToFirst();
+    Metrics* metrics = tree_->cache_->metrics();
+    metrics->add(Metrics::kPushDowns);
+    metrics->add(Metrics::kPushDownMsgs, buf->count());
+    metrics->addPushDownBytes(depth, buf->size());
+
+    // tombstones first, the buffer's messages are newer than them
+    // unless a snapshot kept one that is older. oldest first like the
+    // versions, each one only replaces older ones.
+    MsgBuf::Ranges ranges(buf->ranges());
+    std::stable_sort(ranges.begin(), ranges.end(), seqOrder);
+    for(size_t r = 0; r < ranges.size(); ++r)
+        insertRange(Slice(const_cast<std::string&>(ranges[r].begin)),
+                Slice(const_cast<std::string&>(ranges[r].end)), ranges[r].seq);
+
+    // the versions of a key go down oldest first, each insert then
+    // replaces what a snapshot does not need anymore. a version hidden
+    // by one of the tombstones is dropped unless a snapshot reads it.
+    // an expired value goes on as a Del, it still hides the older ones.
+    const SnapshotList* snapshots = tree_->snapshots_;
+    uint64_t now = nowSeconds();
+    size_t expired = 0;
+    size_t idx = 0;
+    std::vector<Msg> versions;
+    MsgBuf::Iterator iter(buf->skiplist());
+    iter.seekToFirst();
+    while(iter.valid()) {
+        Msg msg = iter.key();
+        iter.next();
+        versions.push_back(msg);
+        if(iter.valid() && iter.key().key() == msg.key())
+            continue;
 
-    while(fast.valid() && idx < pivots_.size()) {
-		if(fast.key().key().compare(pivots_[idx].leftKey) < 0) {
-            j++;
-            fast.next();
-        } else {
-            while(i != j) {
-                insertMsg(idx - 1, slow.key());
-                i++;
-                slow.next();
-            }
+        while(idx + 1 < pivots_.size() && msg.key().compare(pivots_[idx + 1].leftKey) >= 0)
             idx++;
+        for(size_t v = versions.size(); v-- > 0; ) {
+            const Msg& version = versions[v];
+            uint64_t deleted = buf->rangeAfter(msg.key(), version.seq());
+            if(deleted && !snapshots->pinned(version.seq(), deleted)) {
+                Msg dead = version;
+                dead.release();
+                continue;
+            }
+            if(version.type() == Put && version.expired(now)) {
+                Msg del(Del, version.key(), Slice(), version.seq());
+                Slice value = version.value();
+                value.release();
+                expired += version.size() - del.size();
+                insertMsg(idx, del);
+                continue;
+            }
+            insertMsg(idx, version);
         }
+        versions.clear();
     }
-
-    while(slow.valid()) {
-        insertMsg(idx - 1, slow.key());
-        slow.next();
-    }
+    if(expired)
+        metrics->add(Metrics::kExpiredBytes, expired);
 
     setDirty(true);
     parent->setDirty(true);
@@ -312,31 +858,36 @@ void Node::splitNode(std::vector<Node*>& path)
 {
     assert(path.back() == this);
 
-	// <= 16
-    if(pivots_.size() <= tree_->opts_.maxNodeChildNum) {
+    if(!needSplit()) {
         while(!path.empty()) {
             Node* node = path.back();
             node->writeUnlock();
-            //node->decRef();
+            node->decRef();
             path.pop_back();
         }
         return;
     }
 
-	LOGFMTI("############# Node::splitNode ############ ");
+	LOGFMTD("############# Node::splitNode ############ ");
+    tree_->cache_->metrics()->add(Metrics::kSplitNodes);
 	
-    size_t middle = pivots_.size() / 2;
+    size_t middle = splitPoint();
     Slice middleKey = pivots_[middle].leftKey;
 
+    // new nodes sit in the cache already, the write back thread
+    // may look at them before they are linked.
     Node* node = tree_->createNode();
-    node->isLeaf_ = isLeaf_;
+    node->writeLock();
+    node->setLeaf(isLeaf());
 
     std::vector<Pivot>::iterator first = pivots_.begin() + middle;
     std::vector<Pivot>::iterator last = pivots_.end();
 
+    node->growPivots(last - first);
     node->pivots_.insert(node->pivots_.begin(), first, last);
     node->setDirty(true);
-    //node->decRef();
+    node->writeUnlock();
+    node->decRef();
 
     pivots_.resize(middle);
     setDirty(true);
@@ -344,9 +895,11 @@ void Node::splitNode(std::vector<Node*>& path)
 
     if(path.empty()) {
         Node* root = tree_->createNode();
-        root->isLeaf_ = false;
+        root->writeLock();
+        root->setLeaf(false);
         root->addPivot(nid(), NULL, Slice());
         root->addPivot(node->nid(), NULL, middleKey.clone(slab_));
+        root->writeUnlock();
         tree_->growUp(root);
     } else {
         Node* parent = path.back();
@@ -355,48 +908,304 @@ void Node::splitNode(std::vector<Node*>& path)
     }
 
     writeUnlock();
-    //decRef();
+    decRef();
+}
+
+void Node::rebalance(std::vector<Node*>& children, size_t depth)
+{
+    if(isLeaf()) {
+        mergePivots();
+        return;
+    }
+
+    pushDownDeletes(depth);
+    for(size_t i = 0; i + 1 < pivots_.size(); ) {
+        if(!mergeChildren(i))
+            ++i;
+    }
+
+    // nodes not in memory are left alone, a pass never reads the disk.
+    for(size_t i = 0; i < pivots_.size(); ++i) {
+        Node* child = tree_->cache_->peekNode(pivots_[i].childNid);
+        if(child)
+            children.push_back(child);
+    }
+}
+
+// with no writes following them, deletes buffered here would keep the
+// nodes below full for good. a buffer of mostly tombstones goes down to
+// its cached child, the leaves drop what they hide once compacted.
+void Node::pushDownDeletes(size_t depth)
+{
+    for(size_t i = 0; i < pivots_.size(); ++i) {
+        MsgBuf* buf = pivots_[i].buf;
+        buf->lock();
+        bool deletes = buf->hasRanges() || buf->deletes() * 2 > buf->count();
+        buf->unlock();
+        if(!deletes)
+            continue;
+
+        Node* child = tree_->cache_->peekNode(pivots_[i].childNid);
+        if(!child)
+            continue;
+        child->writeLock();
+        if(!child->dead())
+            child->pushDownLocked(buf, this, depth + 1);
+        child->writeUnlock();
+        child->decRef();
+    }
 }
 
+// adjacent leaf pivots merge when one of them is empty or both
+// together fill at most mergeRatio of a buffer.
+void Node::mergePivots()
+{
+    const Options& opts = tree_->opts_;
+    size_t limit = static_cast<size_t>(opts.maxBufferBytes * opts.mergeRatio);
+    size_t merged = 0;
+
+    for(size_t i = 0; i + 1 < pivots_.size(); ) {
+        MsgBuf* buf = pivots_[i].buf;
+        MsgBuf* next = pivots_[i + 1].buf;
+        if(buf->count() != 0 && next->count() != 0
+                && buf->size() + next->size() > limit) {
+            ++i;
+            continue;
+        }
+
+        buf->lock();
+        next->lock();
+        buf->absorb(next, true, tree_->snapshots_);
+        next->unlock();
+        buf->unlock();
+
+        removePivot(i + 1);
+        merged++;
+    }
+
+    if(merged) {
+        setDirty(true);
+        tree_->cache_->metrics()->add(Metrics::kPivotMerges, merged);
+    }
+}
+
+// the children of pivots index and index + 1 become one node, the
+// left one. only cached children are merged.
+bool Node::mergeChildren(size_t index)
+{
+    Cache* cache = tree_->cache_;
+    Node* left = cache->peekNode(pivots_[index].childNid);
+    if(!left)
+        return false;
+    Node* right = cache->peekNode(pivots_[index + 1].childNid);
+    if(!right) {
+        left->decRef();
+        return false;
+    }
+
+    left->writeLock();
+    right->writeLock();
+
+    bool merge = left->canAbsorb(right);
+    if(merge) {
+        MsgBuf* buf = pivots_[index].buf;
+        MsgBuf* next = pivots_[index + 1].buf;
+        buf->lock();
+        next->lock();
+        buf->absorb(next, false);
+        next->unlock();
+        buf->unlock();
+
+        left->absorb(right, pivots_[index + 1].leftKey);
+        removePivot(index + 1);
+        setDirty(true);
+    }
+
+    right->writeUnlock();
+    left->writeUnlock();
+    left->decRef();
+    right->decRef();
+
+    if(merge) {
+        // retired, writers still holding it find it dead and empty.
+        cache->dropNode(right);
+        tree_->layout_->drop(right->nid());
+        cache->metrics()->add(Metrics::kNodeMerges);
+    }
+    return merge;
+}
+
+// internal nodes by fanout, leaves by bytes. a merged leaf keeps room
+// for as many pivots again before it must split.
+// REQUIRES: both nodes are write locked.
+bool Node::canAbsorb(Node* right)
+{
+    assert(isLeaf() == right->isLeaf());
+
+    const Options& opts = tree_->opts_;
+    size_t pivots = pivots_.size() + right->pivots_.size();
+    if(!isLeaf())
+        return pivots <= opts.maxNodeChildNum * opts.mergeRatio;
+    return pivots <= opts.maxNodeChildNum
+        && serializedSize() + right->serializedSize() <= opts.nodeSize * opts.mergeRatio;
+}
+
+// separator is the parent's key for right, the first pivot of right
+// has an empty leftKey only if it never split.
+// REQUIRES: both nodes are write locked, canAbsorb(right).
+void Node::absorb(Node* right, const Slice& separator)
+{
+    size_t first = pivots_.size();
+    assert(first + right->pivots_.size() <= maxPivots());
+
+    growPivots(first + right->pivots_.size());
+    pivots_.insert(pivots_.end(), right->pivots_.begin(), right->pivots_.end());
+    if(pivots_[first].leftKey.empty())
+        pivots_[first].leftKey = separator.clone(slab_);
+    right->pivots_.clear();
+    right->kill();
+    setDirty(true);
+}
+
+// REQUIRES: this node is write locked, the pivot's buffer is empty.
+void Node::removePivot(size_t index)
+{
+    assert(index > 0);
+
+    // lock free readers may still be inside the buffer or the key.
+    tree_->epoch_->retire(MsgBuf::destroy, NULL, pivots_[index].buf);
+    pivots_[index].leftKey.release();
+    pivots_.erase(pivots_.begin() + index);
+}
+
+Node* Node::collapse()
+{
+    if(isLeaf() || pivots_.size() != 1)
+        return NULL;
+
+    Node* child = tree_->cache_->peekNode(pivots_[0].childNid);
+    if(!child)
+        return NULL;
+
+    child->writeLock();
+    child->pushDownLocked(pivots_[0].buf, this, 1);
+    return child;
+}
+
+void Node::kill()
+{
+    state_.fetch_or(kDead, std::memory_order_release);
+    // nothing to write back, Layout::write skips it if it is queued.
+    setDirty(false);
+}
+
+// leaves split by bytes, internal nodes by fanout. a leaf also splits
+// when its pivot array is full, splitBuf cannot add to it then.
+// REQUIRES: this node is write locked.
+bool Node::needSplit()
+{
+    if(pivots_.size() < 2)
+        return false;
+    if(!isLeaf())
+        return pivots_.size() > tree_->opts_.maxNodeChildNum;
+    return pivots_.size() == maxPivots()
+        || serializedSize() > tree_->opts_.nodeSize;
+}
+
+// the writes go to the last pivot of the tree's right edge, only
+// growing it. REQUIRES: this node is write locked.
+bool Node::appending()
+{
+    return tree_->appending_.load(std::memory_order_relaxed)
+        && pivots_.back().buf->appending();
+}
+
+// internal nodes split in the middle pivot, leaves where half of the
+// bytes are on either side. appends leave most of it on the left.
+// REQUIRES: this node is write locked.
+size_t Node::splitPoint()
+{
+    size_t n = pivots_.size();
+    double ratio = appending() ? kAppendSplitRatio : 0.5;
+    if(!isLeaf()) {
+        size_t middle = static_cast<size_t>(n * ratio);
+        return std::max<size_t>(1, std::min(middle, n - 1));
+    }
+
+    size_t total = 0;
+    for(size_t i = 0; i < n; ++i)
+        total += pivots_[i].buf->size();
+
+    size_t left = 0;
+    for(size_t i = 0; i < n - 1; ++i) {
+        left += pivots_[i].buf->size();
+        if(left >= total * ratio)
+            return i + 1;
+    }
+    return n - 1;
+}
+
+// pivots_ only change under the write lock, sum them optimistically
+// so the write back thread never blocks a writer.
 size_t Node::size()
 {
-    MutexLockGuard lock(pivotsMutex_);
-    //size_t usage = sizeof(Node);
+    uint64_t version;
+    if(!readVersion(version))
+        return bufferedSize_.load(std::memory_order_relaxed);
+
     size_t usage = 0;
     for(size_t i = 0; i < pivots_.size(); ++i)
         usage += pivots_[i].buf->size();
+    if(!validateVersion(version))
+        return bufferedSize_.load(std::memory_order_relaxed);
 
-    //return usage + pivots_.size() * sizeof(Pivot);
+    bufferedSize_.store(usage, std::memory_order_relaxed);
     return usage;
 }
 
 void Node::setDirty(bool dirty)
 {
-    MutexLockGuard lock(mutex_);
-
     //if (!dirty_ && dirty) 
         //first_write_timestamp_ = Timestamp::now();
 
-    dirty_ = dirty;
+    if(dirty)
+        state_.fetch_or(kDirty, std::memory_order_release);
+    else
+        state_.fetch_and(~kDirty, std::memory_order_release);
 }
 
 bool Node::dirty() 
 {
-    MutexLockGuard lock(mutex_);
-    return dirty_;
+    return state_.load(std::memory_order_acquire) & kDirty;
 }
 
 void Node::setFlushing(bool flushing)
 {
-    MutexLockGuard lock(mutex_);
-    flushing_ = flushing;
+    if(flushing)
+        state_.fetch_or(kFlushing, std::memory_order_release);
+    else
+        state_.fetch_and(~kFlushing, std::memory_order_release);
 }
 
 size_t Node::writeBackSize()
 {
-    size_t size = 0;
+    uint64_t version;
+    if(!readVersion(version))
+        return imageSize_.load(std::memory_order_relaxed);
+
+    size_t size = serializedSize();
+    if(!validateVersion(version))
+        return imageSize_.load(std::memory_order_relaxed);
+
+    imageSize_.store(size, std::memory_order_relaxed);
+    return size;
+}
 
-    size += sizeof(isLeaf_);
+// REQUIRES: the write lock or a validated version.
+size_t Node::serializedSize()
+{
+    size_t size = 0;
+    size += 1; // isLeaf
     size += sizeof(self_);
     size += 4; // pivots_.size()
 
@@ -404,65 +1213,76 @@ size_t Node::writeBackSize()
         size += sizeof(nid_t); // childNid
         size += 4 + pivots_[i].leftKey.size(); // leftKey
         size += pivots_[i].buf->size(); // buf size
+        size += pivots_[i].buf->filterSize();
     }
-
     return size;
 }
 
 bool Node::flushing()
 {
-    MutexLockGuard lock(mutex_);
-    return flushing_;
+    return state_.load(std::memory_order_acquire) & kFlushing;
 }
 
-void Node::incRef()
+// one load decides, the cache scan does not take any lock per node.
+bool Node::evictable()
 {
-    MutexLockGuard lock(mutex_);
-    refcnt_++;
+    uint32_t state = state_.load(std::memory_order_acquire);
+    return (state & (kDirty | kFlushing)) == 0 && (state >> kRefShift) == 0;
 }
 
-void Node::decRef()
+void Node::setReferenced()
 {
-    MutexLockGuard lock(mutex_);
-    assert(refcnt_ > 0);
+    // hit after hit only reads, the word stays shared between readers.
+    if(!(state_.load(std::memory_order_relaxed) & kReferenced))
+        state_.fetch_or(kReferenced, std::memory_order_relaxed);
+}
 
-    refcnt_--;
-    //last_used_timestamp_ = Timestamp::now();
+bool Node::clearReferenced()
+{
+    return state_.fetch_and(~kReferenced, std::memory_order_relaxed) & kReferenced;
 }
 
-size_t Node::refs()
+void Node::incRef()
 {
-    MutexLockGuard lock(mutex_);
-    return refcnt_;
+    state_.fetch_add(kRefOne, std::memory_order_acq_rel);
 }
 
-nid_t Node::nid() 
+void Node::decRef()
 {
-    MutexLockGuard lock(mutex_);
-    return self_;
+    uint32_t old = state_.fetch_sub(kRefOne, std::memory_order_acq_rel);
+    assert((old >> kRefShift) > 0);
+    (void)old;
+    //last_used_timestamp_ = Timestamp::now();
 }
 
-void Node::setNid(nid_t nid)
+size_t Node::refs()
 {
-    MutexLockGuard lock(mutex_);
-    self_ = nid;
+    return state_.load(std::memory_order_acquire) >> kRefShift;
 }
 
 void Node::setLeaf(bool leaf)
 {
-    MutexLockGuard lock(mutex_);
-    isLeaf_ = leaf;
+    if(leaf)
+        state_.fetch_or(kLeaf, std::memory_order_release);
+    else
+        state_.fetch_and(~kLeaf, std::memory_order_release);
 }
 
 bool Node::serialize(Buffer& writer)
 {
-	writer.appendInt8(isLeaf_);
+	writer.appendInt8(isLeaf());
 	writer.appendInt32(self_);
 	uint32_t pivots = pivots_.size();
 	assert(pivots > 0);
 	writer.appendInt32(pivots);
 
 	for(size_t i = 0; i < pivots; ++i) {
+		if(isLeaf() && pivots_[i].buf->needCompaction(true)) {
+			// written back mostly as its run, cheap to read again.
+			pivots_[i].buf->lock();
+			compact(pivots_[i].buf);
+			pivots_[i].buf->unlock();
+		}
 		writer.appendInt32(pivots_[i].childNid);
 		writer.appendInt32(pivots_[i].leftKey.size());
 		writer.append(pivots_[i].leftKey.data(), pivots_[i].leftKey.size());
@@ -474,12 +1294,13 @@ bool Node::serialize(Buffer& writer)
 
 bool Node::deserialize(Buffer& reader)
 {
-	isLeaf_ = reader.readInt8();
+	setLeaf(reader.readInt8());
 	self_ = reader.readInt32();
 	
 	uint32_t pivots = 0;
 	pivots = reader.readInt32();
 	assert(pivots > 0);
+	growPivots(pivots);
 
 	nid_t child = 0;
 	//Slice leftKey;
@@ -487,8 +1308,8 @@ bool Node::deserialize(Buffer& reader)
 	for(size_t i = 0; i < pivots; ++i) {
 		child = reader.readInt32();
 		std::string readStr(reader.readString());
-		Slice leftKey(readStr);
-		buf = new MsgBuf(slab_);
+		Slice leftKey = Slice(readStr).clone(slab_);
+		buf = newBuf();
 		buf->deserialize(reader);
 		pivots_.push_back(Pivot(child, buf, leftKey));
 	}
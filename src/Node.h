@@ -1,7 +1,10 @@
 #ifndef __BT_NODE_H
 #define __BT_NODE_H
 #include <stdint.h>
+#include <assert.h>
 #include <vector>
+#include <atomic>
+#include <boost/noncopyable.hpp>
 
 #include "RWLock.h"
 #include "Slice.h"
@@ -12,6 +15,7 @@ namespace bt {
 
 class BufferTree;
 class Slab;
+class EpochManager;
 
 struct Pivot
 {
@@ -27,68 +31,239 @@ struct Pivot
     Slice leftKey;
 };
 
+// the pivots of a node, a vector that optimistic readers can walk while
+// it changes. it never reallocates in place: grow() copies it and
+// retires the old array, so a reader still in it keeps valid memory.
+// changes REQUIRE the node write locked, or not published yet.
+class PivotArray : boost::noncopyable
+{
+public:
+    typedef std::vector<Pivot>::iterator iterator;
+
+    PivotArray() : array_(new std::vector<Pivot>()) {}
+    ~PivotArray() { delete array_.load(std::memory_order_relaxed); }
+
+    size_t size() const { return get().size(); }
+    bool empty() const { return get().empty(); }
+    size_t capacity() const { return get().capacity(); }
+    Pivot& operator[](size_t i) { return get()[i]; }
+    Pivot& back() { return get().back(); }
+    iterator begin() { return get().begin(); }
+    iterator end() { return get().end(); }
+
+    // room for n pivots.
+    void grow(size_t n, EpochManager* epoch);
+    // the rest REQUIRE room for what they add.
+    void push_back(const Pivot& pivot)
+    {
+        assert(size() < capacity());
+        get().push_back(pivot);
+    }
+    void insert(iterator pos, const Pivot& pivot)
+    {
+        assert(size() < capacity());
+        get().insert(pos, pivot);
+    }
+    void insert(iterator pos, iterator first, iterator last)
+    {
+        assert(size() + (last - first) <= capacity());
+        get().insert(pos, first, last);
+    }
+    void erase(iterator pos) { get().erase(pos); }
+    void resize(size_t n) { assert(n <= size()); get().resize(n); }
+    void clear() { get().clear(); }
+
+private:
+    static void destroy(void* arg, void* array);
+
+    std::vector<Pivot>& get() const { return *array_.load(std::memory_order_acquire); }
+
+    std::atomic<std::vector<Pivot>*> array_;
+};
+
 class Node
 {
 public:
     Node(BufferTree* tree, nid_t self, Slab* slab);
     ~Node();
 
+    // EpochManager::Deleter for nodes evicted from the cache.
+    static void destroy(void* slab, void* node);
+
 
 	void readLock()		{ rwlock_.readLock(); }
 	void readUnlock()	{ rwlock_.unlock(); }
 
-	void writeLock()		{ rwlock_.writeLock(); }
-	void writeUnlock() 	{ rwlock_.unlock(); }
+	// pivots_ only change under the write lock, which keeps version_ odd
+	// while held, so readers can skip the lock and validate instead.
+	void writeLock()		{ rwlock_.writeLock(); version_.fetch_add(1, std::memory_order_acq_rel); }
+	void writeUnlock() 	{ version_.fetch_add(1, std::memory_order_release); rwlock_.unlock(); }
 
 	bool tryReadLock()	{ return rwlock_.tryReadLock(); }
-	bool tryWriteLock()	{ return rwlock_.tryWriteLock(); }
+	bool tryWriteLock()
+	{
+		if(!rwlock_.tryWriteLock())
+			return false;
+		version_.fetch_add(1, std::memory_order_acq_rel);
+		return true;
+	}
+
+	// optimistic read protocol, returns false if a writer holds the node.
+	bool readVersion(uint64_t& version);
+	bool validateVersion(uint64_t version);
 
-	void optionalLock()    { isLeaf_ ? writeLock() : readLock(); }
-    void optionalUnlock()  { rwlock_.unlock(); }
+	void optionalLock()    { isLeaf() ? writeLock() : readLock(); }
+    void optionalUnlock()  { isLeaf() ? writeUnlock() : readUnlock(); }
 
 	void createFirstPivot();
-	bool get(const Slice& key, Slice& value, Node* parent = NULL);
-	bool put(const Slice& key, const Slice& value);
+	// value points into the tree, it is valid until the caller
+	// leaves the epoch it got it in.
+	// a value built from merge operands is stored in scratch.
+	// the writes after snapshot are not seen.
+	// expiry is the found value's, 0 if it does not expire.
+	bool get(const Slice& key, Slice& value, std::string* scratch,
+			uint64_t snapshot = kMaxSequence, uint64_t* expiry = NULL);
+	bool getLocked(const Slice& key, Slice& value, std::vector<Slice>& operands,
+			uint64_t snapshot, uint64_t& expiry, Node* parent = NULL);
+	// looks up keys[batch[i]], batch sorted by key, into values, found
+	// and expiries. operands holds the merge operands met so far per key.
+	// REQUIRES: this node is read locked, inside an epoch.
+	void multiGet(const std::vector<Slice>& keys, const std::vector<size_t>& batch,
+			std::vector<std::string>* values, std::vector<bool>* found,
+			std::vector<uint64_t>* expiries, std::vector<std::vector<Slice> >* operands);
+	// expiry in seconds since the epoch, 0 never expires.
+	bool put(const Slice& key, const Slice& value, uint64_t expiry = 0);
 	bool del(const Slice& key);
+	bool merge(const Slice& key, const Slice& operand);
 	bool write(const Msg& msg);
-	void pushDownOrSplit();
-	void insertMsg(size_t index, const Msg& msg);
+	bool deleteRange(const Slice& begin, const Slice& end);
+	// depth is this node's distance from the root, for accounting only.
+	void pushDownOrSplit(size_t depth = 0);
+	// stamp: a new write, it gets its sequence number under the
+	// buffer's lock.
+	void insertMsg(size_t index, const Msg& msg, bool stamp = false);
+	// a transaction's commit: the buffers the sorted keys go to are
+	// locked, and the nodes below them, so no write to the keys enters
+	// or moves down until unlockPivots. this node stays locked.
+	// REQUIRES: this is the root and optionalLock()ed, inside an epoch.
+	void lockPivots(const std::vector<Slice>& keys, std::vector<size_t>& pivots,
+			std::vector<Node*>& children);
+	void unlockPivots(const std::vector<size_t>& pivots,
+			const std::vector<Node*>& children);
+	// seq of the newest message of key or range tombstone over it, here
+	// or below, 0 if none but the runs have it. the versions after the
+	// oldest snapshot all keep theirs.
+	// REQUIRES: this node is read locked, or locked is true and key is
+	// locked by lockPivots.
+	uint64_t latest(const Slice& key, bool locked = false);
+	// msg is copied, its seq is kept. REQUIRES: key locked by lockPivots.
+	void writeLocked(const Msg& msg);
+	void compact(MsgBuf* buf);
+	// seq 0 stamps a new range delete once all of its buffers are locked.
+	void insertRange(const Slice& begin, const Slice& end, uint64_t seq = 0);
 	void splitBuf(MsgBuf* buf);
 	void addPivot(nid_t child, MsgBuf* buf, Slice key);
+	// bulk loading fills nodes left to right before they are published.
+	// REQUIRES: key sorts after every pivot's.
+	void appendPivot(nid_t child, MsgBuf* buf, Slice key);
+	// a leaf with one buffer holding nothing, as a new tree's root.
+	bool empty();
 	size_t findPivot(const Slice& key);
 	void lockPath(const Slice& key, std::vector<Node*>& path);
-	void pushDown(MsgBuf* buf, Node* parent);
-	void pushDownLocked(MsgBuf* buf, Node* parent);
+	void pushDown(MsgBuf* buf, Node* parent, size_t depth);
+	void pushDownLocked(MsgBuf* buf, Node* parent, size_t depth);
 	void splitNode(std::vector<Node*>& path);
+	// merges what deletes left underfull below this node and hands back
+	// its cached children, pinned, to be rebalanced next. depth is the
+	// level of this node, the root's is 0.
+	// REQUIRES: this node is write locked.
+	void rebalance(std::vector<Node*>& children, size_t depth);
+	// the only child of the root, with the root's buffer pushed into it,
+	// pinned and write locked. NULL if the root has more children or the
+	// child is not cached. REQUIRES: this is the write locked root.
+	Node* collapse();
+	// merged into a sibling or replaced as root, no pivot points to it.
+	// REQUIRES: this node is write locked.
+	void kill();
+	bool dead() { return state_.load(std::memory_order_acquire) & kDead; }
+	// size() and writeBackSize() do not wait for a writer holding the
+	// node, they give the last size measured then.
 	size_t size();
 	void setDirty(bool dirty);
 	bool dirty();
 	size_t writeBackSize();
 	bool flushing();
 	void setFlushing(bool flushing);
+	// clean, not being flushed and not pinned.
+	bool evictable();
+	// a lock free cache hit, the CLOCK bit Cache::evictFromMemory reads.
+	void setReferenced();
+	// true if the bit was set.
+	bool clearReferenced();
 	void incRef();
 	void decRef();
 	size_t refs();
-	nid_t nid();
-	void setNid(nid_t nid);
+	// fixed before the node is published.
+	nid_t nid() { return self_; }
 	void setLeaf(bool leaf);
+	bool isLeaf() { return state_.load(std::memory_order_relaxed) & kLeaf; }
 	bool serialize(Buffer& writer);
 	bool deserialize(Buffer& reader);
 
 
 private:
-    BufferTree* tree_;
-    nid_t self_;
-    bool isLeaf_;
-    size_t refcnt_;
+    enum GetResult {
+        kFound,
+        kNotFound,
+        kRestart,
+    };
+    GetResult getOptimistic(const Slice& key, Slice& value,
+            std::vector<Slice>& operands, uint64_t snapshot, uint64_t& expiry);
+    bool resolve(const Slice& key, bool found, Slice& value,
+            const std::vector<Slice>& operands, std::string* scratch);
+    bool applyMerges(const Slice& key, const Slice* base,
+            const std::vector<Slice>& operands, std::string* result);
+    void resolveInto(const Slice& key, const Slice* base, size_t k,
+            std::vector<std::string>* values, std::vector<bool>* found,
+            std::vector<std::vector<Slice> >* operands);
+    bool needSplit();
+    bool appending();
+    void pushDownDeletes(size_t depth);
+    void mergePivots();
+    bool mergeChildren(size_t index);
+    bool canAbsorb(Node* right);
+    void absorb(Node* right, const Slice& separator);
+    void removePivot(size_t index);
+    size_t splitPoint();
+    // room for n pivots, a split is due before more than maxPivots().
+    void growPivots(size_t n);
+    size_t maxPivots();
+    size_t serializedSize();
+    MsgBuf* newBuf();
+    void insertLocked(MsgBuf* buf, const Msg& msg);
+    // a buffer the key was not in, passed by its filter or not.
+    void countFilter(bool filtered);
 
-    std::vector<Pivot> pivots_;
-    MutexLock pivotsMutex_;
-    RWLock rwlock_;
-    MutexLock mutex_;
-    bool dirty_;
-    bool flushing_;
+    // state_ packs the flags below with the refcount in the high bits.
+    enum {
+        kDirty = 1,
+        kFlushing = 2,
+        kLeaf = 4,
+        kDead = 8,
+        kReferenced = 16,
+        kRefShift = 5,
+        kRefOne = 1 << kRefShift,
+    };
+
+    BufferTree* tree_;
 	Slab* slab_;
+    PivotArray pivots_;
+    RWLock rwlock_;
+    std::atomic<uint64_t> version_;
+    std::atomic<uint32_t> state_;
+    std::atomic<size_t> bufferedSize_;
+    std::atomic<size_t> imageSize_;
+    nid_t self_;
 };
 }
 
@@ -1,6 +1,11 @@
 #ifndef __BT_OPRIONS_H
 #define __BT_OPRIONS_H
 
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <vector>
+
 namespace bt {
 
 #define SLAB_SIZE 256 * 1024 * 1024 // 256MB
@@ -9,22 +14,120 @@ namespace bt {
 typedef uint32_t nid_t;
 #define NID_NIL ((nid_t)0)
 
+class MergeOperator;
 
 class Options
 {
 public:
     Options()
     {
-        maxNodeChildNum = 4; // 16 nodes
-        maxNodeMsg = 100; // 16K, 1 node at most 256K
+        nodeSize = 4 << 20; // 4M
+        keySizeHint = 32;
+        bufferRatio = 1.0;
+        maxNodeChildNum = 0; // derived
+        maxBufferBytes = 0; // derived
+        filterBitsPerKey = 10; // ~1% false positives
+        filterBits = 0; // derived
+        rowCacheSize = 0; // off
+        mergeOperator = NULL;
         cacheLimitMem = 1 << 28; // 256M
         cacheDirtyNodeExpire = 1;
+        writeSlowdownBytes = 1 << 26; // 64M
+        writeStopBytes = 1 << 27; // 128M
+        bufferSlowdownBytes = 1 << 25; // 32M
+        bufferStopBytes = 1 << 26; // 64M
+        writeSlowdownMicros = 1000; // 1ms at most per put
+        bulkLoadFill = 0.9;
+        mergeRatio = 0.5;
+        rebalanceIntervalMs = 1000; // 1s
+        shards = 1;
     }
 
+    // node sizing, all in bytes. a node holds up to maxNodeChildNum
+    // pivots, each buffering up to maxBufferBytes of messages before it
+    // is pushed down (internal) or split (leaf). leaves split once their
+    // serialized size passes nodeSize, internal nodes past the fanout.
+    //
+    // left at 0 they are derived by sanitize(): the fanout as B^1/2,
+    // the square root of how many pivots (keySizeHint plus 8 bytes of
+    // child id and length) fit in nodeSize, the buffer as
+    // nodeSize * bufferRatio / fanout.
+    size_t nodeSize;
+    size_t keySizeHint;
+    double bufferRatio;
     size_t maxNodeChildNum;
-    size_t maxNodeMsg;
+    size_t maxBufferBytes;
+
+    // every pivot buffer keeps a bloom filter of its keys so lookups
+    // skip the buffers not holding the key. filterBits is sized for a
+    // full buffer of keySizeHint keys, 0 bits per key turns it off.
+    size_t filterBitsPerKey;
+    size_t filterBits;
+
+    // bytes of the key -> value cache gets consult before the trees,
+    // 0 turns it off.
+    size_t rowCacheSize;
+
+    // combines DB::merge operands, not owned, must outlive the DB.
+    const MergeOperator* mergeOperator;
     size_t cacheLimitMem;
     size_t cacheDirtyNodeExpire;
+
+    // write flow control: dirty node bytes not yet written back
+    // and bytes still buffered in internal nodes.
+    // puts are delayed between slowdown and stop, blocked above stop.
+    size_t writeSlowdownBytes;
+    size_t writeStopBytes;
+    size_t bufferSlowdownBytes;
+    size_t bufferStopBytes;
+    size_t writeSlowdownMicros;
+
+    // rebalancing after deletes: every rebalanceIntervalMs a background
+    // pass merges adjacent leaf pivots holding at most mergeRatio of
+    // maxBufferBytes together, sibling nodes at most mergeRatio of
+    // nodeSize (leaves) or of the fanout (internal nodes), and drops a
+    // root left with one child. only cached nodes are looked at.
+    // 0 ms turns it off.
+    double mergeRatio;
+    size_t rebalanceIntervalMs;
+
+    // DB::bulkLoad packs leaf buffers, leaves and internal nodes to this
+    // share of maxBufferBytes, nodeSize and the fanout, leaving room for
+    // later writes before they split.
+    double bulkLoadFill;
+
+    // the key space is split over shards independent BufferTrees sharing
+    // one cache, slab and layout. keys are hashed to a shard unless
+    // shardBoundaries holds (shards - 1) ascending split keys, then
+    // shard i holds [shardBoundaries[i - 1], shardBoundaries[i]).
+    size_t shards;
+    std::vector<std::string> shardBoundaries;
+
+    void sanitize()
+    {
+        if(nodeSize < 4096)
+            nodeSize = 4096;
+        if(bufferRatio <= 0)
+            bufferRatio = 1.0;
+
+        if(maxNodeChildNum == 0) {
+            double pivots = static_cast<double>(nodeSize) / (keySizeHint + 8);
+            maxNodeChildNum = static_cast<size_t>(sqrt(pivots));
+        }
+        if(maxNodeChildNum < 2)
+            maxNodeChildNum = 2;
+
+        if(maxBufferBytes == 0)
+            maxBufferBytes = static_cast<size_t>(nodeSize * bufferRatio / maxNodeChildNum);
+        if(maxBufferBytes == 0)
+            maxBufferBytes = 1;
+
+        // a message costs at least its key, type and two lengths.
+        if(filterBitsPerKey == 0)
+            filterBits = 0;
+        else if(filterBits == 0)
+            filterBits = maxBufferBytes / (keySizeHint + 12) * filterBitsPerKey;
+    }
 };
 
 }
@@ -0,0 +1,157 @@
+#include <functional>
+
+#include "RowCache.h"
+#include "Metrics.h"
+
+using namespace bt;
+
+RowCache::RowCache(size_t capacity, Metrics* metrics)
+    : capacity_(capacity),
+      stripeCapacity_(capacity / kStripes),
+      metrics_(metrics)
+{
+    for(int i = 0; i < kStripes; ++i) {
+        stripes_[i].hand = 0;
+        stripes_[i].usage = 0;
+        stripes_[i].generation = 0;
+    }
+}
+
+RowCache::~RowCache()
+{
+}
+
+// the strings and their share of the map and slot.
+size_t RowCache::charge(const Entry& entry)
+{
+    return entry.key.size() * 2 + entry.value.size() + sizeof(Entry) + 32;
+}
+
+RowCache::Stripe& RowCache::stripeFor(const std::string& key)
+{
+    return stripes_[std::hash<std::string>()(key) % kStripes];
+}
+
+bool RowCache::lookup(const Slice& key, std::string* value, uint64_t* ticket)
+{
+    std::string k(key.data(), key.size());
+    Stripe& stripe = stripeFor(k);
+
+    MutexLockGuard lock(stripe.mutex);
+    std::unordered_map<std::string, size_t>::iterator it = stripe.index.find(k);
+    if(it == stripe.index.end()) {
+        *ticket = stripe.generation;
+        metrics_->add(Metrics::kRowCacheMisses);
+        return false;
+    }
+
+    Entry& entry = stripe.entries[it->second];
+    entry.ref = true;
+    value->assign(entry.value);
+    metrics_->add(Metrics::kRowCacheHits);
+    return true;
+}
+
+void RowCache::insert(const Slice& key, const Slice& value, uint64_t ticket)
+{
+    Entry entry;
+    entry.key.assign(key.data(), key.size());
+    entry.value.assign(value.data(), value.size());
+    entry.used = true;
+    entry.ref = false;
+
+    size_t size = charge(entry);
+    if(size > stripeCapacity_)
+        return;
+
+    Stripe& stripe = stripeFor(entry.key);
+    MutexLockGuard lock(stripe.mutex);
+    // written since the miss, the value may be stale already.
+    if(stripe.generation != ticket)
+        return;
+    // another reader filled it first.
+    if(stripe.index.count(entry.key))
+        return;
+
+    // every entry is passed at most twice, once to clear its bit.
+    size_t steps = 2 * stripe.entries.size();
+    while(stripe.usage + size > stripeCapacity_ && steps--) {
+        if(stripe.hand >= stripe.entries.size())
+            stripe.hand = 0;
+        Entry& victim = stripe.entries[stripe.hand];
+        if(victim.used) {
+            if(victim.ref)
+                victim.ref = false;
+            else
+                evict(stripe, stripe.hand);
+        }
+        ++stripe.hand;
+    }
+    if(stripe.usage + size > stripeCapacity_)
+        return;
+
+    size_t slot;
+    if(!stripe.free.empty()) {
+        slot = stripe.free.back();
+        stripe.free.pop_back();
+        stripe.entries[slot].key.swap(entry.key);
+        stripe.entries[slot].value.swap(entry.value);
+        stripe.entries[slot].used = true;
+        stripe.entries[slot].ref = false;
+    } else {
+        slot = stripe.entries.size();
+        stripe.entries.push_back(entry);
+    }
+
+    stripe.index[stripe.entries[slot].key] = slot;
+    stripe.usage += size;
+}
+
+void RowCache::erase(const Slice& key)
+{
+    std::string k(key.data(), key.size());
+    Stripe& stripe = stripeFor(k);
+
+    MutexLockGuard lock(stripe.mutex);
+    ++stripe.generation;
+    std::unordered_map<std::string, size_t>::iterator it = stripe.index.find(k);
+    if(it != stripe.index.end())
+        evict(stripe, it->second);
+}
+
+void RowCache::clear()
+{
+    for(int i = 0; i < kStripes; ++i) {
+        Stripe& stripe = stripes_[i];
+        MutexLockGuard lock(stripe.mutex);
+        ++stripe.generation;
+        for(size_t slot = 0; slot < stripe.entries.size(); ++slot) {
+            if(stripe.entries[slot].used)
+                evict(stripe, slot);
+        }
+    }
+}
+
+void RowCache::evict(Stripe& stripe, size_t slot)
+{
+    assert(stripe.mutex.isLockedByThisThread());
+
+    Entry& entry = stripe.entries[slot];
+    stripe.usage -= charge(entry);
+    stripe.index.erase(entry.key);
+    entry.used = false;
+    entry.ref = false;
+    std::string().swap(entry.key);
+    std::string().swap(entry.value);
+    stripe.free.push_back(slot);
+}
+
+size_t RowCache::usage()
+{
+    size_t usage = 0;
+    for(int i = 0; i < kStripes; ++i) {
+        MutexLockGuard lock(stripes_[i].mutex);
+        usage += stripes_[i].usage;
+    }
+    return usage;
+}
@@ -0,0 +1,81 @@
+#ifndef __BT_ROWCACHE_H
+#define __BT_ROWCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/noncopyable.hpp>
+
+#include "Slice.h"
+#include "Mutex.h"
+
+namespace bt {
+
+class Metrics;
+
+// Key -> value cache in front of the trees, so a hot key is not looked
+// up root to leaf on every get.
+//
+// The budget is split over kStripes stripes picked by key hash, each
+// under its own mutex with a CLOCK hand over its entries: a hit sets
+// the entry's reference bit, the hand clears set bits and evicts the
+// first entry found clear.
+//
+// Writers erase() after their tree write. A reader that missed fills
+// the value it read from the tree only if no erase() hit the stripe
+// in between, so a racing write can not leave a stale value behind.
+class RowCache : boost::noncopyable
+{
+public:
+    RowCache(size_t capacity, Metrics* metrics);
+    ~RowCache();
+
+    // on a hit the value is copied out, on a miss ticket is what
+    // insert() needs.
+    bool lookup(const Slice& key, std::string* value, uint64_t* ticket);
+    void insert(const Slice& key, const Slice& value, uint64_t ticket);
+    void erase(const Slice& key);
+    // drops every entry, for writes that touch more keys than worth
+    // finding, like a range delete.
+    void clear();
+
+    size_t usage();
+    size_t capacity() const { return capacity_; }
+
+private:
+    static const int kStripes = 16;
+
+    struct Entry
+    {
+        std::string key;
+        std::string value;
+        bool used;
+        bool ref;
+    };
+
+    struct Stripe
+    {
+        MutexLock mutex;
+        std::unordered_map<std::string, size_t> index; // GUARDED BY mutex
+        std::vector<Entry> entries; // GUARDED BY mutex
+        std::vector<size_t> free; // GUARDED BY mutex
+        size_t hand; // GUARDED BY mutex
+        size_t usage; // GUARDED BY mutex
+        uint64_t generation; // GUARDED BY mutex
+    };
+
+    static size_t charge(const Entry& entry);
+    Stripe& stripeFor(const std::string& key);
+    // REQUIRES: stripe.mutex is held.
+    void evict(Stripe& stripe, size_t slot);
+
+    size_t capacity_;
+    size_t stripeCapacity_;
+    Metrics* metrics_;
+    Stripe stripes_[kStripes];
+};
+
+}
+
+#endif
@@ -20,6 +20,7 @@ private:
     struct Node;
 public:
     explicit SkipList(Comparator cmp, Slab* slab);
+    ~SkipList();
 
     void insert(const Key& key);
     bool contains(const Key& key) const;
@@ -79,9 +80,10 @@ struct SkipList<Key, Comparator>::Node
 {
     explicit Node(const Key& k) : key(k) { } 
     Key key;
-    Node* next(size_t n) { return next_[n]; }
-    void setNext(size_t n, Node* node) { next_[n] = node; }
-    void setKey(const Key& k) { key = k; }
+    // release/acquire so a reader without the buffer lock sees a
+    // fully built node once it is linked.
+    Node* next(size_t n) { return __atomic_load_n(&next_[n], __ATOMIC_ACQUIRE); }
+    void setNext(size_t n, Node* node) { __atomic_store_n(&next_[n], node, __ATOMIC_RELEASE); }
 
 private:
     Node* next_[1];
@@ -206,7 +208,7 @@ typename SkipList<Key, Comparator>::Node*
 SkipList<Key, Comparator>::findGreaterOrEqual(const Key& key, Node** prev) const
 {
     Node* curr = head_;
-    size_t level = maxHeight_ - 1;
+    size_t level = __atomic_load_n(&maxHeight_, __ATOMIC_RELAXED) - 1;
 
     while (true) {
         Node* next = curr->next(level);
@@ -230,7 +232,7 @@ typename SkipList<Key, Comparator>::Node*
 SkipList<Key, Comparator>::findLessThan(const Key& key) const
 {
     Node* curr = head_;
-    size_t level = maxHeight_ - 1;
+    size_t level = __atomic_load_n(&maxHeight_, __ATOMIC_RELAXED) - 1;
 
     while (true) {
         Node* next = curr->next(level);
@@ -260,33 +262,53 @@ SkipList<Key, Comparator>::SkipList(Comparator cmp, Slab* slab)
 }
 
 
+template<class Key, class Comparator>
+SkipList<Key, Comparator>::~SkipList()
+{
+    clear();
+    slab_->retire((void*)head_);
+}
+
 template<class Key, class Comparator>
 void SkipList<Key, Comparator>::insert(const Key& key)
 {
     Node* prev[kMaxHeight];
     Node* next = findGreaterOrEqual(key, prev);
 
+    if (next && equal(next->key, key)) {
+        // a copy takes its place on every level it is linked on, lock
+        // free readers see one node or the other whole.
+        size_t height = 0;
+        while (height < maxHeight_ && prev[height]->next(height) == next)
+            height++;
+
+        Node* curr = newNode(key, height);
+        for (size_t i = 0; i < height; i++)
+            curr->setNext(i, next->next(i));
+        for (size_t i = 0; i < height; i++)
+            prev[i]->setNext(i, curr);
+
+        slab_->retire((void*)next);
+        return;
+    }
+
     size_t height = randomHeight();
 
     if (height > maxHeight_) {
         for (size_t i = maxHeight_; i < height; i++)
             prev[i] = head_;
 
-        maxHeight_ = height;
+        __atomic_store_n(&maxHeight_, height, __ATOMIC_RELAXED);
     }
 
-    if (next && equal(next->key, key)) {
-        next->setKey(key);
-    } else {
-        Node* curr = newNode(key, height);
+    Node* curr = newNode(key, height);
 
-        for (size_t i = 0; i < height; i++) {
-            curr->setNext(i, prev[i]->next(i));
-            prev[i]->setNext(i, curr);
-        }
-
-        count_++;
+    for (size_t i = 0; i < height; i++) {
+        curr->setNext(i, prev[i]->next(i));
+        prev[i]->setNext(i, curr);
     }
+
+    count_++;
 }
 
 template<class Key, class Comparator>
@@ -314,8 +336,8 @@ void SkipList<Key, Comparator>::erase(const Key& key)
             prev[i]->setNext(i, curr->next(i));
     }
 	
-	LOGFMTI("SkipList<Key, Comparator>::erase node %p", curr);
-	slab_->free((void*)curr);
+	LOGFMTT("SkipList<Key, Comparator>::erase node %p", curr);
+	slab_->retire((void*)curr);
 
     count_--;
 }
@@ -350,13 +372,14 @@ void SkipList<Key, Comparator>::clear()
 {
 	
     //slab_->clear();
-    Node* node = head_;
+    Node* node = head_->next(0);
 	Node* next;
 	//LOGFMTI("SkipList<Key, Comparator>::clear head_ %p", head_);
-	for(size_t i = 0; i < count_; i++) {
-		//LOGFMTI("SkipList<Key, Comparator>::clear node %p", node->next(0));
+	// nodes are retired, lock free readers may still be walking them.
+	while(node != NULL) {
+		//LOGFMTI("SkipList<Key, Comparator>::clear node %p", node);
 		next = node->next(0);
-		slab_->free((void*)node->next(0));
+		slab_->retire((void*)node);
 		node = next;
 	}
 	
@@ -366,7 +389,7 @@ void SkipList<Key, Comparator>::clear()
         head_->setNext(i, NULL);
 
     count_ = 0;
-    maxHeight_ = 1;
+    __atomic_store_n(&maxHeight_, 1, __ATOMIC_RELAXED);
 }
 
 }
@@ -46,7 +46,9 @@
 using namespace bt;
 
 Slab::Slab()
-    : minSize_(0),
+    : mutex_(),
+      epoch_(),
+      minSize_(0),
       minShift_(3),
       pages_(0),
       last_(0),
@@ -66,6 +68,8 @@ Slab::Slab()
 
 Slab::~Slab()
 {
+    // retired chunks point into this slab.
+    epoch_.synchronize();
     free(addr_);
 }
 
@@ -128,6 +132,7 @@ bool Slab::clear()
 
 void* Slab::alloc(uint32_t size)
 {
+    MutexLockGuard lock(mutex_);
     void* p = allocLocked(size);
     return p;
 }
@@ -362,9 +367,20 @@ Page* Slab::allocPages(uint32_t pages)
 
 void Slab::free(void* p)
 {
+    MutexLockGuard lock(mutex_);
     freeLocked(p);
 }
 
+static void freeRetired(void* slab, void* p)
+{
+    static_cast<Slab*>(slab)->free(p);
+}
+
+void Slab::retire(void* p)
+{
+    epoch_.retire(freeRetired, this, p);
+}
+
 void Slab::freeLocked(void* p)
 {
     size_t size;
@@ -5,6 +5,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "Mutex.h"
+#include "Epoch.h"
+
 namespace bt {
 
 struct Page
@@ -29,10 +32,15 @@ public:
 	Page* allocPages(uint32_t pages);
     void free(void* p);
     void freeLocked(void* p);
+    // free p once no thread inside an epoch can still reach it.
+    void retire(void* p);
+    EpochManager* epoch() { return &epoch_; }
 	void freePages(Page* page, uint32_t pages);
     void slabStat();
 private:
     //struct Stat stat_;
+    MutexLock mutex_;
+    EpochManager epoch_;
 
     uint32_t minSize_;
     uint32_t minShift_;
@@ -0,0 +1,50 @@
+#include <algorithm>
+
+#include "SnapshotList.h"
+#include "Msg.h"
+
+using namespace bt;
+
+SnapshotList::SnapshotList()
+    : last_(0),
+      mutex_(),
+      live_(),
+      oldest_(kMaxSequence)
+{
+}
+
+const Snapshot* SnapshotList::acquire()
+{
+    MutexLockGuard lock(mutex_);
+    // lowered before the sequence is read. a writer stamped after it
+    // then finds oldest() below its stamp and asks live_, under mutex_.
+    uint64_t bound = std::min(oldest(), last());
+    oldest_.store(bound);
+    uint64_t sequence = last();
+    live_.insert(sequence);
+    oldest_.store(*live_.begin());
+    return new Snapshot(sequence);
+}
+
+void SnapshotList::release(const Snapshot* snapshot)
+{
+    {
+    MutexLockGuard lock(mutex_);
+    std::multiset<uint64_t>::iterator it = live_.find(snapshot->sequence());
+    assert(it != live_.end());
+    live_.erase(it);
+    oldest_.store(live_.empty() ? kMaxSequence : *live_.begin());
+    }
+    delete snapshot;
+}
+
+bool SnapshotList::pinned(uint64_t older, uint64_t newer) const
+{
+    // every snapshot is at least as new as newer, the common case.
+    if(oldest() >= newer)
+        return false;
+
+    MutexLockGuard lock(mutex_);
+    std::multiset<uint64_t>::const_iterator it = live_.lower_bound(older);
+    return it != live_.end() && *it < newer;
+}
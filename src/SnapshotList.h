@@ -0,0 +1,49 @@
+#ifndef __BT_SNAPSHOTLIST_H
+#define __BT_SNAPSHOTLIST_H
+
+#include <stdint.h>
+#include <set>
+#include <atomic>
+#include <boost/noncopyable.hpp>
+
+#include "Mutex.h"
+#include "Snapshot.h"
+
+namespace bt {
+
+// Hands out the sequence numbers stamped on every message and keeps the
+// live snapshots, so buffers know which older versions are still read.
+//
+// A message is stamped under the lock of the buffer it goes into. A
+// snapshot taken after the stamp reads that buffer only once the
+// writer let go of it, with the message in place.
+class SnapshotList : boost::noncopyable
+{
+public:
+    SnapshotList();
+
+    // the sequence number of a new write, the first is 1.
+    uint64_t next() { return last_.fetch_add(1) + 1; }
+    uint64_t last() const { return last_.load(); }
+
+    const Snapshot* acquire();
+    void release(const Snapshot* snapshot);
+
+    // a live snapshot sees the version written at older but not the
+    // one written at newer, the older one has to be kept.
+    bool pinned(uint64_t older, uint64_t newer) const;
+    // of the oldest live snapshot, kMaxSequence if there is none. the
+    // versions up to it are the same for every snapshot.
+    uint64_t oldest() const { return oldest_.load(); }
+
+private:
+    // sequentially consistent, see acquire().
+    std::atomic<uint64_t> last_;
+    mutable MutexLock mutex_;
+    std::multiset<uint64_t> live_; // GUARDED BY mutex_
+    std::atomic<uint64_t> oldest_;
+};
+
+}
+
+#endif
@@ -0,0 +1,98 @@
+#include <assert.h>
+
+#include "SortedRun.h"
+#include "coding.h"
+
+using namespace bt;
+
+SortedRun::SortedRun()
+    : data_(),
+      offsets_()
+{
+}
+
+void SortedRun::append(const Slice& key, const Slice& value, uint64_t expiry)
+{
+    assert(count() == 0 || this->key(count() - 1).compare(key) < 0);
+    assert(value.size() < kExpires);
+
+    char buf[8];
+    offsets_.push_back(data_.size());
+    EncodeFixed32(buf, key.size());
+    data_.append(buf, 4);
+    data_.append(key.data(), key.size());
+    EncodeFixed32(buf, expiry ? value.size() | kExpires : value.size());
+    data_.append(buf, 4);
+    data_.append(value.data(), value.size());
+    if(expiry) {
+        EncodeFixed64(buf, expiry);
+        data_.append(buf, 8);
+    }
+}
+
+SortedRun* SortedRun::decode(const char* data, size_t size)
+{
+    SortedRun* run = new SortedRun();
+    run->data_.assign(data, size);
+
+    size_t pos = 0;
+    while(pos + 8 <= size) {
+        run->offsets_.push_back(pos);
+        pos += 4 + DecodeFixed32(data + pos);
+        uint32_t valueSize = DecodeFixed32(data + pos);
+        pos += 4 + (valueSize & ~kExpires) + (valueSize & kExpires ? 8 : 0);
+    }
+    assert(pos == size);
+    return run;
+}
+
+void SortedRun::destroy(void* arg, void* ptr)
+{
+    delete static_cast<SortedRun*>(ptr);
+}
+
+Slice SortedRun::key(size_t i) const
+{
+    const char* p = data_.data() + offsets_[i];
+    return Slice(const_cast<char*>(p + 4), DecodeFixed32(p));
+}
+
+Slice SortedRun::value(size_t i) const
+{
+    const char* p = data_.data() + offsets_[i];
+    p += 4 + DecodeFixed32(p);
+    return Slice(const_cast<char*>(p + 4), DecodeFixed32(p) & ~kExpires);
+}
+
+uint64_t SortedRun::expiry(size_t i) const
+{
+    const char* p = data_.data() + offsets_[i];
+    p += 4 + DecodeFixed32(p);
+    uint32_t size = DecodeFixed32(p);
+    if(!(size & kExpires))
+        return 0;
+    return DecodeFixed64(p + 4 + (size & ~kExpires));
+}
+
+size_t SortedRun::lowerBound(const Slice& key) const
+{
+    size_t lo = 0, hi = count();
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(this->key(mid).compare(key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool SortedRun::find(const Slice& key, Slice* value, uint64_t* expiry) const
+{
+    size_t i = lowerBound(key);
+    if(i == count() || this->key(i).compare(key) != 0)
+        return false;
+    *value = this->value(i);
+    *expiry = this->expiry(i);
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef __BT_SORTEDRUN_H
+#define __BT_SORTEDRUN_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "Slice.h"
+
+namespace bt {
+
+// Immutable sorted key/value pairs, the compacted base of a leaf MsgBuf.
+//
+// The pairs are packed back to back in one block as
+// [fixed32 key size][key][fixed32 value size][value], which is also
+// their on disk form, plus an offset per pair for binary search. A
+// value that expires has the top bit of its size set and its fixed64
+// expiry after it. A run is only appended to before it is published,
+// lock free readers then share it until it is retired through the
+// epoch.
+class SortedRun : boost::noncopyable
+{
+public:
+    SortedRun();
+
+    // REQUIRES: key is greater than every key appended before.
+    void append(const Slice& key, const Slice& value, uint64_t expiry = 0);
+    // rebuilds a run from the block of data().
+    static SortedRun* decode(const char* data, size_t size);
+    // EpochManager::Deleter.
+    static void destroy(void* arg, void* ptr);
+
+    size_t count() const { return offsets_.size(); }
+    // bytes of the block.
+    size_t size() const { return data_.size(); }
+    size_t memUsage() const { return sizeof(SortedRun) + data_.capacity() + offsets_.capacity() * 4; }
+    const char* data() const { return data_.data(); }
+
+    Slice key(size_t i) const;
+    Slice value(size_t i) const;
+    // 0 if the value does not expire.
+    uint64_t expiry(size_t i) const;
+    // index of the first key not less than key, count() if none.
+    size_t lowerBound(const Slice& key) const;
+    bool find(const Slice& key, Slice* value, uint64_t* expiry) const;
+
+private:
+    static const uint32_t kExpires = 1U << 31;
+
+    std::string data_;
+    std::vector<uint32_t> offsets_;
+};
+
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include <vector>
+
+#include "TransactionImpl.h"
+#include "DBImpl.h"
+
+using namespace bt;
+
+TransactionImpl::TransactionImpl(DBImpl* db, const Snapshot* snapshot)
+    : db_(db),
+      snapshot_(snapshot),
+      reads_(),
+      writes_()
+{
+}
+
+TransactionImpl::~TransactionImpl()
+{
+    if(snapshot_)
+        db_->releaseSnapshot(snapshot_);
+}
+
+bool TransactionImpl::get(Slice& key, std::string* value)
+{
+    std::string k(key.data(), key.size());
+    std::map<std::string, Write>::iterator it = writes_.find(k);
+    if(it != writes_.end()) {
+        if(it->second.type != Put)
+            return false;
+        *value = it->second.value;
+        return true;
+    }
+
+    reads_.insert(k);
+    return db_->get(key, value, snapshot_);
+}
+
+void TransactionImpl::put(Slice& key, Slice& value)
+{
+    Write& w = writes_[std::string(key.data(), key.size())];
+    w.type = Put;
+    w.value.assign(value.data(), value.size());
+}
+
+void TransactionImpl::del(Slice& key)
+{
+    Write& w = writes_[std::string(key.data(), key.size())];
+    w.type = Del;
+    w.value.clear();
+}
+
+bool TransactionImpl::commit()
+{
+    if(!snapshot_)
+        return false;
+
+    // the slices point into reads_ and writes_, which outlive the call.
+    std::vector<Slice> reads;
+    std::vector<Msg> writes;
+    reads.reserve(reads_.size());
+    for(std::set<std::string>::iterator it = reads_.begin(); it != reads_.end(); ++it)
+        reads.push_back(Slice(const_cast<std::string&>(*it)));
+    writes.reserve(writes_.size());
+    for(std::map<std::string, Write>::iterator it = writes_.begin(); it != writes_.end(); ++it)
+        writes.push_back(Msg(it->second.type, Slice(const_cast<std::string&>(it->first)),
+                    Slice(it->second.value)));
+
+    bool ok = db_->commit(reads, writes, snapshot_->sequence());
+    db_->releaseSnapshot(snapshot_);
+    snapshot_ = NULL;
+    return ok;
+}
@@ -0,0 +1,49 @@
+#ifndef __BT_TRANSACTIONIMPL_H
+#define __BT_TRANSACTIONIMPL_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <boost/noncopyable.hpp>
+
+#include "Transaction.h"
+#include "Msg.h"
+
+namespace bt {
+
+class DBImpl;
+class Snapshot;
+
+// Keeps the keys read and the last write of each key until commit,
+// then hands them to DBImpl::commit, which checks that no key read has
+// a write newer than the snapshot. Nothing is locked before commit.
+class TransactionImpl : public Transaction, boost::noncopyable
+{
+public:
+    TransactionImpl(DBImpl* db, const Snapshot* snapshot);
+    ~TransactionImpl();
+
+    bool get(Slice& key, std::string* value);
+    void put(Slice& key, Slice& value);
+    void del(Slice& key);
+    bool commit();
+
+private:
+    struct Write
+    {
+        Write() : type(Nop), value() {}
+
+        MsgType type;
+        std::string value;
+    };
+
+    DBImpl* db_;
+    // NULL once committed.
+    const Snapshot* snapshot_;
+    std::set<std::string> reads_;
+    std::map<std::string, Write> writes_;
+};
+
+}
+
+#endif
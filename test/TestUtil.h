@@ -0,0 +1,96 @@
+#ifndef __BT_TEST_UTIL_H
+#define __BT_TEST_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "DB.h"
+#include "MergeOperator.h"
+
+// helpers shared by the tests.
+
+// unlike assert() it stays in release builds, the calls it wraps run
+// whatever NDEBUG says.
+#define CHECK(cond) \
+do { \
+    if(!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        abort(); \
+    } \
+} while(0)
+
+// keys sort like their numbers.
+inline std::string keyOf(int i)
+{
+    char k[32];
+    snprintf(k, sizeof(k), "key_%06d", i);
+    return k;
+}
+
+// small nodes and cache, the messages get pushed down and evicted.
+inline bt::Options smallOptions()
+{
+    bt::Options opts;
+    opts.nodeSize = 4096;
+    opts.cacheLimitMem = 64 << 10;
+    return opts;
+}
+
+// a "name: value" line of a getProperty() text.
+inline uint64_t statOf(bt::DB* db, const char* property, const char* name)
+{
+    std::string stats;
+    CHECK(db->getProperty(property, &stats));
+    std::string line = std::string("\n") + name + ": ";
+    stats.insert(0, "\n");
+    size_t pos = stats.find(line);
+    CHECK(pos != std::string::npos);
+    return strtoull(stats.c_str() + pos + line.size(), NULL, 10);
+}
+
+// a counter of "bt.stats".
+inline uint64_t ticker(bt::DB* db, const char* name)
+{
+    return statOf(db, "bt.stats", name);
+}
+
+// keyOf(0) ... keyOf(n - 1), each valued prefix + key.
+inline void putAll(bt::DB* db, int n, const std::string& prefix = std::string())
+{
+    for(int i = 0; i < n; i++) {
+        std::string k = keyOf(i), v = prefix + k;
+        bt::Slice key(k), value(v);
+        CHECK(db->put(key, value));
+    }
+}
+
+inline bool getValue(bt::DB* db, const std::string& k, std::string* value)
+{
+    bt::Slice key(const_cast<char*>(k.data()), k.size());
+    return db->get(key, value);
+}
+
+// appends the operand to the value, comma separated.
+class AppendOperator : public bt::MergeOperator
+{
+public:
+    bool merge(const bt::Slice& key, const bt::Slice* existing,
+            const bt::Slice& operand, std::string* result) const
+    {
+        result->clear();
+        if(existing && existing->size()) {
+            result->assign(existing->data(), existing->size());
+            result->append(",");
+        }
+        result->append(operand.data(), operand.size());
+        return true;
+    }
+
+    const char* name() const { return "append"; }
+};
+
+#endif
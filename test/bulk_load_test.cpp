@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+typedef std::vector<std::pair<std::string, std::string> > Pairs;
+
+class PairIterator : public Iterator
+{
+public:
+    explicit PairIterator(Pairs* pairs) : pairs_(pairs), i_(0) {}
+
+    bool valid() const { return i_ < pairs_->size(); }
+    Slice key() const { return Slice((*pairs_)[i_].first); }
+    Slice value() const { return Slice((*pairs_)[i_].second); }
+    void next() { i_++; }
+
+private:
+    Pairs* pairs_;
+    size_t i_;
+};
+
+// the even keys, the odd ones are left for gets to miss.
+static Pairs evenPairs(int n)
+{
+    Pairs pairs;
+    for(int i = 0; i < n; i += 2)
+        pairs.push_back(std::make_pair(keyOf(i), "value_" + keyOf(i)));
+    return pairs;
+}
+
+static void checkLoaded(DB* db, int n)
+{
+    std::string ret;
+    for(int i = 0; i < n; i++) {
+        std::string k = keyOf(i);
+        bool loaded = i % 2 == 0;
+        CHECK(getValue(db, k, &ret) == loaded);
+        if(loaded)
+            CHECK(ret == "value_" + k);
+    }
+}
+
+void testBulkLoad(size_t shards)
+{
+    Options opts;
+    // small nodes build a tree of several levels.
+    opts.nodeSize = 4096;
+    opts.shards = shards;
+    DB* db = DB::open("bulk_load_test", opts);
+
+    const int N = 40000;
+
+    // keys out of order fail past the first written nodes, and leave
+    // nothing behind.
+    Pairs unsorted = evenPairs(N);
+    unsorted.push_back(std::make_pair(keyOf(1), std::string("late")));
+    PairIterator bad(&unsorted);
+    CHECK(!db->bulkLoad(&bad));
+    std::string ret;
+    for(int i = 0; i < N; i += 97)
+        CHECK(!getValue(db, keyOf(i), &ret));
+
+    Pairs pairs = evenPairs(N);
+    PairIterator iter(&pairs);
+    CHECK(db->bulkLoad(&iter));
+    checkLoaded(db, N);
+
+    // a second load finds the DB not empty.
+    PairIterator again(&pairs);
+    CHECK(!db->bulkLoad(&again));
+    checkLoaded(db, N);
+
+    // the loaded trees take writes like any other.
+    for(int i = 1; i < N; i += 2) {
+        std::string k = keyOf(i), v = "value_" + k;
+        Slice key(k), value(v);
+        CHECK(db->put(key, value));
+    }
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        CHECK(getValue(db, k, &ret));
+        CHECK(ret == "value_" + k);
+    }
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testBulkLoad(1);
+    testBulkLoad(3);
+
+    printf("bulk_load_test passed\n");
+    return 0;
+}
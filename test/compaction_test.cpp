@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int N = 10000;
+
+void testLeafCompaction()
+{
+    DB* db = DB::open("compaction_test", smallOptions());
+
+    // every key overwritten, then half of them deleted: the leaves hold
+    // dead versions and tombstones to drop.
+    putAll(db, N, "old_");
+    putAll(db, N, "new_");
+    for(int i = 0; i < N; i += 2) {
+        std::string k = keyOf(i);
+        Slice key(k);
+        CHECK(db->del(key));
+    }
+    putAll(db, N / 2, "last_");
+
+    std::string ret;
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        bool found = getValue(db, k, &ret);
+        if(i < N / 2) {
+            CHECK(found);
+            CHECK(ret == "last_" + k);
+        } else if(i % 2 == 0) {
+            CHECK(!found);
+        } else {
+            CHECK(found);
+            CHECK(ret == "new_" + k);
+        }
+    }
+    CHECK(ticker(db, "leaf_compactions") > 0);
+    CHECK(ticker(db, "compaction_dropped_bytes") > 0);
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testLeafCompaction();
+
+    printf("compaction_test passed\n");
+    return 0;
+}
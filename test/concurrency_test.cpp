@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "Thread.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int kKeys = 2000;
+static const int kWriters = 4;
+static const int kReaders = 4;
+static const int kOps = 10000;
+
+// a value names its key and the write, a torn read shows as another key.
+static std::string valueOf(const std::string& k, int op)
+{
+    char v[64];
+    snprintf(v, sizeof(v), "%s:%d", k.c_str(), op);
+    return v;
+}
+
+static bool sameKey(const std::string& value, const std::string& k)
+{
+    return value.size() > k.size() && value.compare(0, k.size(), k) == 0
+        && value[k.size()] == ':';
+}
+
+// writer w owns the keys i % kWriters == w, last[i] is the value it
+// left there, empty if deleted.
+static void writer(DB* db, int w, std::vector<std::string>* last)
+{
+    unsigned int seed = w;
+    for(int op = 0; op < kOps; op++) {
+        int i = rand_r(&seed) % (kKeys / kWriters) * kWriters + w;
+        std::string k = keyOf(i);
+        Slice key(k);
+        if(op % 5 == 4) {
+            CHECK(db->del(key));
+            (*last)[i].clear();
+        } else {
+            std::string v = valueOf(k, op);
+            Slice value(v);
+            CHECK(db->put(key, value));
+            (*last)[i] = v;
+        }
+    }
+}
+
+static void reader(DB* db, int r, std::atomic<bool>* stop, std::atomic<int>* bad)
+{
+    unsigned int seed = 100 + r;
+    std::string ret;
+    while(!stop->load()) {
+        std::string k = keyOf(rand_r(&seed) % kKeys);
+        if(getValue(db, k, &ret) && !sameKey(ret, k))
+            bad->fetch_add(1);
+    }
+}
+
+void testConcurrentWrites()
+{
+    // small nodes split under the readers.
+    DB* db = DB::open("concurrency_test", smallOptions());
+
+    std::vector<std::string> last(kKeys);
+    std::atomic<bool> stop(false);
+    std::atomic<int> bad(0);
+    std::vector<Thread*> writers, readers;
+    for(int r = 0; r < kReaders; r++) {
+        readers.push_back(new Thread(boost::bind(reader, db, r, &stop, &bad)));
+        readers.back()->start();
+    }
+    for(int w = 0; w < kWriters; w++) {
+        writers.push_back(new Thread(boost::bind(writer, db, w, &last)));
+        writers.back()->start();
+    }
+
+    for(int w = 0; w < kWriters; w++) {
+        writers[w]->join();
+        delete writers[w];
+    }
+    stop.store(true);
+    for(int r = 0; r < kReaders; r++) {
+        readers[r]->join();
+        delete readers[r];
+    }
+    CHECK(bad.load() == 0);
+
+    std::string ret;
+    for(int i = 0; i < kKeys; i++) {
+        std::string k = keyOf(i);
+        bool live = !last[i].empty();
+        CHECK(getValue(db, k, &ret) == live);
+        if(live)
+            CHECK(ret == last[i]);
+    }
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testConcurrentWrites();
+
+    printf("concurrency_test passed\n");
+    return 0;
+}
@@ -0,0 +1,864 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <boost/bind.hpp>
+
+#include "Options.h"
+#include "Logger.h"
+#include "Layout.h"
+#include "Metrics.h"
+#include "Thread.h"
+#include "DB.h"
+#include "MergeOperator.h"
+
+using namespace bt;
+
+// Comma separated list of benchmarks to run in order:
+//   fillseq          write num keys in sequential order into a fresh db
+//   fillrandom       write num keys in random order into a fresh db
+//   bulkload         load num keys in sequential order into a fresh db
+//                    with DB::bulkLoad
+//   overwrite        overwrite num random keys
+//   readrandom       read reads random keys
+//   multireadrandom  readrandom in multiGet batches of batch_size keys
+//   readseq          read reads keys in key order
+//   readwhilewriting readrandom while one extra thread keeps writing
+//   deleterandom     delete num random keys
+//   mergerandom      add 1 to num random 8 byte counters with merge
+//   txnrandom        move 1 between two of num random 8 byte counters
+//                    in a transaction, again until it commits
+//   deleterange      delete the num keys in ranges of scan_length keys
+//   ycsba .. ycsbf   YCSB core workloads over num records
+//
+// there is no iterator yet, readseq and the scans of ycsbe are point
+// gets of consecutive keys.
+static const char* FLAGS_benchmarks =
+    "fillseq,fillrandom,overwrite,readrandom,readseq,readwhilewriting,"
+    "deleterandom,ycsba,ycsbb,ycsbc,ycsbd,ycsbe,ycsbf";
+
+static long FLAGS_num = 100000;
+// operations per read benchmark, < 0 means num.
+static long FLAGS_reads = -1;
+static int FLAGS_threads = 1;
+static int FLAGS_key_size = 16;
+static int FLAGS_value_size = 100;
+// zipfian constant of random keys, 0 is uniform. ycsb uses 0.99
+// unless it is set.
+static double FLAGS_zipf = 0;
+static int FLAGS_scan_length = 100;
+static int FLAGS_batch_size = 100;
+static uint64_t FLAGS_seed = 301;
+// seconds the written values live, 0 never expire.
+static long FLAGS_ttl = 0;
+static const char* FLAGS_db = "bench";
+
+// Options overrides, < 0 keeps the default.
+static long FLAGS_node_size = -1;
+static long FLAGS_fanout = -1;
+static long FLAGS_buffer_bytes = -1;
+static long FLAGS_cache_mb = -1;
+static long FLAGS_row_cache_mb = -1;
+static long FLAGS_shards = -1;
+static long FLAGS_rebalance_ms = -1;
+
+namespace {
+
+// little endian uint64 counters.
+class AddOperator : public MergeOperator
+{
+public:
+    bool merge(const Slice& key, const Slice* existing,
+            const Slice& operand, std::string* result) const
+    {
+        uint64_t sum = decode(operand);
+        if(existing)
+            sum += decode(*existing);
+        result->assign(reinterpret_cast<const char*>(&sum), sizeof(sum));
+        return true;
+    }
+
+    const char* name() const { return "add"; }
+
+private:
+    static uint64_t decode(const Slice& s)
+    {
+        uint64_t n = 0;
+        memcpy(&n, s.data(), std::min(s.size(), sizeof(n)));
+        return n;
+    }
+};
+
+AddOperator addOperator;
+
+class Random
+{
+public:
+    explicit Random(uint64_t seed)
+        : state_(seed ? seed : 88172645463325252ULL)
+    {}
+
+    // xorshift64*
+    uint64_t next()
+    {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 2685821657736338717ULL;
+    }
+
+    uint64_t uniform(uint64_t n) { return next() % n; }
+    double nextDouble() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+    uint64_t state_;
+};
+
+uint64_t fnv64(uint64_t v)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(int i = 0; i < 8; ++i) {
+        h ^= v & 0xff;
+        h *= 1099511628211ULL;
+        v >>= 8;
+    }
+    return h;
+}
+
+// Gray et al, "Quickly generating billion-record synthetic databases",
+// the same generator YCSB uses. rank 0 is the most popular.
+class Zipfian
+{
+public:
+    Zipfian(uint64_t n, double theta)
+        : n_(n), theta_(theta)
+    {
+        double zeta2 = zeta(2, theta);
+        zetan_ = zeta(n, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan_);
+    }
+
+    uint64_t next(Random& rnd) const
+    {
+        double u = rnd.nextDouble();
+        double uz = u * zetan_;
+        if(uz < 1.0)
+            return 0;
+        if(uz < 1.0 + pow(0.5, theta_))
+            return 1;
+        uint64_t v = static_cast<uint64_t>(n_ * pow(eta_ * u - eta_ + 1, alpha_));
+        return v < n_ ? v : n_ - 1;
+    }
+
+    // popular keys spread over the key space instead of clustering at 0.
+    uint64_t nextScrambled(Random& rnd) const
+    {
+        return fnv64(next(rnd)) % n_;
+    }
+
+private:
+    static double zeta(uint64_t n, double theta)
+    {
+        double sum = 0;
+        for(uint64_t i = 1; i <= n; ++i)
+            sum += 1.0 / pow(static_cast<double>(i), theta);
+        return sum;
+    }
+
+    uint64_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+struct ThreadState
+{
+    int tid;
+    Random rnd;
+    uint64_t start;
+    uint64_t finish;
+    long done;
+    long reads;
+    long found;
+    int64_t bytes;
+
+    ThreadState(int id, uint64_t seed)
+        : tid(id), rnd(seed),
+          start(0), finish(0), done(0), reads(0), found(0), bytes(0)
+    {}
+};
+
+class Benchmark
+{
+public:
+    typedef void (Benchmark::*Method)(ThreadState*);
+
+    Benchmark()
+        : db_(NULL),
+          metrics_(NULL),
+          zipf_(NULL),
+          zipfTheta_(0),
+          reads_(FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads),
+          records_(0),
+          workload_(0),
+          runs_(0),
+          inserted_(0),
+          readersDone_(0),
+          writerDone_(false)
+    {
+        Random rnd(FLAGS_seed);
+        values_.resize(1 << 20);
+        for(size_t i = 0; i < values_.size(); ++i)
+            values_[i] = static_cast<char>(' ' + rnd.uniform(95));
+    }
+
+    ~Benchmark()
+    {
+        delete db_;
+        delete zipf_;
+    }
+
+    void run()
+    {
+        printHeader();
+        open(true);
+
+        const char* p = FLAGS_benchmarks;
+        while(*p) {
+            const char* sep = strchr(p, ',');
+            std::string name = sep ? std::string(p, sep - p) : std::string(p);
+            p = sep ? sep + 1 : p + name.size();
+            if(!name.empty())
+                runOne(name);
+        }
+    }
+
+private:
+    void printHeader()
+    {
+        fprintf(stdout, "Keys:       %d bytes each\n", FLAGS_key_size);
+        fprintf(stdout, "Values:     %d bytes each\n", FLAGS_value_size);
+        fprintf(stdout, "Entries:    %ld\n", FLAGS_num);
+        fprintf(stdout, "RawSize:    %.1f MB (estimated)\n",
+                (FLAGS_key_size + FLAGS_value_size) * FLAGS_num / 1048576.0);
+        fprintf(stdout, "Threads:    %d\n", FLAGS_threads);
+        fprintf(stdout, "Zipf:       %.2f\n", FLAGS_zipf);
+        fprintf(stdout, "------------------------------------------------\n");
+    }
+
+    void open(bool fresh)
+    {
+        delete db_;
+        db_ = NULL;
+
+        if(fresh) {
+            std::string name(FLAGS_db);
+            unlink((std::string(DATA_PATH) + name + "_0").c_str());
+            unlink((std::string(META_PATH) + name).c_str());
+        }
+
+        Options opts;
+        opts.mergeOperator = &addOperator;
+        opts.keySizeHint = FLAGS_key_size;
+        if(FLAGS_node_size >= 0)
+            opts.nodeSize = FLAGS_node_size;
+        if(FLAGS_fanout >= 0)
+            opts.maxNodeChildNum = FLAGS_fanout;
+        if(FLAGS_buffer_bytes >= 0)
+            opts.maxBufferBytes = FLAGS_buffer_bytes;
+        if(FLAGS_cache_mb >= 0)
+            opts.cacheLimitMem = FLAGS_cache_mb << 20;
+        if(FLAGS_row_cache_mb >= 0)
+            opts.rowCacheSize = FLAGS_row_cache_mb << 20;
+        if(FLAGS_shards >= 0)
+            opts.shards = FLAGS_shards;
+        if(FLAGS_rebalance_ms >= 0)
+            opts.rebalanceIntervalMs = FLAGS_rebalance_ms;
+
+        db_ = DB::open(FLAGS_db, opts);
+        if(db_ == NULL) {
+            fprintf(stderr, "open db %s failed\n", FLAGS_db);
+            exit(1);
+        }
+        records_ = 0;
+    }
+
+    void runOne(const std::string& name)
+    {
+        Method method = NULL;
+        bool fresh = false;
+        double theta = FLAGS_zipf;
+
+        if(name == "fillseq") {
+            fresh = true;
+            method = &Benchmark::fillSeq;
+        } else if(name == "fillrandom") {
+            fresh = true;
+            method = &Benchmark::fillRandom;
+        } else if(name == "bulkload") {
+            fresh = true;
+            method = &Benchmark::bulkLoad;
+        } else if(name == "overwrite") {
+            method = &Benchmark::fillRandom;
+        } else if(name == "readrandom") {
+            method = &Benchmark::readRandom;
+        } else if(name == "multireadrandom") {
+            method = &Benchmark::multiReadRandom;
+        } else if(name == "readseq") {
+            method = &Benchmark::readSeq;
+        } else if(name == "readwhilewriting") {
+            method = &Benchmark::readWhileWriting;
+        } else if(name == "mergerandom") {
+            method = &Benchmark::mergeRandom;
+        } else if(name == "txnrandom") {
+            method = &Benchmark::txnRandom;
+        } else if(name == "deleterandom") {
+            method = &Benchmark::deleteRandom;
+        } else if(name == "deleterange") {
+            method = &Benchmark::deleteRange;
+        } else if(name.size() == 5 && name.compare(0, 4, "ycsb") == 0
+                && name[4] >= 'a' && name[4] <= 'f') {
+            workload_ = name[4];
+            method = &Benchmark::ycsb;
+            if(theta == 0)
+                theta = 0.99;
+        } else {
+            fprintf(stderr, "unknown benchmark '%s'\n", name.c_str());
+            return;
+        }
+
+        if(fresh)
+            open(true);
+        // the ycsb workloads expect every record to be loaded.
+        if(method == &Benchmark::ycsb && records_ < FLAGS_num) {
+            runThreads(&Benchmark::fillSeq, NULL);
+            records_ = FLAGS_num;
+        }
+
+        // zeta(num) is O(num), keep the generator while theta stays.
+        if(theta != zipfTheta_) {
+            delete zipf_;
+            zipf_ = theta > 0 ? new Zipfian(FLAGS_num, theta) : NULL;
+            zipfTheta_ = theta;
+        }
+        readersDone_ = 0;
+        writerDone_ = false;
+
+        Metrics metrics;
+        runThreads(method, &metrics);
+        report(name, metrics);
+
+        if(method == &Benchmark::fillSeq || method == &Benchmark::fillRandom
+                || method == &Benchmark::bulkLoad)
+            records_ = FLAGS_num;
+        else if(method == &Benchmark::deleteRandom || method == &Benchmark::deleteRange)
+            records_ = 0;
+    }
+
+    void runThreads(Method method, Metrics* metrics)
+    {
+        metrics_ = metrics;
+        inserted_ = FLAGS_num;
+        states_.clear();
+        // a new key sequence per run, overwrite must not replay fillrandom.
+        runs_++;
+        for(int i = 0; i < FLAGS_threads; ++i)
+            states_.push_back(ThreadState(i, FLAGS_seed + 1000 * i + 1000000 * runs_));
+
+        std::vector<Thread*> threads;
+        for(int i = 0; i < FLAGS_threads; ++i)
+            threads.push_back(new Thread(boost::bind(method, this, &states_[i])));
+        for(size_t i = 0; i < threads.size(); ++i)
+            threads[i]->start();
+        for(size_t i = 0; i < threads.size(); ++i) {
+            threads[i]->join();
+            delete threads[i];
+        }
+    }
+
+    void report(const std::string& name, const Metrics& metrics)
+    {
+        uint64_t start = UINT64_MAX, finish = 0;
+        long done = 0, reads = 0, found = 0;
+        int64_t bytes = 0;
+        for(size_t i = 0; i < states_.size(); ++i) {
+            start = std::min(start, states_[i].start);
+            finish = std::max(finish, states_[i].finish);
+            done += states_[i].done;
+            reads += states_[i].reads;
+            found += states_[i].found;
+            bytes += states_[i].bytes;
+        }
+
+        double secs = (finish - start) * 1e-6;
+        if(secs <= 0)
+            secs = 1e-6;
+        fprintf(stdout, "%-16s : %11.3f micros/op %10.0f ops/sec %8.1f MB/s",
+                name.c_str(), secs * 1e6 / (done ? done : 1), done / secs,
+                bytes / 1048576.0 / secs);
+        if(reads)
+            fprintf(stdout, " (%ld of %ld found)", found, reads);
+        fprintf(stdout, "\n");
+
+        static const struct {
+            Metrics::Histogram histogram;
+            const char* name;
+        } kOps[] = {
+            { Metrics::kPutMicros, "put" },
+            { Metrics::kGetMicros, "get" },
+            { Metrics::kDelMicros, "del" },
+            { Metrics::kMultiGetMicros, "multiget" },
+            { Metrics::kMergeMicros, "merge" },
+        };
+        for(size_t i = 0; i < sizeof(kOps) / sizeof(kOps[0]); ++i) {
+            if(metrics.percentile(kOps[i].histogram, 100) == 0)
+                continue;
+            fprintf(stdout, "  %s micros: p50 %lu p99 %lu p999 %lu max %lu\n",
+                    kOps[i].name,
+                    metrics.percentile(kOps[i].histogram, 50),
+                    metrics.percentile(kOps[i].histogram, 99),
+                    metrics.percentile(kOps[i].histogram, 99.9),
+                    metrics.percentile(kOps[i].histogram, 100));
+        }
+        fflush(stdout);
+    }
+
+    std::string makeKey(uint64_t k)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%0*llu", FLAGS_key_size,
+                static_cast<unsigned long long>(k));
+        return buf;
+    }
+
+    uint64_t randomKey(ThreadState* thread)
+    {
+        return zipf_ ? zipf_->nextScrambled(thread->rnd)
+                     : thread->rnd.uniform(FLAGS_num);
+    }
+
+    void put(ThreadState* thread, uint64_t k)
+    {
+        std::string key = makeKey(k);
+        size_t offset = thread->rnd.uniform(values_.size() - FLAGS_value_size);
+        Slice skey(key);
+        Slice svalue(&values_[offset], FLAGS_value_size);
+        {
+        MetricsTimer timer(metrics_, Metrics::kPutMicros);
+        if(FLAGS_ttl > 0)
+            db_->put(skey, svalue, time(NULL) + FLAGS_ttl);
+        else
+            db_->put(skey, svalue);
+        }
+        thread->bytes += key.size() + FLAGS_value_size;
+    }
+
+    void get(ThreadState* thread, uint64_t k)
+    {
+        std::string key = makeKey(k);
+        Slice skey(key);
+        PinnableSlice value;
+        bool ok;
+        {
+        MetricsTimer timer(metrics_, Metrics::kGetMicros);
+        ok = db_->get(skey, &value);
+        }
+        thread->reads++;
+        if(ok) {
+            thread->found++;
+            thread->bytes += key.size() + value.size();
+        }
+    }
+
+    void del(ThreadState* thread, uint64_t k)
+    {
+        std::string key = makeKey(k);
+        Slice skey(key);
+        MetricsTimer timer(metrics_, Metrics::kDelMicros);
+        db_->del(skey);
+    }
+
+    // [begin, end) of this thread's share of n.
+    void share(ThreadState* thread, long n, long* begin, long* end)
+    {
+        *begin = n * thread->tid / FLAGS_threads;
+        *end = n * (thread->tid + 1) / FLAGS_threads;
+    }
+
+    void fillSeq(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, FLAGS_num, &begin, &end);
+        thread->start = Metrics::nowMicros();
+        for(long i = begin; i < end; ++i)
+            put(thread, i);
+        thread->done = end - begin;
+        thread->finish = Metrics::nowMicros();
+    }
+
+    // keys 0 .. num - 1 with fillseq's values.
+    class SeqIterator : public Iterator
+    {
+    public:
+        SeqIterator(Benchmark* bench, ThreadState* thread)
+            : bench_(bench), thread_(thread), i_(0), key_(), value_()
+        { make(); }
+
+        bool valid() const { return i_ < FLAGS_num; }
+        Slice key() const { return Slice(const_cast<std::string&>(key_)); }
+        Slice value() const { return value_; }
+        void next() { ++i_; make(); }
+
+    private:
+        void make()
+        {
+            if(!valid())
+                return;
+            key_ = bench_->makeKey(i_);
+            std::vector<char>& values = bench_->values_;
+            size_t offset = thread_->rnd.uniform(values.size() - FLAGS_value_size);
+            value_ = Slice(&values[offset], FLAGS_value_size);
+            thread_->bytes += key_.size() + FLAGS_value_size;
+        }
+
+        Benchmark* bench_;
+        ThreadState* thread_;
+        long i_;
+        std::string key_;
+        Slice value_;
+    };
+
+    // one call loads everything, the other threads have nothing to do.
+    void bulkLoad(ThreadState* thread)
+    {
+        thread->start = Metrics::nowMicros();
+        if(thread->tid == 0) {
+            SeqIterator iter(this, thread);
+            if(!db_->bulkLoad(&iter))
+                fprintf(stderr, "bulkLoad failed\n");
+            thread->done = FLAGS_num;
+        }
+        thread->finish = Metrics::nowMicros();
+    }
+
+    void fillRandom(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, FLAGS_num, &begin, &end);
+        thread->start = Metrics::nowMicros();
+        for(long i = begin; i < end; ++i)
+            put(thread, randomKey(thread));
+        thread->done = end - begin;
+        thread->finish = Metrics::nowMicros();
+    }
+
+    void readRandom(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, reads_, &begin, &end);
+        thread->start = Metrics::nowMicros();
+        for(long i = begin; i < end; ++i)
+            get(thread, randomKey(thread));
+        thread->done = end - begin;
+        thread->finish = Metrics::nowMicros();
+    }
+
+    void multiReadRandom(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, reads_, &begin, &end);
+        thread->start = Metrics::nowMicros();
+
+        std::vector<std::string> keys;
+        std::vector<Slice> skeys;
+        std::vector<std::string> values;
+        std::vector<bool> found;
+        for(long i = begin; i < end; i += FLAGS_batch_size) {
+            long n = std::min<long>(FLAGS_batch_size, end - i);
+            keys.clear();
+            for(long j = 0; j < n; ++j)
+                keys.push_back(makeKey(randomKey(thread)));
+            skeys.clear();
+            for(long j = 0; j < n; ++j)
+                skeys.push_back(Slice(keys[j]));
+
+            {
+            MetricsTimer timer(metrics_, Metrics::kMultiGetMicros);
+            db_->multiGet(skeys, &values, &found);
+            }
+            thread->reads += n;
+            for(long j = 0; j < n; ++j) {
+                if(found[j]) {
+                    thread->found++;
+                    thread->bytes += keys[j].size() + values[j].size();
+                }
+            }
+        }
+        thread->done = end - begin;
+        thread->finish = Metrics::nowMicros();
+    }
+
+    void readSeq(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, reads_, &begin, &end);
+        thread->start = Metrics::nowMicros();
+        for(long i = begin; i < end; ++i)
+            get(thread, i % FLAGS_num);
+        thread->done = end - begin;
+        thread->finish = Metrics::nowMicros();
+    }
+
+    // thread 0 writes until the readers are done and is left out of the
+    // report, so run it with --threads > 1.
+    void readWhileWriting(ThreadState* thread)
+    {
+        if(thread->tid == 0 && FLAGS_threads > 1) {
+            while(!writerDone_.load(std::memory_order_relaxed)) {
+                std::string key = makeKey(randomKey(thread));
+                size_t offset = thread->rnd.uniform(values_.size() - FLAGS_value_size);
+                Slice skey(key);
+                Slice svalue(&values_[offset], FLAGS_value_size);
+                db_->put(skey, svalue);
+            }
+            thread->start = UINT64_MAX;
+            return;
+        }
+
+        readRandom(thread);
+        if(++readersDone_ == FLAGS_threads - 1 || FLAGS_threads == 1)
+            writerDone_ = true;
+    }
+
+    void mergeRandom(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, FLAGS_num, &begin, &end);
+        thread->start = Metrics::nowMicros();
+
+        uint64_t one = 1;
+        Slice operand(reinterpret_cast<char*>(&one), sizeof(one));
+        for(long i = begin; i < end; ++i) {
+            std::string key = makeKey(randomKey(thread));
+            Slice skey(key);
+            MetricsTimer timer(metrics_, Metrics::kMergeMicros);
+            db_->merge(skey, operand);
+            thread->bytes += key.size() + sizeof(one);
+        }
+        thread->done = end - begin;
+        thread->finish = Metrics::nowMicros();
+    }
+
+    // a missing counter reads as 0.
+    static uint64_t counter(Transaction* txn, Slice& key)
+    {
+        std::string value;
+        uint64_t n = 0;
+        if(txn->get(key, &value) && value.size() == sizeof(n))
+            memcpy(&n, value.data(), sizeof(n));
+        return n;
+    }
+
+    void txnRandom(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, FLAGS_num, &begin, &end);
+        thread->start = Metrics::nowMicros();
+
+        for(long i = begin; i < end; ++i) {
+            std::string from = makeKey(randomKey(thread));
+            std::string to = makeKey(randomKey(thread));
+            Slice sfrom(from), sto(to);
+            for(;;) {
+                Transaction* txn = db_->beginTransaction();
+                uint64_t a = counter(txn, sfrom) - 1;
+                uint64_t b = counter(txn, sto) + 1;
+                Slice va(reinterpret_cast<char*>(&a), sizeof(a));
+                Slice vb(reinterpret_cast<char*>(&b), sizeof(b));
+                txn->put(sfrom, va);
+                txn->put(sto, vb);
+                bool committed = txn->commit();
+                delete txn;
+                if(committed)
+                    break;
+            }
+            thread->bytes += from.size() + to.size() + 2 * sizeof(uint64_t);
+        }
+        thread->done = end - begin;
+        thread->finish = Metrics::nowMicros();
+    }
+
+    void deleteRandom(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, FLAGS_num, &begin, &end);
+        thread->start = Metrics::nowMicros();
+        for(long i = begin; i < end; ++i)
+            del(thread, randomKey(thread));
+        thread->done = end - begin;
+        thread->finish = Metrics::nowMicros();
+    }
+
+    void deleteRange(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, FLAGS_num, &begin, &end);
+        thread->start = Metrics::nowMicros();
+        for(long i = begin; i < end; i += FLAGS_scan_length) {
+            std::string first = makeKey(i);
+            std::string last = makeKey(std::min(i + FLAGS_scan_length, end));
+            Slice sfirst(first), slast(last);
+            MetricsTimer timer(metrics_, Metrics::kDelMicros);
+            db_->deleteRange(sfirst, slast);
+            thread->done++;
+        }
+        thread->finish = Metrics::nowMicros();
+    }
+
+    // A 50% read 50% update, B 95/5, C read only,
+    // D 95% read of the latest inserts 5% insert,
+    // E 95% short scans 5% insert, F 50% read 50% read-modify-write.
+    void ycsb(ThreadState* thread)
+    {
+        long begin, end;
+        share(thread, reads_, &begin, &end);
+        int readPct = 0;
+        switch(workload_) {
+        case 'a': readPct = 50; break;
+        case 'b': readPct = 95; break;
+        case 'c': readPct = 100; break;
+        case 'd': readPct = 95; break;
+        case 'e': readPct = 95; break;
+        case 'f': readPct = 50; break;
+        }
+
+        thread->start = Metrics::nowMicros();
+        for(long i = begin; i < end; ++i) {
+            bool read = static_cast<int>(thread->rnd.uniform(100)) < readPct;
+            if(workload_ == 'd' || workload_ == 'e') {
+                if(!read) {
+                    put(thread, inserted_.fetch_add(1));
+                    continue;
+                }
+                if(workload_ == 'd') {
+                    uint64_t latest = inserted_.load(std::memory_order_relaxed);
+                    uint64_t back = zipf_->next(thread->rnd);
+                    get(thread, back < latest ? latest - 1 - back : 0);
+                } else {
+                    uint64_t first = randomKey(thread);
+                    int len = 1 + thread->rnd.uniform(FLAGS_scan_length);
+                    for(int j = 0; j < len; ++j)
+                        get(thread, first + j);
+                }
+            } else if(read) {
+                get(thread, randomKey(thread));
+            } else if(workload_ == 'f') {
+                uint64_t k = randomKey(thread);
+                get(thread, k);
+                put(thread, k);
+            } else {
+                put(thread, randomKey(thread));
+            }
+        }
+        thread->done = end - begin;
+        thread->finish = Metrics::nowMicros();
+    }
+
+    DB* db_;
+    Metrics* metrics_;
+    Zipfian* zipf_;
+    double zipfTheta_;
+    long reads_;
+    long records_;
+    char workload_;
+    uint64_t runs_;
+    std::vector<char> values_;
+    std::vector<ThreadState> states_;
+    std::atomic<uint64_t> inserted_;
+    std::atomic<int> readersDone_;
+    std::atomic<bool> writerDone_;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string benchmarks;
+    std::string db;
+    for(int i = 1; i < argc; ++i) {
+        double d;
+        long n;
+        char junk;
+        if(strncmp(argv[i], "--benchmarks=", 13) == 0) {
+            benchmarks = argv[i] + 13;
+            FLAGS_benchmarks = benchmarks.c_str();
+        } else if(strncmp(argv[i], "--db=", 5) == 0) {
+            db = argv[i] + 5;
+            FLAGS_db = db.c_str();
+        } else if(sscanf(argv[i], "--num=%ld%c", &n, &junk) == 1) {
+            FLAGS_num = n;
+        } else if(sscanf(argv[i], "--reads=%ld%c", &n, &junk) == 1) {
+            FLAGS_reads = n;
+        } else if(sscanf(argv[i], "--threads=%ld%c", &n, &junk) == 1) {
+            FLAGS_threads = n;
+        } else if(sscanf(argv[i], "--key_size=%ld%c", &n, &junk) == 1) {
+            FLAGS_key_size = n;
+        } else if(sscanf(argv[i], "--value_size=%ld%c", &n, &junk) == 1) {
+            FLAGS_value_size = n;
+        } else if(sscanf(argv[i], "--zipf=%lf%c", &d, &junk) == 1) {
+            FLAGS_zipf = d;
+        } else if(sscanf(argv[i], "--scan_length=%ld%c", &n, &junk) == 1) {
+            FLAGS_scan_length = n;
+        } else if(sscanf(argv[i], "--batch_size=%ld%c", &n, &junk) == 1) {
+            FLAGS_batch_size = n;
+        } else if(sscanf(argv[i], "--seed=%ld%c", &n, &junk) == 1) {
+            FLAGS_seed = n;
+        } else if(sscanf(argv[i], "--ttl=%ld%c", &n, &junk) == 1) {
+            FLAGS_ttl = n;
+        } else if(sscanf(argv[i], "--node_size=%ld%c", &n, &junk) == 1) {
+            FLAGS_node_size = n;
+        } else if(sscanf(argv[i], "--fanout=%ld%c", &n, &junk) == 1) {
+            FLAGS_fanout = n;
+        } else if(sscanf(argv[i], "--buffer_bytes=%ld%c", &n, &junk) == 1) {
+            FLAGS_buffer_bytes = n;
+        } else if(sscanf(argv[i], "--cache_mb=%ld%c", &n, &junk) == 1) {
+            FLAGS_cache_mb = n;
+        } else if(sscanf(argv[i], "--row_cache_mb=%ld%c", &n, &junk) == 1) {
+            FLAGS_row_cache_mb = n;
+        } else if(sscanf(argv[i], "--shards=%ld%c", &n, &junk) == 1) {
+            FLAGS_shards = n;
+        } else if(sscanf(argv[i], "--rebalance_ms=%ld%c", &n, &junk) == 1) {
+            FLAGS_rebalance_ms = n;
+        } else {
+            fprintf(stderr, "invalid flag '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if(FLAGS_threads < 1)
+        FLAGS_threads = 1;
+    if(FLAGS_value_size < 1)
+        FLAGS_value_size = 1;
+    if(FLAGS_scan_length < 1)
+        FLAGS_scan_length = 1;
+    if(FLAGS_batch_size < 1)
+        FLAGS_batch_size = 1;
+
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID, LOG_LEVEL_WARN);
+
+    Benchmark benchmark;
+    benchmark.run();
+
+    return 0;
+}
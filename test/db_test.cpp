@@ -20,7 +20,7 @@ int main()
     
     DB* db = DB::open("test", opts);
 
-    Slice ret;
+    std::string ret;
     std::string keystr, valstr;
     char suf[32];
     for(int i = 0; i < 1024; i++) {
@@ -31,13 +31,17 @@ int main()
         Slice val(valstr);
         db->put(key, val);
 
-        if(!db->get(key, ret)) {
+        if(!db->get(key, &ret)) {
             LOGFMTI("Cannot get value");
             return 0;
         }
-        LOGFMTF("return a value [%s]", ret.data());
+        LOGFMTF("return a value [%s]", ret.c_str());
     }
 
+    std::string stats;
+    if(db->getProperty("bt.stats", &stats))
+        printf("%s", stats.c_str());
+
     delete db;
 
     return 0;
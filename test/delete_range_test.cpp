@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int N = 5000;
+
+static bool found(DB* db, int i)
+{
+    std::string k = keyOf(i), ret;
+    if(!getValue(db, k, &ret))
+        return false;
+    CHECK(ret == k);
+    return true;
+}
+
+void testDeleteRange()
+{
+    DB* db = DB::open("delete_range_test", smallOptions());
+    putAll(db, N);
+
+    // [1000, 2000), the end is not deleted.
+    std::string b = keyOf(1000), e = keyOf(2000);
+    Slice begin(b), end(e);
+    CHECK(db->deleteRange(begin, end));
+    CHECK(!db->deleteRange(end, begin));
+
+    for(int i = 0; i < N; i++)
+        CHECK(found(db, i) == (i < 1000 || i >= 2000));
+
+    // a put after the delete is visible, its neighbours stay deleted.
+    std::string k = keyOf(1500);
+    Slice key(k), value(k);
+    CHECK(db->put(key, value));
+    CHECK(found(db, 1500));
+    CHECK(!found(db, 1499));
+    CHECK(!found(db, 1501));
+
+    // pushing the tombstone down keeps it over the older keys only.
+    putAll(db, N);
+    std::string b2 = keyOf(3000), e2 = keyOf(3100);
+    Slice begin2(b2), end2(e2);
+    CHECK(db->deleteRange(begin2, end2));
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(N + i);
+        Slice key(k), value(k);
+        CHECK(db->put(key, value));
+    }
+    for(int i = 0; i < N; i++)
+        CHECK(found(db, i) == (i < 3000 || i >= 3100));
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_WARN);
+
+    testDeleteRange();
+
+    printf("delete_range_test passed\n");
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+#include <boost/bind.hpp>
+
+#include "Thread.h"
+#include "Epoch.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static void countFree(void* arg, void* ptr)
+{
+    static_cast<std::atomic<int>*>(arg)->fetch_add(1);
+    delete static_cast<int*>(ptr);
+}
+
+static void waitFor(std::atomic<bool>* flag)
+{
+    while(!flag->load())
+        usleep(1000);
+}
+
+static void holdEpoch(EpochManager* epoch, std::atomic<bool>* entered,
+        std::atomic<bool>* leave)
+{
+    EpochGuard guard(epoch);
+    entered->store(true);
+    waitFor(leave);
+}
+
+void testRetireWaitsForReaders()
+{
+    EpochManager epoch;
+    std::atomic<int> freed(0);
+    std::atomic<bool> entered(false), leave(false);
+
+    Thread reader(boost::bind(holdEpoch, &epoch, &entered, &leave));
+    reader.start();
+    waitFor(&entered);
+
+    // the reader may still see it.
+    epoch.retire(countFree, &freed, new int(1));
+    for(int i = 0; i < 10; i++)
+        epoch.reclaim();
+    CHECK(freed.load() == 0);
+    CHECK(epoch.pending() == 1);
+
+    leave.store(true);
+    reader.join();
+    epoch.synchronize();
+    CHECK(freed.load() == 1);
+    CHECK(epoch.pending() == 0);
+}
+
+void testNestedGuards()
+{
+    EpochManager epoch;
+    std::atomic<int> freed(0);
+
+    epoch.enter();
+    epoch.enter();
+    epoch.exit();
+    // still inside the outer one.
+    epoch.retire(countFree, &freed, new int(1));
+    for(int i = 0; i < 10; i++)
+        epoch.reclaim();
+    CHECK(freed.load() == 0);
+
+    epoch.exit();
+    epoch.synchronize();
+    CHECK(freed.load() == 1);
+}
+
+static void retireMany(EpochManager* epoch, std::atomic<int>* freed, int n)
+{
+    for(int i = 0; i < n; i++) {
+        EpochGuard guard(epoch);
+        epoch->retire(countFree, freed, new int(i));
+    }
+}
+
+void testConcurrentRetire()
+{
+    const int T = 4, N = 1000;
+    EpochManager epoch;
+    std::atomic<int> freed(0);
+
+    std::vector<Thread*> threads;
+    for(int t = 0; t < T; t++) {
+        threads.push_back(new Thread(boost::bind(retireMany, &epoch, &freed, N)));
+        threads.back()->start();
+    }
+    for(int t = 0; t < T; t++) {
+        threads[t]->join();
+        delete threads[t];
+    }
+
+    epoch.synchronize();
+    CHECK(freed.load() == T * N);
+    CHECK(epoch.pending() == 0);
+}
+
+static void exitInside(EpochManager* epoch)
+{
+    epoch->enter();
+}
+
+void testExitedThreads()
+{
+    const int T = 200;
+    EpochManager epoch;
+    std::atomic<int> freed(0);
+
+    // a thread gone without leaving its epoch does not hold it back.
+    Thread stuck(boost::bind(exitInside, &epoch));
+    stuck.start();
+    stuck.join();
+
+    // every thread takes over the record the one before gave back.
+    for(int t = 0; t < T; t++) {
+        Thread thread(boost::bind(retireMany, &epoch, &freed, 1));
+        thread.start();
+        thread.join();
+    }
+
+    epoch.synchronize();
+    CHECK(freed.load() == T);
+    CHECK(epoch.pending() == 0);
+}
+
+int main()
+{
+    testRetireWaitsForReaders();
+    testNestedGuards();
+    testConcurrentRetire();
+    testExitedThreads();
+
+    printf("epoch_test passed\n");
+    return 0;
+}
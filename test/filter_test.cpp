@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "Buffer.h"
+#include "Filter.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int N = 1000;
+
+static bool mayContain(const BloomFilter& filter, int i)
+{
+    std::string k = keyOf(i);
+    return filter.mayContain(Slice(k));
+}
+
+static void addAll(BloomFilter* filter)
+{
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        filter->add(Slice(k));
+    }
+}
+
+void testNoFalseNegatives()
+{
+    BloomFilter filter(N * 10, 10);
+    CHECK(filter.enabled());
+    CHECK(!mayContain(filter, 0));
+    addAll(&filter);
+
+    for(int i = 0; i < N; i++)
+        CHECK(mayContain(filter, i));
+
+    // about 1% at 10 bits per key.
+    int positives = 0;
+    for(int i = N; i < 11 * N; i++)
+        positives += mayContain(filter, i);
+    CHECK(positives < 3 * N / 10);
+
+    filter.clear();
+    positives = 0;
+    for(int i = 0; i < N; i++)
+        positives += mayContain(filter, i);
+    CHECK(positives == 0);
+}
+
+void testDisabled()
+{
+    BloomFilter filter(0, 10);
+    CHECK(!filter.enabled());
+    CHECK(mayContain(filter, 0));
+    addAll(&filter);
+    CHECK(mayContain(filter, 2 * N));
+    CHECK(filter.encodedSize() == 4);
+}
+
+void testEncode()
+{
+    BloomFilter filter(N * 10, 10);
+    addAll(&filter);
+
+    Buffer buf;
+    filter.encode(buf);
+    CHECK(buf.readableBytes() == filter.encodedSize());
+
+    BloomFilter copy(N * 10, 10);
+    CHECK(copy.decode(buf));
+    CHECK(buf.readableBytes() == 0);
+    for(int i = 0; i < 11 * N; i++)
+        CHECK(mayContain(copy, i) == mayContain(filter, i));
+
+    // another size is skipped over, the caller adds the keys again.
+    filter.encode(buf);
+    BloomFilter other(N * 20, 10);
+    CHECK(!other.decode(buf));
+    CHECK(buf.readableBytes() == 0);
+}
+
+void testFilteredGets()
+{
+    Options opts = smallOptions();
+    opts.sanitize();
+    CHECK(opts.filterBits == opts.maxBufferBytes / (opts.keySizeHint + 12) * 10);
+
+    // every buffered key is found past the filters, misses skip buffers.
+    DB* db = DB::open("filter_test", smallOptions());
+    putAll(db, 10 * N);
+    std::string ret;
+    for(int i = 0; i < 20 * N; i++)
+        CHECK(getValue(db, keyOf(i), &ret) == (i < 10 * N));
+    CHECK(ticker(db, "filter_skips") > 0);
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testNoFalseNegatives();
+    testDisabled();
+    testEncode();
+    testFilteredGets();
+
+    printf("filter_test passed\n");
+    return 0;
+}
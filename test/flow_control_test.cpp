@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <boost/bind.hpp>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "Thread.h"
+#include "FlowControl.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+// a slowdown band of [1000, 2000) bytes, dirty or buffered.
+static Options flowOptions()
+{
+    Options opts;
+    opts.writeSlowdownBytes = 1000;
+    opts.writeStopBytes = 2000;
+    opts.bufferSlowdownBytes = 1000;
+    opts.bufferStopBytes = 2000;
+    opts.writeSlowdownMicros = 1000;
+    return opts;
+}
+
+static void stalledWrite(FlowControl* flow, std::atomic<bool>* done)
+{
+    flow->delayWrite();
+    done->store(true);
+}
+
+void testSlowdown()
+{
+    FlowControl flow(flowOptions());
+    CHECK(flow.state() == FlowControl::kNormal);
+    flow.delayWrite();
+    CHECK(flow.stats().slowdowns == 0);
+
+    // halfway through the band a write waits half of writeSlowdownMicros.
+    flow.setPending(1500, 0);
+    CHECK(flow.state() == FlowControl::kSlowdown);
+    flow.delayWrite();
+    FlowStats stats = flow.stats();
+    CHECK(stats.slowdowns == 1);
+    CHECK(stats.slowdownMicros == 500);
+    CHECK(stats.stops == 0);
+
+    // buffered bytes count like dirty ones.
+    flow.setPending(0, 1500);
+    CHECK(flow.state() == FlowControl::kSlowdown);
+    flow.setPending(0, 0);
+    CHECK(flow.state() == FlowControl::kNormal);
+}
+
+void testStop()
+{
+    FlowControl flow(flowOptions());
+    flow.setPending(3000, 0);
+    CHECK(flow.state() == FlowControl::kStop);
+
+    std::atomic<bool> done(false);
+    Thread writer(boost::bind(stalledWrite, &flow, &done));
+    writer.start();
+    usleep(50 * 1000);
+    CHECK(!done.load());
+
+    // the write back brings it down into the band, the writer goes on
+    // after a slowdown.
+    flow.flushed(1500);
+    writer.join();
+    CHECK(done.load());
+    FlowStats stats = flow.stats();
+    CHECK(stats.stops == 1);
+    CHECK(stats.stopMicros > 0);
+    CHECK(stats.slowdowns == 1);
+    CHECK(stats.dirtyBytes == 1500);
+}
+
+void testShutdown()
+{
+    FlowControl flow(flowOptions());
+    flow.setPending(3000, 3000);
+
+    std::atomic<bool> done(false);
+    Thread writer(boost::bind(stalledWrite, &flow, &done));
+    writer.start();
+    usleep(50 * 1000);
+    CHECK(!done.load());
+
+    flow.shutdown();
+    writer.join();
+    CHECK(done.load());
+
+    // nothing stalls once shut down.
+    flow.delayWrite();
+    FlowStats stats = flow.stats();
+    CHECK(stats.stops == 1);
+    CHECK(stats.slowdowns == 0);
+}
+
+void testWritesSlowDown()
+{
+    Options opts = smallOptions();
+    // any buffered bytes slow writes down, by the least delay.
+    opts.bufferSlowdownBytes = 1024;
+    opts.bufferStopBytes = 1 << 30;
+    DB* db = DB::open("flow_control_test", opts);
+
+    // the write back sweep measures every 100ms.
+    int n = 0;
+    for(int round = 0; round < 50 && statOf(db, "bt.flow", "slowdowns") == 0; round++) {
+        for(int i = 0; i < 1000; i++, n++) {
+            std::string k = keyOf(n);
+            Slice key(k), value(k);
+            CHECK(db->put(key, value));
+        }
+    }
+    CHECK(statOf(db, "bt.flow", "slowdowns") > 0);
+    CHECK(statOf(db, "bt.flow", "stops") == 0);
+
+    std::string ret;
+    for(int i = 0; i < n; i++) {
+        std::string k = keyOf(i);
+        CHECK(getValue(db, k, &ret));
+        CHECK(ret == k);
+    }
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testSlowdown();
+    testStop();
+    testShutdown();
+    testWritesSlowDown();
+
+    printf("flow_control_test passed\n");
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+// this file alone compiles out the levels below info, whatever the
+// build's LOG_MIN_LEVEL.
+#undef LOG4Z_MIN_LEVEL
+#define LOG4Z_MIN_LEVEL LOG_LEVEL_INFO
+
+#include "Logger.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static int evaluated = 0;
+
+static int touch()
+{
+    return ++evaluated;
+}
+
+void testCompiledOut()
+{
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_TRACE);
+    evaluated = 0;
+
+    // the runtime level lets them through, their arguments still never run.
+    LOGFMTT("trace %d", touch());
+    LOGFMTD("debug %d", touch());
+    LOGT("trace " << touch());
+    LOGD("debug " << touch());
+    CHECK(evaluated == 0);
+
+    LOGFMTI("info %d", touch());
+    LOGI("info " << touch());
+    LOGFMTW("warn %d", touch());
+    CHECK(evaluated == 3);
+
+    // above the compiled level the runtime one still filters.
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_WARN);
+    LOGFMTI("info %d", touch());
+    CHECK(evaluated == 3);
+}
+
+void testRingOverflow()
+{
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_INFO);
+    unsigned long long dropped = ILog4zManager::getRef().getStatusDroppedCount();
+
+    // the log thread drains every 10ms when idle, a burst fills the ring
+    // and the rest is dropped instead of waiting.
+    for(int i = 0; i < 20 * LOG4Z_RING_SLOTS; i++)
+        LOGFMTI("overflow %d", i);
+    CHECK(ILog4zManager::getRef().getStatusDroppedCount() > dropped);
+}
+
+void testWarningsKept()
+{
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_INFO);
+    for(int i = 0; i < 4 * LOG4Z_RING_SLOTS; i++)
+        LOGFMTI("overflow %d", i);
+    unsigned long long dropped = ILog4zManager::getRef().getStatusDroppedCount();
+
+    // warnings and errors wait for room in the full ring.
+    for(int i = 0; i < 2 * LOG4Z_RING_SLOTS; i++) {
+        LOGFMTW("warn %d", i);
+        LOGFMTE("error %d", i);
+    }
+    CHECK(ILog4zManager::getRef().getStatusDroppedCount() == dropped);
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerDisplay(LOG4Z_MAIN_LOGGER_ID,false);
+
+    testCompiledOut();
+    testRingOverflow();
+    testWarningsKept();
+
+    printf("logger_test passed\n");
+    return 0;
+}
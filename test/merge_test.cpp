@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static AppendOperator appendOperator;
+
+static Options mergeOptions()
+{
+    Options opts = smallOptions();
+    opts.mergeOperator = &appendOperator;
+    return opts;
+}
+
+void testMergeFolds()
+{
+    DB* db = DB::open("merge_test", mergeOptions());
+
+    std::string keystr("counter"), ret;
+    Slice key(keystr);
+    std::string a("a"), b("b"), c("c");
+    Slice va(a), vb(b), vc(c);
+
+    // operands without a value start from nothing.
+    CHECK(db->merge(key, va));
+    CHECK(db->merge(key, vb));
+    CHECK(getValue(db, keystr, &ret));
+    CHECK(ret == "a,b");
+
+    // a put replaces what was folded, later operands apply to it.
+    CHECK(db->put(key, vc));
+    CHECK(db->merge(key, va));
+    CHECK(getValue(db, keystr, &ret));
+    CHECK(ret == "c,a");
+
+    // a delete drops the value, the next operand starts over.
+    CHECK(db->del(key));
+    CHECK(!getValue(db, keystr, &ret));
+    CHECK(db->merge(key, vb));
+    CHECK(getValue(db, keystr, &ret));
+    CHECK(ret == "b");
+
+    delete db;
+}
+
+void testMergePushedDown()
+{
+    DB* db = DB::open("merge_test", mergeOptions());
+
+    const int N = 2000, R = 5;
+    std::map<std::string, std::string> expected;
+    char v[32];
+    for(int r = 0; r < R; r++) {
+        for(int i = 0; i < N; i++) {
+            std::string k = keyOf(i);
+            sprintf(v, "%d", r);
+            Slice key(k), operand(v);
+            CHECK(db->merge(key, operand));
+            std::string& e = expected[k];
+            if(!e.empty())
+                e += ",";
+            e += v;
+        }
+    }
+
+    std::string ret;
+    for(std::map<std::string, std::string>::iterator it = expected.begin();
+            it != expected.end(); ++it) {
+        CHECK(getValue(db, it->first, &ret));
+        CHECK(ret == it->second);
+    }
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_WARN);
+
+    testMergeFolds();
+    testMergePushedDown();
+
+    printf("merge_test passed\n");
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "Thread.h"
+#include "Metrics.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static void addMany(Metrics* metrics, int n)
+{
+    for(int i = 0; i < n; i++) {
+        metrics->add(Metrics::kPuts);
+        metrics->add(Metrics::kGets, 2);
+        metrics->record(Metrics::kPutMicros, i % 100);
+    }
+}
+
+void testConcurrentAdds()
+{
+    const int T = 4, N = 10000;
+    Metrics* metrics = new Metrics();
+
+    std::vector<Thread*> threads;
+    for(int t = 0; t < T; t++) {
+        threads.push_back(new Thread(boost::bind(addMany, metrics, N)));
+        threads.back()->start();
+    }
+    for(int t = 0; t < T; t++) {
+        threads[t]->join();
+        delete threads[t];
+    }
+
+    // the shards sum up to every add.
+    CHECK(metrics->ticker(Metrics::kPuts) == static_cast<uint64_t>(T * N));
+    CHECK(metrics->ticker(Metrics::kGets) == static_cast<uint64_t>(2 * T * N));
+    CHECK(metrics->ticker(Metrics::kDels) == 0);
+    CHECK(metrics->percentile(Metrics::kPutMicros, 100) == 99);
+    delete metrics;
+}
+
+void testPercentiles()
+{
+    Metrics* metrics = new Metrics();
+    CHECK(metrics->percentile(Metrics::kGetMicros, 50) == 0);
+
+    for(uint64_t v = 1; v <= 10000; v++)
+        metrics->record(Metrics::kGetMicros, v);
+
+    // a bucket is at most 12.5% wide.
+    uint64_t p50 = metrics->percentile(Metrics::kGetMicros, 50);
+    uint64_t p99 = metrics->percentile(Metrics::kGetMicros, 99);
+    CHECK(p50 >= 5000 && p50 <= 5000 * 1.125);
+    CHECK(p99 >= 9900 && p99 <= 10000);
+    CHECK(metrics->percentile(Metrics::kGetMicros, 100) == 10000);
+    CHECK(metrics->toString().find("get_micros: count 10000 ") != std::string::npos);
+    delete metrics;
+}
+
+void testDBStats()
+{
+    Options opts;
+    DB* db = DB::open("metrics_test", opts);
+
+    const int N = 1000;
+    putAll(db, N);
+    std::string ret;
+    for(int i = 0; i < 2 * N; i++)
+        CHECK(getValue(db, keyOf(i), &ret) == (i < N));
+    for(int i = 0; i < N; i += 10) {
+        std::string k = keyOf(i);
+        Slice key(k);
+        CHECK(db->del(key));
+    }
+
+    CHECK(ticker(db, "puts") == N);
+    CHECK(ticker(db, "gets") == 2 * N);
+    CHECK(ticker(db, "dels") == N / 10);
+
+    std::string stats;
+    CHECK(db->getProperty("bt.stats", &stats));
+    CHECK(stats.find("put_micros: count 1000 ") != std::string::npos);
+    CHECK(stats.find("get_micros: count 2000 ") != std::string::npos);
+
+    delete db;
+}
+
+// a line of "bt.write-amp", value is what follows name.
+static const char* writeAmp(DB* db, std::string* amp, const char* name)
+{
+    CHECK(db->getProperty("bt.write-amp", amp));
+    size_t pos = amp->find(name);
+    CHECK(pos != std::string::npos);
+    return amp->c_str() + pos + strlen(name);
+}
+
+static uint64_t levelBytes(DB* db, int level)
+{
+    std::string amp;
+    char name[64];
+    snprintf(name, sizeof(name), "write_amp_level_%d: bytes ", level);
+    return strtoull(writeAmp(db, &amp, name), NULL, 10);
+}
+
+static double ampOf(DB* db, const char* name)
+{
+    std::string amp;
+    return strtod(writeAmp(db, &amp, name), NULL);
+}
+
+void testWriteAmp()
+{
+    DB* db = DB::open("metrics_test", smallOptions());
+
+    // the root takes every user byte once, the levels below are fed
+    // by push downs.
+    const int N = 20000;
+    putAll(db, N);
+    uint64_t user = 2 * keyOf(0).size() * N;
+    CHECK(ticker(db, "user_bytes") == user);
+    CHECK(levelBytes(db, 0) == user);
+    uint64_t level1 = levelBytes(db, 1);
+    CHECK(level1 > 0);
+    // printed to two decimals.
+    CHECK(ampOf(db, "write_amp_memory: ") >= 0.995 + static_cast<double>(level1) / user);
+    // the cache is too small to keep the tree, the write back sweep
+    // takes the nodes to disk.
+    for(int i = 0; i < 100 && ticker(db, "bytes_written") == 0; i++)
+        usleep(20 * 1000);
+    CHECK(ampOf(db, "write_amp_disk: ") > 0);
+
+    // more writes only add.
+    putAll(db, N, "again_");
+    CHECK(levelBytes(db, 0) > user);
+    CHECK(levelBytes(db, 1) > level1);
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testConcurrentAdds();
+    testPercentiles();
+    testDBStats();
+    testWriteAmp();
+
+    printf("metrics_test passed\n");
+    return 0;
+}
@@ -0,0 +1,660 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Options.h"
+#include "Logger.h"
+#include "Buffer.h"
+#include "coding.h"
+#include "Slab.h"
+#include "Slice.h"
+#include "Skiplist.h"
+#include "Msg.h"
+#include "Node.h"
+#include "BufferTree.h"
+#include "SnapshotList.h"
+
+using namespace bt;
+
+// Microbenchmarks of the primitives under every operation.
+//
+//   micro_bench [--filter=substring] [--min_time=seconds]
+//
+// every benchmark is rerun with growing iteration counts until one run
+// takes min_time, that run is reported. results go to stdout as JSON.
+static const char* FLAGS_filter = NULL;
+static double FLAGS_min_time = 0.2;
+
+namespace {
+
+uint64_t nowNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// keeps results alive so the optimizer cannot drop the measured work.
+volatile uint64_t sink;
+
+class State
+{
+public:
+    State(long iters, long arg)
+        : iters_(iters), arg_(arg), bytes_(0),
+          elapsed_(0), start_(0), running_(false)
+    {}
+
+    long iters() const { return iters_; }
+    long arg() const { return arg_; }
+    // bytes processed over all iterations, reported as throughput.
+    void setBytes(int64_t bytes) { bytes_ = bytes; }
+    int64_t bytes() const { return bytes_; }
+
+    void start()
+    {
+        running_ = true;
+        start_ = nowNanos();
+    }
+
+    void stop()
+    {
+        if(running_)
+            elapsed_ += nowNanos() - start_;
+        running_ = false;
+    }
+
+    uint64_t elapsed() const { return elapsed_; }
+
+private:
+    long iters_;
+    long arg_;
+    int64_t bytes_;
+    uint64_t elapsed_;
+    uint64_t start_;
+    bool running_;
+};
+
+typedef void (*BenchFunc)(State& state);
+
+struct Benchmark
+{
+    std::string name;
+    BenchFunc func;
+    long arg;
+};
+
+struct Result
+{
+    std::string name;
+    long iters;
+    double nsPerOp;
+    double bytesPerSecond;
+};
+
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : state_(seed) {}
+
+    uint64_t next()
+    {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 2685821657736338717ULL;
+    }
+
+private:
+    uint64_t state_;
+};
+
+Slab* slab = NULL;
+
+//////////////////////////////////////////////////////////////////////////
+// Slab
+//////////////////////////////////////////////////////////////////////////
+
+// one op is an alloc and its free, in batches so the free lists are
+// actually walked.
+void benchSlabAllocFree(State& state)
+{
+    const long kBatch = 1024;
+    uint32_t size = static_cast<uint32_t>(state.arg());
+    std::vector<void*> ptrs(kBatch);
+
+    state.start();
+    for(long done = 0; done < state.iters(); done += kBatch) {
+        long n = std::min(kBatch, state.iters() - done);
+        for(long i = 0; i < n; ++i)
+            ptrs[i] = slab->alloc(size);
+        for(long i = 0; i < n; ++i)
+            slab->free(ptrs[i]);
+    }
+    state.stop();
+    state.setBytes(static_cast<int64_t>(state.iters()) * size);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// SkipList
+//////////////////////////////////////////////////////////////////////////
+
+struct IntCmp
+{
+    int operator()(const uint64_t& a, const uint64_t& b) const
+    {
+        return a < b ? -1 : (a > b ? 1 : 0);
+    }
+};
+
+typedef SkipList<uint64_t, IntCmp> IntList;
+
+// random inserts into lists growing up to arg entries.
+void benchSkipListInsert(State& state)
+{
+    Random rnd(301);
+    IntList* list = new IntList(IntCmp(), slab);
+
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        if(list->count() >= static_cast<size_t>(state.arg())) {
+            state.stop();
+            delete list;
+            list = new IntList(IntCmp(), slab);
+            state.start();
+        }
+        list->insert(rnd.next());
+    }
+    state.stop();
+    delete list;
+}
+
+void benchSkipListSeek(State& state)
+{
+    Random rnd(301);
+    IntList list(IntCmp(), slab);
+    std::vector<uint64_t> keys(state.arg());
+    for(size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = rnd.next();
+        list.insert(keys[i]);
+    }
+
+    IntList::Iterator iter(&list);
+    uint64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        iter.seek(keys[rnd.next() % keys.size()]);
+        sum += iter.key();
+    }
+    state.stop();
+    sink = sum;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Buffer
+//////////////////////////////////////////////////////////////////////////
+
+// the buffer is reset every kReset appends so it stays in cache.
+const long kReset = 4096;
+
+void benchBufferAppendInt32(State& state)
+{
+    Buffer buf;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        if(i % kReset == 0)
+            buf.retrieveAll();
+        buf.appendInt32(static_cast<int32_t>(i));
+    }
+    state.stop();
+    state.setBytes(state.iters() * 4);
+}
+
+void benchBufferAppendInt64(State& state)
+{
+    Buffer buf;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        if(i % kReset == 0)
+            buf.retrieveAll();
+        buf.appendInt64(i);
+    }
+    state.stop();
+    state.setBytes(state.iters() * 8);
+}
+
+void benchBufferAppend(State& state)
+{
+    Buffer buf;
+    std::string data(state.arg(), 'x');
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        if(i % kReset == 0)
+            buf.retrieveAll();
+        buf.append(data.data(), data.size());
+    }
+    state.stop();
+    state.setBytes(state.iters() * state.arg());
+}
+
+void benchBufferReadInt32(State& state)
+{
+    Buffer buf;
+    uint64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        if(buf.readableBytes() < 4) {
+            state.stop();
+            buf.retrieveAll();
+            for(long j = 0; j < kReset; ++j)
+                buf.appendInt32(static_cast<int32_t>(j));
+            state.start();
+        }
+        sum += buf.readInt32();
+    }
+    state.stop();
+    state.setBytes(state.iters() * 4);
+    sink = sum;
+}
+
+void benchBufferReadInt64(State& state)
+{
+    Buffer buf;
+    uint64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        if(buf.readableBytes() < 8) {
+            state.stop();
+            buf.retrieveAll();
+            for(long j = 0; j < kReset; ++j)
+                buf.appendInt64(j);
+            state.start();
+        }
+        sum += buf.readInt64();
+    }
+    state.stop();
+    state.setBytes(state.iters() * 8);
+    sink = sum;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// coding.h
+//////////////////////////////////////////////////////////////////////////
+
+// values with a spread of varint lengths.
+std::vector<uint64_t> codingValues()
+{
+    Random rnd(301);
+    std::vector<uint64_t> values(1024);
+    for(size_t i = 0; i < values.size(); ++i)
+        values[i] = rnd.next() >> (rnd.next() % 64);
+    return values;
+}
+
+void benchEncodeFixed32(State& state)
+{
+    char buf[4];
+    uint64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        EncodeFixed32(buf, static_cast<uint32_t>(i));
+        sum += buf[i & 3];
+    }
+    state.stop();
+    sink = sum;
+}
+
+void benchDecodeFixed32(State& state)
+{
+    std::vector<char> data(4096);
+    for(size_t i = 0; i + 4 <= data.size(); i += 4)
+        EncodeFixed32(&data[i], static_cast<uint32_t>(i));
+    uint64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i)
+        sum += DecodeFixed32(&data[(i * 4) & 4095]);
+    state.stop();
+    sink = sum;
+}
+
+void benchEncodeFixed64(State& state)
+{
+    char buf[8];
+    uint64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        EncodeFixed64(buf, i);
+        sum += buf[i & 7];
+    }
+    state.stop();
+    sink = sum;
+}
+
+void benchDecodeFixed64(State& state)
+{
+    std::vector<char> data(4096);
+    for(size_t i = 0; i + 8 <= data.size(); i += 8)
+        EncodeFixed64(&data[i], i);
+    uint64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i)
+        sum += DecodeFixed64(&data[(i * 8) & 4095]);
+    state.stop();
+    sink = sum;
+}
+
+void benchEncodeVarint32(State& state)
+{
+    std::vector<uint64_t> values = codingValues();
+    char buf[8];
+    uint64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        char* end = EncodeVarint32(buf, static_cast<uint32_t>(values[i & 1023]));
+        sum += end - buf;
+    }
+    state.stop();
+    sink = sum;
+}
+
+void benchDecodeVarint32(State& state)
+{
+    std::vector<uint64_t> values = codingValues();
+    std::vector<char> data(values.size() * 5 + 5);
+    char* p = &data[0];
+    for(size_t i = 0; i < values.size(); ++i)
+        p = EncodeVarint32(p, static_cast<uint32_t>(values[i]));
+    const char* limit = p;
+
+    uint64_t sum = 0;
+    const char* q = &data[0];
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        if(q >= limit)
+            q = &data[0];
+        uint32_t v = 0;
+        q = GetVarint32Ptr(q, limit, &v);
+        sum += v;
+    }
+    state.stop();
+    sink = sum;
+}
+
+void benchEncodeVarint64(State& state)
+{
+    std::vector<uint64_t> values = codingValues();
+    char buf[10];
+    uint64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        char* end = EncodeVarint64(buf, values[i & 1023]);
+        sum += end - buf;
+    }
+    state.stop();
+    sink = sum;
+}
+
+void benchDecodeVarint64(State& state)
+{
+    std::vector<uint64_t> values = codingValues();
+    std::vector<char> data(values.size() * 10 + 10);
+    char* p = &data[0];
+    for(size_t i = 0; i < values.size(); ++i)
+        p = EncodeVarint64(p, values[i]);
+    const char* limit = p;
+
+    uint64_t sum = 0;
+    const char* q = &data[0];
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        if(q >= limit)
+            q = &data[0];
+        uint64_t v = 0;
+        q = GetVarint64Ptr(q, limit, &v);
+        sum += v;
+    }
+    state.stop();
+    sink = sum;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Slice
+//////////////////////////////////////////////////////////////////////////
+
+// keys sharing all but the last byte, the worst case for memcmp.
+void benchSliceCompare(State& state)
+{
+    std::string a(state.arg(), 'k');
+    std::string b(state.arg(), 'k');
+    b[b.size() - 1] = 'l';
+    Slice sa(a), sb(b);
+    int64_t sum = 0;
+    state.start();
+    for(long i = 0; i < state.iters(); ++i)
+        sum += (i & 1) ? sa.compare(sb) : sb.compare(sa);
+    state.stop();
+    state.setBytes(state.iters() * state.arg());
+    sink = sum;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Node
+//////////////////////////////////////////////////////////////////////////
+
+// a leaf holding arg Put messages of 16 byte keys and 100 byte values.
+Node* makeNode(BufferTree* tree, long msgs)
+{
+    Node* node = new Node(tree, 1, slab);
+    node->createFirstPivot();
+    node->setLeaf(true);
+
+    char key[32];
+    std::string value(100, 'v');
+    for(long i = 0; i < msgs; ++i) {
+        snprintf(key, sizeof(key), "%016ld", i);
+        Slice k(key), v(value);
+        node->insertMsg(0, Msg(Put, k.clone(slab), v.clone(slab)));
+    }
+    return node;
+}
+
+void benchNodeSerialize(State& state)
+{
+    Options opts;
+    opts.sanitize();
+    SnapshotList snapshots;
+    BufferTree tree("micro", 0, opts, NULL, NULL, slab->epoch(), &snapshots);
+    Node* node = makeNode(&tree, state.arg());
+    Buffer buf;
+    int64_t bytes = 0;
+
+    state.start();
+    for(long i = 0; i < state.iters(); ++i) {
+        buf.retrieveAll();
+        node->serialize(buf);
+        bytes += buf.readableBytes();
+    }
+    state.stop();
+    state.setBytes(bytes);
+    delete node;
+}
+
+void benchNodeDeserialize(State& state)
+{
+    Options opts;
+    opts.sanitize();
+    SnapshotList snapshots;
+    BufferTree tree("micro", 0, opts, NULL, NULL, slab->epoch(), &snapshots);
+    Node* node = makeNode(&tree, state.arg());
+    Buffer image;
+    node->serialize(image);
+    delete node;
+
+    std::string data(image.beginRead(), image.readableBytes());
+    Buffer buf;
+    int64_t bytes = 0;
+
+    for(long i = 0; i < state.iters(); ++i) {
+        buf.retrieveAll();
+        buf.append(data.data(), data.size());
+        Node* copy = new Node(&tree, 1, slab);
+        state.start();
+        copy->deserialize(buf);
+        state.stop();
+        bytes += data.size();
+        delete copy;
+        slab->epoch()->reclaim();
+    }
+    state.setBytes(bytes);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Result runBenchmark(const Benchmark& bench)
+{
+    long iters = 1;
+    while(true) {
+        State state(iters, bench.arg);
+        bench.func(state);
+
+        double secs = state.elapsed() * 1e-9;
+        // the timed run is long enough, or growing it would take too long.
+        if(secs >= FLAGS_min_time || iters >= (1L << 30)) {
+            Result result;
+            result.name = bench.name;
+            result.iters = iters;
+            result.nsPerOp = static_cast<double>(state.elapsed()) / iters;
+            result.bytesPerSecond = secs > 0 ? state.bytes() / secs : 0;
+            return result;
+        }
+
+        // aim a bit past min_time, grow at most 10x per round.
+        double next = secs > 0 ? iters * FLAGS_min_time * 1.4 / secs : iters * 10.0;
+        if(next > iters * 10.0)
+            next = iters * 10.0;
+        if(next < iters + 1)
+            next = iters + 1;
+        iters = static_cast<long>(next);
+    }
+}
+
+void add(std::vector<Benchmark>& benchmarks, const char* name, BenchFunc func, long arg = -1)
+{
+    Benchmark bench;
+    char buf[128];
+    if(arg >= 0)
+        snprintf(buf, sizeof(buf), "%s/%ld", name, arg);
+    else
+        snprintf(buf, sizeof(buf), "%s", name);
+    bench.name = buf;
+    bench.func = func;
+    bench.arg = arg;
+    benchmarks.push_back(bench);
+}
+
+std::vector<Benchmark> registerBenchmarks()
+{
+    std::vector<Benchmark> b;
+
+    for(long size = 16; size <= 16384; size *= 4)
+        add(b, "slab_alloc_free", benchSlabAllocFree, size);
+
+    add(b, "skiplist_insert", benchSkipListInsert, 1000);
+    add(b, "skiplist_insert", benchSkipListInsert, 100000);
+    add(b, "skiplist_seek", benchSkipListSeek, 1000);
+    add(b, "skiplist_seek", benchSkipListSeek, 100000);
+
+    add(b, "buffer_append_int32", benchBufferAppendInt32);
+    add(b, "buffer_append_int64", benchBufferAppendInt64);
+    add(b, "buffer_append", benchBufferAppend, 16);
+    add(b, "buffer_append", benchBufferAppend, 1024);
+    add(b, "buffer_read_int32", benchBufferReadInt32);
+    add(b, "buffer_read_int64", benchBufferReadInt64);
+
+    add(b, "encode_fixed32", benchEncodeFixed32);
+    add(b, "decode_fixed32", benchDecodeFixed32);
+    add(b, "encode_fixed64", benchEncodeFixed64);
+    add(b, "decode_fixed64", benchDecodeFixed64);
+    add(b, "encode_varint32", benchEncodeVarint32);
+    add(b, "decode_varint32", benchDecodeVarint32);
+    add(b, "encode_varint64", benchEncodeVarint64);
+    add(b, "decode_varint64", benchDecodeVarint64);
+
+    add(b, "slice_compare", benchSliceCompare, 16);
+    add(b, "slice_compare", benchSliceCompare, 256);
+
+    add(b, "node_serialize", benchNodeSerialize, 100);
+    add(b, "node_serialize", benchNodeSerialize, 1000);
+    add(b, "node_deserialize", benchNodeDeserialize, 100);
+    add(b, "node_deserialize", benchNodeDeserialize, 1000);
+
+    return b;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    for(int i = 1; i < argc; ++i) {
+        double d;
+        char junk;
+        if(strncmp(argv[i], "--filter=", 9) == 0) {
+            FLAGS_filter = argv[i] + 9;
+        } else if(sscanf(argv[i], "--min_time=%lf%c", &d, &junk) == 1) {
+            FLAGS_min_time = d;
+        } else {
+            fprintf(stderr, "invalid flag '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    slab = new Slab();
+    if(!slab->init(SLAB_SIZE)) {
+        fprintf(stderr, "init slab failed\n");
+        return 1;
+    }
+
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host));
+    time_t now = time(NULL);
+    char date[64];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    printf("{\n");
+    printf("  \"context\": {\n");
+    printf("    \"date\": \"%s\",\n", date);
+    printf("    \"host\": \"%s\",\n", host);
+    printf("    \"cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef NDEBUG
+    printf("    \"build\": \"release\",\n");
+#else
+    printf("    \"build\": \"debug\",\n");
+#endif
+    printf("    \"min_time\": %.3f\n", FLAGS_min_time);
+    printf("  },\n");
+    printf("  \"benchmarks\": [");
+
+    std::vector<Benchmark> benchmarks = registerBenchmarks();
+    bool first = true;
+    for(size_t i = 0; i < benchmarks.size(); ++i) {
+        if(FLAGS_filter && benchmarks[i].name.find(FLAGS_filter) == std::string::npos)
+            continue;
+
+        Result r = runBenchmark(benchmarks[i]);
+        printf("%s\n    {\"name\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.2f, "
+                "\"bytes_per_second\": %.0f}",
+                first ? "" : ",", r.name.c_str(), r.iters, r.nsPerOp, r.bytesPerSecond);
+        fflush(stdout);
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
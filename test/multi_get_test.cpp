@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int N = 5000;
+
+// multiGet answers every key like get does, whatever the order.
+static void checkKeys(DB* db, std::vector<std::string>& ks)
+{
+    std::vector<Slice> keys;
+    for(size_t i = 0; i < ks.size(); i++)
+        keys.push_back(Slice(ks[i]));
+
+    std::vector<std::string> values;
+    std::vector<bool> statuses;
+    db->multiGet(keys, &values, &statuses);
+    CHECK(values.size() == ks.size());
+    CHECK(statuses.size() == ks.size());
+
+    std::string ret;
+    for(size_t i = 0; i < ks.size(); i++) {
+        bool found = getValue(db, ks[i], &ret);
+        CHECK(statuses[i] == found);
+        if(found)
+            CHECK(values[i] == ret);
+    }
+}
+
+static void checkDB(const Options& opts)
+{
+    DB* db = DB::open("multi_get_test", opts);
+    putAll(db, N);
+    for(int i = 0; i < N; i += 4) {
+        std::string k = keyOf(i);
+        Slice key(k);
+        CHECK(db->del(key));
+    }
+
+    // sorted, with misses past the end.
+    std::vector<std::string> ks;
+    for(int i = 0; i < N + 100; i += 3)
+        ks.push_back(keyOf(i));
+    checkKeys(db, ks);
+
+    // shuffled, with duplicates.
+    ks.clear();
+    unsigned int seed = 1;
+    for(int i = 0; i < 2000; i++)
+        ks.push_back(keyOf(rand_r(&seed) % (N + 100)));
+    checkKeys(db, ks);
+
+    ks.clear();
+    checkKeys(db, ks);
+    ks.push_back(keyOf(1));
+    checkKeys(db, ks);
+
+    delete db;
+}
+
+void testMultiGet()
+{
+    checkDB(smallOptions());
+}
+
+void testMultiGetShards()
+{
+    Options opts = smallOptions();
+    opts.shards = 3;
+    checkDB(opts);
+
+    opts.shardBoundaries.push_back(keyOf(N / 3));
+    opts.shardBoundaries.push_back(keyOf(2 * N / 3));
+    checkDB(opts);
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testMultiGet();
+    testMultiGetShards();
+
+    printf("multi_get_test passed\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <vector>
+#include <boost/bind.hpp>
+
+#include "Options.h"
+#include "Thread.h"
+#include "BufferTree.h"
+#include "Node.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+void testFlags()
+{
+    Options opts;
+    BufferTree tree("node_test", 0, opts, NULL, NULL, NULL, NULL);
+    Node node(&tree, 1, NULL);
+
+    CHECK(node.nid() == 1);
+    CHECK(!node.dirty() && !node.flushing() && !node.isLeaf());
+    CHECK(node.refs() == 0);
+    CHECK(node.evictable());
+
+    node.setLeaf(true);
+    CHECK(node.isLeaf());
+    CHECK(node.evictable());
+
+    // dirty, flushing or pinned each keep it cached.
+    node.setDirty(true);
+    CHECK(node.dirty());
+    CHECK(!node.evictable());
+    node.setDirty(false);
+    node.setFlushing(true);
+    CHECK(node.flushing());
+    CHECK(!node.evictable());
+    node.setFlushing(false);
+    node.incRef();
+    CHECK(node.refs() == 1);
+    CHECK(!node.evictable());
+    node.decRef();
+    CHECK(node.evictable());
+
+    // the refcount shares the word without touching the flags.
+    node.setDirty(true);
+    for(int i = 0; i < 1000; i++)
+        node.incRef();
+    CHECK(node.refs() == 1000);
+    CHECK(node.dirty() && node.isLeaf() && !node.flushing());
+    for(int i = 0; i < 1000; i++)
+        node.decRef();
+    CHECK(node.refs() == 0);
+    CHECK(node.dirty() && node.isLeaf());
+}
+
+static void pinMany(Node* node, int n)
+{
+    for(int i = 0; i < n; i++) {
+        node->incRef();
+        node->decRef();
+        node->incRef();
+    }
+}
+
+static void flipFlags(Node* node, int n)
+{
+    for(int i = 0; i < n; i++) {
+        node->setDirty(i % 2 == 0);
+        node->setFlushing(i % 3 == 0);
+    }
+    node->setDirty(false);
+    node->setFlushing(false);
+}
+
+void testConcurrentUpdates()
+{
+    const int T = 4, N = 100000;
+    Options opts;
+    BufferTree tree("node_test", 0, opts, NULL, NULL, NULL, NULL);
+    Node node(&tree, 1, NULL);
+    node.setLeaf(true);
+
+    // no update of one part of the word is lost to another.
+    std::vector<Thread*> threads;
+    for(int t = 0; t < T; t++) {
+        threads.push_back(new Thread(boost::bind(pinMany, &node, N)));
+        threads.back()->start();
+    }
+    Thread flipper(boost::bind(flipFlags, &node, N));
+    flipper.start();
+    for(int t = 0; t < T; t++) {
+        threads[t]->join();
+        delete threads[t];
+    }
+    flipper.join();
+
+    CHECK(node.refs() == static_cast<size_t>(T * N));
+    CHECK(node.isLeaf() && !node.dirty() && !node.flushing());
+    for(int i = 0; i < T * N; i++)
+        node.decRef();
+    CHECK(node.evictable());
+}
+
+int main()
+{
+    testFlags();
+    testConcurrentUpdates();
+
+    printf("node_test passed\n");
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "PinnableSlice.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int N = 5000;
+
+void testPinOutlivesWrites()
+{
+    DB* db = DB::open("pinned_get_test", smallOptions());
+    putAll(db, N, "old_");
+
+    std::string k = keyOf(N / 2), old = "old_" + k;
+    Slice key(k);
+    PinnableSlice pinned;
+    CHECK(db->get(key, &pinned));
+    CHECK(pinned.pinned());
+    CHECK(pinned.toString() == old);
+
+    // overwrites, deletes, splits and evictions all leave the pinned
+    // bytes alone.
+    putAll(db, N, "new_");
+    for(int i = 0; i < N; i += 2) {
+        std::string d = keyOf(i);
+        Slice dk(d);
+        CHECK(db->del(dk));
+    }
+    putAll(db, N, "last_");
+    CHECK(pinned.size() == old.size());
+    CHECK(memcmp(pinned.data(), old.data(), old.size()) == 0);
+
+    pinned.reset();
+    CHECK(!pinned.pinned());
+    CHECK(pinned.size() == 0);
+    CHECK(db->get(key, &pinned));
+    CHECK(pinned.toString() == "last_" + k);
+    pinned.reset();
+
+    std::string missing = keyOf(N);
+    Slice missingKey(missing);
+    CHECK(!db->get(missingKey, &pinned));
+    CHECK(!pinned.pinned());
+
+    delete db;
+}
+
+void testPinnedMatchesCopy()
+{
+    Options opts = smallOptions();
+    opts.rowCacheSize = 1 << 20;
+    DB* db = DB::open("pinned_get_test", opts);
+    putAll(db, N);
+
+    // a row cache hit comes back as a copy owned by the handle.
+    std::string ret;
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        Slice key(k);
+        for(int n = 0; n < 2; n++) {
+            PinnableSlice value;
+            CHECK(db->get(key, &value));
+            CHECK(value.toString() == k);
+            CHECK(getValue(db, k, &ret));
+            CHECK(ret == value.toString());
+        }
+    }
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testPinOutlivesWrites();
+    testPinnedMatchesCopy();
+
+    printf("pinned_get_test passed\n");
+    return 0;
+}
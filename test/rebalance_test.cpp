@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+void testDeletesShrinkTree()
+{
+    Options opts;
+    // small nodes make a tree of several levels, rebalanced often.
+    opts.nodeSize = 4096;
+    opts.rebalanceIntervalMs = 20;
+    DB* db = DB::open("rebalance_test", opts);
+
+    const int N = 20000, KEEP = 100;
+    putAll(db, N);
+    CHECK(ticker(db, "split_nodes") > 0);
+
+    for(int i = 0; i < N; i++) {
+        if(i % KEEP == 0)
+            continue;
+        std::string k = keyOf(i);
+        Slice key(k);
+        CHECK(db->del(key));
+    }
+
+    // the background pass merges the emptied nodes and lowers the root.
+    for(int i = 0; i < 500 && ticker(db, "root_shrinks") == 0; i++)
+        usleep(20 * 1000);
+    CHECK(ticker(db, "node_merges") > 0);
+    CHECK(ticker(db, "root_shrinks") > 0);
+
+    std::string ret;
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        bool kept = i % KEEP == 0;
+        CHECK(getValue(db, k, &ret) == kept);
+        if(kept)
+            CHECK(ret == k);
+    }
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_WARN);
+
+    testDeletesShrinkTree();
+
+    printf("rebalance_test passed\n");
+    return 0;
+}
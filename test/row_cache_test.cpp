@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static AppendOperator appendOperator;
+
+static Options cachedOptions(size_t rowCacheSize)
+{
+    Options opts = smallOptions();
+    opts.rowCacheSize = rowCacheSize;
+    opts.mergeOperator = &appendOperator;
+    return opts;
+}
+
+// the value after a second get, served by the row cache.
+static std::string cachedGet(DB* db, const std::string& k)
+{
+    std::string first, second;
+    bool found = getValue(db, k, &first);
+    CHECK(getValue(db, k, &second) == found);
+    CHECK(second == first);
+    return found ? first : "<none>";
+}
+
+void testWritesInvalidate()
+{
+    DB* db = DB::open("row_cache_test", cachedOptions(1 << 20));
+
+    std::string k("key"), v1("v1"), v2("v2"), x("x");
+    Slice key(k), value1(v1), value2(v2), operand(x);
+
+    CHECK(db->put(key, value1));
+    CHECK(cachedGet(db, k) == "v1");
+    CHECK(statOf(db, "bt.row-cache", "hits") > 0);
+
+    CHECK(db->put(key, value2));
+    CHECK(cachedGet(db, k) == "v2");
+
+    CHECK(db->del(key));
+    CHECK(cachedGet(db, k) == "<none>");
+
+    CHECK(db->put(key, value1));
+    CHECK(cachedGet(db, k) == "v1");
+
+    CHECK(db->merge(key, operand));
+    CHECK(cachedGet(db, k) == "v1,x");
+
+    std::string b("a"), e("z");
+    Slice begin(b), end(e);
+    CHECK(db->deleteRange(begin, end));
+    CHECK(cachedGet(db, k) == "<none>");
+
+    delete db;
+}
+
+void testEviction()
+{
+    // far less than the keys, the CLOCK hand keeps evicting.
+    const int N = 5000;
+    DB* db = DB::open("row_cache_test", cachedOptions(16 << 10));
+
+    std::string ret;
+    for(int round = 0; round < 3; round++) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "%d_", round);
+        putAll(db, N, prefix);
+        for(int i = 0; i < N; i++) {
+            std::string k = keyOf(i);
+            CHECK(cachedGet(db, k) == prefix + k);
+        }
+    }
+    CHECK(statOf(db, "bt.row-cache", "usage") <= (16 << 10));
+    CHECK(statOf(db, "bt.row-cache", "hits") >= 3 * N);
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testWritesInvalidate();
+    testEviction();
+
+    printf("row_cache_test passed\n");
+    return 0;
+}
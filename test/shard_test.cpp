@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int N = 6000;
+
+// puts every key, deletes every third, and reads them all back.
+static void checkShards(const Options& opts)
+{
+    DB* db = DB::open("shard_test", opts);
+    CHECK(db != NULL);
+
+    putAll(db, N);
+    for(int i = 0; i < N; i += 3) {
+        std::string k = keyOf(i);
+        Slice key(k);
+        CHECK(db->del(key));
+    }
+
+    std::string ret;
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        bool live = i % 3 != 0;
+        CHECK(getValue(db, k, &ret) == live);
+        if(live)
+            CHECK(ret == k);
+    }
+    // below and above the loaded keys.
+    CHECK(!getValue(db, "key_", &ret));
+    CHECK(!getValue(db, "zzz", &ret));
+
+    delete db;
+}
+
+void testHashedShards()
+{
+    Options opts = smallOptions();
+    opts.shards = 4;
+    checkShards(opts);
+}
+
+void testRangeShards()
+{
+    Options opts = smallOptions();
+    opts.shards = 3;
+    // a boundary key starts the next shard.
+    opts.shardBoundaries.push_back(keyOf(N / 3));
+    opts.shardBoundaries.push_back(keyOf(2 * N / 3));
+    checkShards(opts);
+
+    // all keys in the last shard, the others stay empty.
+    opts.shardBoundaries[0] = "a";
+    opts.shardBoundaries[1] = "b";
+    checkShards(opts);
+}
+
+void testBadBoundaries()
+{
+    // a count not matching the shards falls back to hashing.
+    Options opts = smallOptions();
+    opts.shards = 3;
+    opts.shardBoundaries.push_back(keyOf(N / 2));
+    checkShards(opts);
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testHashedShards();
+    testRangeShards();
+    testBadBoundaries();
+
+    printf("shard_test passed\n");
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+void testDerivedSizes()
+{
+    // sqrt(4096 / (32 + 8)) pivots, sharing the node's bytes.
+    Options opts;
+    opts.nodeSize = 4096;
+    opts.sanitize();
+    CHECK(opts.maxNodeChildNum == 10);
+    CHECK(opts.maxBufferBytes == 409);
+
+    Options large;
+    large.sanitize();
+    CHECK(large.maxNodeChildNum == 323);
+    CHECK(large.maxBufferBytes == (4 << 20) / 323);
+
+    // what is set is kept, too small a node is raised.
+    Options given;
+    given.nodeSize = 100;
+    given.maxNodeChildNum = 7;
+    given.bufferRatio = 0.5;
+    given.sanitize();
+    CHECK(given.nodeSize == 4096);
+    CHECK(given.maxNodeChildNum == 7);
+    CHECK(given.maxBufferBytes == 2048 / 7);
+
+    Options wide;
+    wide.nodeSize = 4096;
+    wide.keySizeHint = 4096;
+    wide.sanitize();
+    CHECK(wide.maxNodeChildNum == 2);
+}
+
+static std::string valueOf(int i, int round)
+{
+    // up to most of a node, past a whole buffer.
+    size_t size = (i * 37 + round * 1009) % 3000 + 1;
+    return std::string(size, static_cast<char>('a' + (i + round) % 26));
+}
+
+void testMixedValueSizes()
+{
+    // small cache, nodes of every size go out to disk and back.
+    DB* db = DB::open("sizing_test", smallOptions());
+
+    const int N = 2000, R = 3;
+    std::string ret;
+    for(int r = 0; r < R; r++) {
+        for(int i = 0; i < N; i++) {
+            std::string k = keyOf(i), v = valueOf(i, r);
+            Slice key(k), value(v);
+            CHECK(db->put(key, value));
+        }
+        for(int i = 0; i < N; i++) {
+            CHECK(getValue(db, keyOf(i), &ret));
+            CHECK(ret == valueOf(i, r));
+        }
+    }
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testDerivedSizes();
+    testMixedValueSizes();
+
+    printf("sizing_test passed\n");
+    return 0;
+}
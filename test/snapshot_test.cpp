@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int N = 5000;
+
+void testSnapshotReads()
+{
+    DB* db = DB::open("snapshot_test", smallOptions());
+
+    putAll(db, N, "old_");
+    const Snapshot* snapshot = db->getSnapshot();
+
+    // overwrite the even keys, delete the odd ones, then one range.
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i), v = "new_" + k;
+        Slice key(k), value(v);
+        if(i % 2 == 0)
+            CHECK(db->put(key, value));
+        else
+            CHECK(db->del(key));
+    }
+    std::string b = keyOf(1000), e = keyOf(2000);
+    Slice begin(b), end(e);
+    CHECK(db->deleteRange(begin, end));
+
+    std::string ret;
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        Slice key(k);
+        CHECK(db->get(key, &ret, snapshot));
+        CHECK(ret == "old_" + k);
+
+        bool live = i % 2 == 0 && (i < 1000 || i >= 2000);
+        CHECK(getValue(db, k, &ret) == live);
+        if(live)
+            CHECK(ret == "new_" + k);
+    }
+
+    // a snapshot taken now sees the writes so far, and none after it.
+    const Snapshot* later = db->getSnapshot();
+    putAll(db, N, "last_");
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        Slice key(k);
+        bool live = i % 2 == 0 && (i < 1000 || i >= 2000);
+        CHECK(db->get(key, &ret, later) == live);
+        if(live)
+            CHECK(ret == "new_" + k);
+        CHECK(db->get(key, &ret, snapshot));
+        CHECK(ret == "old_" + k);
+    }
+
+    db->releaseSnapshot(later);
+    db->releaseSnapshot(snapshot);
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        CHECK(getValue(db, k, &ret));
+        CHECK(ret == "last_" + k);
+    }
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_WARN);
+
+    testSnapshotReads();
+
+    printf("snapshot_test passed\n");
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int N = 20000;
+
+// the leaf splits of filling N keys in the given order.
+static uint64_t fill(const std::vector<int>& order)
+{
+    Options opts = smallOptions();
+    opts.rebalanceIntervalMs = 0;
+    DB* db = DB::open("split_test", opts);
+
+    std::string v(100, 'v');
+    Slice value(v);
+    for(size_t i = 0; i < order.size(); i++) {
+        std::string k = keyOf(order[i]);
+        Slice key(k);
+        CHECK(db->put(key, value));
+    }
+
+    std::string ret;
+    for(int i = 0; i < N; i++) {
+        CHECK(getValue(db, keyOf(i), &ret));
+        CHECK(ret == v);
+    }
+    uint64_t splits = ticker(db, "split_nodes");
+
+    delete db;
+    return splits;
+}
+
+void testAppendSplits()
+{
+    std::vector<int> order;
+    for(int i = 0; i < N; i++)
+        order.push_back(i);
+    uint64_t sequential = fill(order);
+
+    unsigned int seed = 1;
+    for(int i = N - 1; i > 0; i--)
+        std::swap(order[i], order[rand_r(&seed) % (i + 1)]);
+    uint64_t shuffled = fill(order);
+
+    // appends leave the left leaf full instead of half empty.
+    CHECK(sequential <= shuffled);
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_ERROR);
+
+    testAppendSplits();
+
+    printf("split_test passed\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static DB* db = NULL;
+
+static void put(const char* k, const char* v)
+{
+    std::string ks(k), vs(v);
+    Slice key(ks), value(vs);
+    CHECK(db->put(key, value));
+}
+
+static std::string get(const char* k)
+{
+    std::string ret;
+    if(!getValue(db, k, &ret))
+        return "<none>";
+    return ret;
+}
+
+static std::string txnGet(Transaction* txn, const char* k)
+{
+    std::string ks(k), ret;
+    Slice key(ks);
+    if(!txn->get(key, &ret))
+        return "<none>";
+    return ret;
+}
+
+static void txnPut(Transaction* txn, const char* k, const char* v)
+{
+    std::string ks(k), vs(v);
+    Slice key(ks), value(vs);
+    txn->put(key, value);
+}
+
+void testCommit()
+{
+    put("a", "1");
+
+    Transaction* txn = db->beginTransaction();
+    CHECK(txnGet(txn, "a") == "1");
+    txnPut(txn, "a", "2");
+    txnPut(txn, "b", "3");
+    // its own writes are seen inside, nothing outside before commit.
+    CHECK(txnGet(txn, "a") == "2");
+    CHECK(get("a") == "1");
+    CHECK(get("b") == "<none>");
+    CHECK(txn->commit());
+    delete txn;
+
+    CHECK(get("a") == "2");
+    CHECK(get("b") == "3");
+}
+
+void testConflict()
+{
+    put("x", "0");
+
+    Transaction* first = db->beginTransaction();
+    Transaction* second = db->beginTransaction();
+    CHECK(txnGet(first, "x") == "0");
+    CHECK(txnGet(second, "x") == "0");
+    txnPut(first, "x", "first");
+    txnPut(second, "x", "second");
+    txnPut(second, "y", "second");
+
+    CHECK(first->commit());
+    // x was written since second began, none of its writes apply.
+    CHECK(!second->commit());
+    delete first;
+    delete second;
+
+    CHECK(get("x") == "first");
+    CHECK(get("y") == "<none>");
+}
+
+void testPlainWriteConflicts()
+{
+    put("p", "0");
+
+    Transaction* txn = db->beginTransaction();
+    CHECK(txnGet(txn, "p") == "0");
+    txnPut(txn, "q", "txn");
+    put("p", "plain");
+    CHECK(!txn->commit());
+    delete txn;
+
+    CHECK(get("p") == "plain");
+    CHECK(get("q") == "<none>");
+}
+
+void testDisjointCommit()
+{
+    Transaction* first = db->beginTransaction();
+    Transaction* second = db->beginTransaction();
+    CHECK(txnGet(first, "m") == "<none>");
+    CHECK(txnGet(second, "n") == "<none>");
+    txnPut(first, "m", "1");
+    txnPut(second, "n", "1");
+    CHECK(first->commit());
+    CHECK(second->commit());
+    delete first;
+    delete second;
+
+    CHECK(get("m") == "1");
+    CHECK(get("n") == "1");
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_WARN);
+
+    Options opts;
+    opts.shards = 3;
+    db = DB::open("transaction_test", opts);
+
+    testCommit();
+    testConflict();
+    testPlainWriteConflicts();
+    testDisjointCommit();
+
+    delete db;
+
+    printf("transaction_test passed\n");
+    return 0;
+}
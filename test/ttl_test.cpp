@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+
+#include "Options.h"
+#include "Logger.h"
+#include "DB.h"
+#include "TestUtil.h"
+
+using namespace bt;
+
+static const int N = 5000;
+
+// every third key expired, every third one expiring far ahead and the
+// rest without an expiry.
+static void check(DB* db)
+{
+    std::string ret;
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        bool live = i % 3 != 0;
+        CHECK(getValue(db, k, &ret) == live);
+        if(live)
+            CHECK(ret == k);
+    }
+}
+
+void testExpiry()
+{
+    DB* db = DB::open("ttl_test", smallOptions());
+
+    uint64_t now = time(NULL);
+    for(int i = 0; i < N; i++) {
+        std::string k = keyOf(i);
+        Slice key(k), value(k);
+        if(i % 3 == 0)
+            CHECK(db->put(key, value, now - 1));
+        else if(i % 3 == 1)
+            CHECK(db->put(key, value, now + 3600));
+        else
+            CHECK(db->put(key, value));
+    }
+    check(db);
+
+    // more writes push the expired values down to the leaves, where
+    // they are dropped.
+    for(int i = 0; i < 4 * N; i++) {
+        std::string k = keyOf(N + i);
+        Slice key(k), value(k);
+        CHECK(db->put(key, value));
+    }
+    check(db);
+    CHECK(ticker(db, "expired_bytes") > 0);
+
+    delete db;
+}
+
+void testExpiresLater()
+{
+    Options opts;
+    DB* db = DB::open("ttl_test", opts);
+
+    std::string k("soon"), ret;
+    Slice key(k), value(k);
+    CHECK(db->put(key, value, time(NULL) + 1));
+    CHECK(getValue(db, k, &ret));
+    CHECK(ret == k);
+
+    sleep(2);
+    CHECK(!getValue(db, k, &ret));
+
+    delete db;
+}
+
+int main()
+{
+    ILog4zManager::getRef().start();
+    ILog4zManager::getRef().setLoggerLevel(LOG4Z_MAIN_LOGGER_ID,LOG_LEVEL_WARN);
+
+    testExpiry();
+    testExpiresLater();
+
+    printf("ttl_test passed\n");
+    return 0;
+}